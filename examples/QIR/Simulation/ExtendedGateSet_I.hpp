@@ -0,0 +1,35 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <complex>
+
+#include "CoreTypes.hpp"
+
+namespace Microsoft
+{
+namespace Quantum
+{
+    // Optional extension of the Q# instruction set (`IQuantumGateSet`) for backends that can apply multi-qubit
+    // blocks in one step. Compiler passes that already know a block, e.g. a SWAP, an iSWAP or a fused sequence of
+    // gates on a few qubits, can submit it as a single call instead of a series of single-qubit and controlled
+    // gates. Matrices are given in row-major order over the 2^k basis states of the k targets, where the first
+    // target corresponds to the most significant bit, i.e. a 4x4 matrix on {q0, q1} acts on |q0 q1⟩.
+    struct IExtendedGateSet
+    {
+        virtual ~IExtendedGateSet() {}
+
+        // Exchange the states of two qubits.
+        virtual void Swap(Qubit q1, Qubit q2) = 0;
+
+        // Apply the 2^k x 2^k unitary matrix to the k target qubits.
+        virtual void Unitary(long numTargets, Qubit targets[], const std::complex<double> matrix[]) = 0;
+
+        // Apply the 2^k x 2^k unitary matrix to the k target qubits, controlled on all control qubits being |1⟩.
+        virtual void ControlledUnitary(long numControls, Qubit controls[], long numTargets, Qubit targets[],
+                                       const std::complex<double> matrix[]) = 0;
+    };
+
+} // namespace Quantum
+} // namespace Microsoft
@@ -0,0 +1,459 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include <memory>
+
+#include "AsyncStateSimulator.hpp"
+
+using namespace Microsoft::Quantum;
+
+// Number of times a thread polls for work before blocking on the condition variable. Gates usually follow each
+// other closely, so this avoids the latency of a wake-up most of the time.
+static constexpr int SPIN_COUNT = 1000;
+
+
+///
+/// Pipeline
+///
+
+AsyncStateSimulator::AsyncStateSimulator(uint32_t userProvidedSeed, uint64_t streamId, NoiseModel noise)
+    : sim(userProvidedSeed, streamId, std::move(noise))
+{
+    this->worker = std::thread([this]() { RunWorker(); });
+}
+
+AsyncStateSimulator::~AsyncStateSimulator()
+{
+    Record(GateCall::Stop);
+    Submit();
+    this->worker.join();
+}
+
+GateCall& AsyncStateSimulator::Record(GateCall::Kind kind)
+{
+    GateCall* call;
+    while ((call = this->queue.Back()) == nullptr)
+        std::this_thread::yield();
+    call->kind = kind;
+    return *call;
+}
+
+void AsyncStateSimulator::Submit()
+{
+    this->queue.Push();
+    this->numSubmitted++;
+
+    // Pairs with the fence of a worker going to sleep: either the worker sees the new call, or this thread sees
+    // the worker sleeping and wakes it up.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (this->workerSleeping.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->wakeUp.notify_all();
+    }
+}
+
+void AsyncStateSimulator::RecordSingle(void (StateSimulator::*gate)(Qubit), Qubit q)
+{
+    GateCall& call = Record(GateCall::Single);
+    call.single = gate;
+    call.controls.clear();
+    call.targets.clear();
+    call.target = ToHandle(q);
+    Submit();
+}
+
+void AsyncStateSimulator::RecordControlled(void (StateSimulator::*gate)(long, Qubit[], Qubit), long numControls, Qubit controls[], Qubit target)
+{
+    GateCall& call = Record(GateCall::Controlled);
+    call.controlled = gate;
+    AssignHandles(call.controls, numControls, controls);
+    call.targets.clear();
+    call.target = ToHandle(target);
+    Submit();
+}
+
+void AsyncStateSimulator::Synchronize()
+{
+    for (int spin = 0; spin < SPIN_COUNT && this->numCompleted.load(std::memory_order_acquire) != this->numSubmitted; spin++)
+        std::this_thread::yield();
+    if (this->numCompleted.load(std::memory_order_acquire) != this->numSubmitted) {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->programWaiting.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        this->wakeUp.wait(lock, [this]() {
+            return this->numCompleted.load(std::memory_order_acquire) == this->numSubmitted;
+        });
+        this->programWaiting.store(false, std::memory_order_relaxed);
+    }
+
+    // The simulator state is undefined after a failed call, so every later synchronization fails as well.
+    if (this->error)
+        std::rethrow_exception(this->error);
+}
+
+void AsyncStateSimulator::RunWorker()
+{
+    for (;;) {
+        GateCall* call = this->queue.Front();
+        for (int spin = 0; call == nullptr && spin < SPIN_COUNT; spin++) {
+            std::this_thread::yield();
+            call = this->queue.Front();
+        }
+        if (call == nullptr) {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->workerSleeping.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            this->wakeUp.wait(lock, [this]() { return !this->queue.Empty(); });
+            this->workerSleeping.store(false, std::memory_order_relaxed);
+            continue;
+        }
+
+        if (call->kind == GateCall::Stop) {
+            this->queue.Pop();
+            return;
+        }
+        if (!this->error) {
+            try {
+                Execute(*call);
+            } catch (...) {
+                this->error = std::current_exception();
+            }
+        }
+        this->queue.Pop();
+        this->numCompleted.fetch_add(1, std::memory_order_release);
+
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (this->programWaiting.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->wakeUp.notify_all();
+        }
+    }
+}
+
+void AsyncStateSimulator::Execute(const GateCall& call)
+{
+    AssignBackendQubits(this->workerControls, call.controls);
+    AssignBackendQubits(this->workerTargets, call.targets);
+    long numControls = this->workerControls.size(), numTargets = this->workerTargets.size();
+
+    switch (call.kind) {
+        case GateCall::Allocate:
+            if (this->backendQubits.size() <= static_cast<size_t>(call.target))
+                this->backendQubits.resize(call.target + 1);
+            this->backendQubits[call.target] = this->sim.AllocateQubit();
+            break;
+        case GateCall::Release:
+            this->sim.ReleaseQubit(this->backendQubits[call.target]);
+            break;
+        case GateCall::Single:
+            (this->sim.*call.single)(this->backendQubits[call.target]);
+            break;
+        case GateCall::Controlled:
+            (this->sim.*call.controlled)(numControls, this->workerControls.data(), this->backendQubits[call.target]);
+            break;
+        case GateCall::Rotation:
+            this->sim.ControlledR(numControls, this->workerControls.data(), call.paulis[0],
+                                  this->backendQubits[call.target], call.theta);
+            break;
+        case GateCall::PauliExp:
+            this->sim.ControlledExp(numControls, this->workerControls.data(), numTargets,
+                                    const_cast<PauliId*>(call.paulis.data()), this->workerTargets.data(), call.theta);
+            break;
+        case GateCall::SwapQubits:
+            this->sim.Swap(this->workerTargets[0], this->workerTargets[1]);
+            break;
+        case GateCall::MultiQubit:
+            this->sim.ControlledUnitary(numControls, this->workerControls.data(), numTargets,
+                                        this->workerTargets.data(), call.matrix.data());
+            break;
+        case GateCall::Stop:
+            break;
+    }
+}
+
+
+///
+/// Implementation of IRuntimeDriver
+///
+
+Qubit AsyncStateSimulator::AllocateQubit()
+{
+    // Handles of released qubits are reused. The worker releases the old qubit before allocating the new one.
+    long handle;
+    if (!this->freeHandles.empty()) {
+        handle = this->freeHandles.back();
+        this->freeHandles.pop_back();
+    } else {
+        handle = this->numHandles++;
+    }
+    GateCall& call = Record(GateCall::Allocate);
+    call.controls.clear();
+    call.targets.clear();
+    call.target = handle;
+    Submit();
+    return ToQubit(handle);
+}
+
+void AsyncStateSimulator::ReleaseQubit(Qubit q)
+{
+    GateCall& call = Record(GateCall::Release);
+    call.controls.clear();
+    call.targets.clear();
+    call.target = ToHandle(q);
+    Submit();
+    this->freeHandles.push_back(ToHandle(q));
+}
+
+std::string AsyncStateSimulator::QubitToString(Qubit q)
+{
+    Synchronize();
+    return this->sim.QubitToString(this->backendQubits[ToHandle(q)]);
+}
+
+void AsyncStateSimulator::ReleaseResult(Result r)
+{
+    this->sim.ReleaseResult(r);
+}
+
+bool AsyncStateSimulator::AreEqualResults(Result r1, Result r2)
+{
+    Synchronize();
+    return this->sim.AreEqualResults(r1, r2);
+}
+
+ResultValue AsyncStateSimulator::GetResultValue(Result r)
+{
+    return this->sim.GetResultValue(r);
+}
+
+Result AsyncStateSimulator::UseZero()
+{
+    return this->sim.UseZero();
+}
+
+Result AsyncStateSimulator::UseOne()
+{
+    return this->sim.UseOne();
+}
+
+
+///
+/// Implementation of IQuantumGateSet
+///
+
+void AsyncStateSimulator::X(Qubit q)
+{
+    RecordSingle(&StateSimulator::X, q);
+}
+
+void AsyncStateSimulator::ControlledX(long numControls, Qubit controls[], Qubit target)
+{
+    RecordControlled(&StateSimulator::ControlledX, numControls, controls, target);
+}
+
+void AsyncStateSimulator::Y(Qubit q)
+{
+    RecordSingle(&StateSimulator::Y, q);
+}
+
+void AsyncStateSimulator::ControlledY(long numControls, Qubit controls[], Qubit target)
+{
+    RecordControlled(&StateSimulator::ControlledY, numControls, controls, target);
+}
+
+void AsyncStateSimulator::Z(Qubit q)
+{
+    RecordSingle(&StateSimulator::Z, q);
+}
+
+void AsyncStateSimulator::ControlledZ(long numControls, Qubit controls[], Qubit target)
+{
+    RecordControlled(&StateSimulator::ControlledZ, numControls, controls, target);
+}
+
+void AsyncStateSimulator::H(Qubit q)
+{
+    RecordSingle(&StateSimulator::H, q);
+}
+
+void AsyncStateSimulator::ControlledH(long numControls, Qubit controls[], Qubit target)
+{
+    RecordControlled(&StateSimulator::ControlledH, numControls, controls, target);
+}
+
+void AsyncStateSimulator::S(Qubit q)
+{
+    RecordSingle(&StateSimulator::S, q);
+}
+
+void AsyncStateSimulator::ControlledS(long numControls, Qubit controls[], Qubit target)
+{
+    RecordControlled(&StateSimulator::ControlledS, numControls, controls, target);
+}
+
+void AsyncStateSimulator::AdjointS(Qubit q)
+{
+    RecordSingle(&StateSimulator::AdjointS, q);
+}
+
+void AsyncStateSimulator::ControlledAdjointS(long numControls, Qubit controls[], Qubit target)
+{
+    RecordControlled(&StateSimulator::ControlledAdjointS, numControls, controls, target);
+}
+
+void AsyncStateSimulator::T(Qubit q)
+{
+    RecordSingle(&StateSimulator::T, q);
+}
+
+void AsyncStateSimulator::ControlledT(long numControls, Qubit controls[], Qubit target)
+{
+    RecordControlled(&StateSimulator::ControlledT, numControls, controls, target);
+}
+
+void AsyncStateSimulator::AdjointT(Qubit q)
+{
+    RecordSingle(&StateSimulator::AdjointT, q);
+}
+
+void AsyncStateSimulator::ControlledAdjointT(long numControls, Qubit controls[], Qubit target)
+{
+    RecordControlled(&StateSimulator::ControlledAdjointT, numControls, controls, target);
+}
+
+void AsyncStateSimulator::R(PauliId axis, Qubit q, double theta)
+{
+    ControlledR(0, nullptr, axis, q, theta);
+}
+
+void AsyncStateSimulator::ControlledR(long numControls, Qubit controls[], PauliId axis, Qubit target, double theta)
+{
+    GateCall& call = Record(GateCall::Rotation);
+    AssignHandles(call.controls, numControls, controls);
+    call.targets.clear();
+    call.paulis.assign(1, axis);
+    call.target = ToHandle(target);
+    call.theta = theta;
+    Submit();
+}
+
+void AsyncStateSimulator::Exp(long numTargets, PauliId paulis[], Qubit targets[], double theta)
+{
+    ControlledExp(0, nullptr, numTargets, paulis, targets, theta);
+}
+
+void AsyncStateSimulator::ControlledExp(long numControls, Qubit controls[], long numTargets, PauliId paulis[], Qubit targets[], double theta)
+{
+    GateCall& call = Record(GateCall::PauliExp);
+    AssignHandles(call.controls, numControls, controls);
+    AssignHandles(call.targets, numTargets, targets);
+    call.paulis.assign(paulis, paulis + numTargets);
+    call.theta = theta;
+    Submit();
+}
+
+Result AsyncStateSimulator::Measure(long numBases, PauliId bases[], long numTargets, Qubit targets[])
+{
+    Synchronize();
+    std::vector<Qubit> qubits(numTargets);
+    for (long i = 0; i < numTargets; i++)
+        qubits[i] = this->backendQubits[ToHandle(targets[i])];
+    return this->sim.Measure(numBases, bases, numTargets, qubits.data());
+}
+
+
+///
+/// Implementation of IExtendedGateSet
+///
+
+void AsyncStateSimulator::Swap(Qubit q1, Qubit q2)
+{
+    Qubit qubits[] = {q1, q2};
+    GateCall& call = Record(GateCall::SwapQubits);
+    call.controls.clear();
+    AssignHandles(call.targets, 2, qubits);
+    Submit();
+}
+
+void AsyncStateSimulator::Unitary(long numTargets, Qubit targets[], const std::complex<double> matrix[])
+{
+    ControlledUnitary(0, nullptr, numTargets, targets, matrix);
+}
+
+void AsyncStateSimulator::ControlledUnitary(long numControls, Qubit controls[], long numTargets, Qubit targets[], const std::complex<double> matrix[])
+{
+    GateCall& call = Record(GateCall::MultiQubit);
+    AssignHandles(call.controls, numControls, controls);
+    AssignHandles(call.targets, numTargets, targets);
+    call.matrix.assign(matrix, matrix + (uint64_t(1) << (2 * numTargets)));
+    Submit();
+}
+
+
+///
+/// Implementation of IDiagnostics
+///
+
+bool AsyncStateSimulator::Assert(long numTargets, PauliId* bases, Qubit* targets, Result result, const char* failureMessage)
+{
+    Synchronize();
+    std::vector<Qubit> qubits(numTargets);
+    for (long i = 0; i < numTargets; i++)
+        qubits[i] = this->backendQubits[ToHandle(targets[i])];
+    return this->sim.Assert(numTargets, bases, qubits.data(), result, failureMessage);
+}
+
+bool AsyncStateSimulator::AssertProbability(long numTargets, PauliId bases[], Qubit targets[], double probabilityOfZero, double precision, const char* failureMessage)
+{
+    Synchronize();
+    std::vector<Qubit> qubits(numTargets);
+    for (long i = 0; i < numTargets; i++)
+        qubits[i] = this->backendQubits[ToHandle(targets[i])];
+    return this->sim.AssertProbability(numTargets, bases, qubits.data(), probabilityOfZero, precision, failureMessage);
+}
+
+void AsyncStateSimulator::GetState(TGetStateCallback callback)
+{
+    Synchronize();
+    this->sim.GetState(callback);
+}
+
+void AsyncStateSimulator::DumpMachine(const void* location)
+{
+    Synchronize();
+    this->sim.DumpMachine(location);
+}
+
+void AsyncStateSimulator::DumpRegister(const void* location, const QirArray* qubits)
+{
+    // The register holds handles, which are swapped for the simulator's qubits during the call.
+    Synchronize();
+    Qubit* buffer = reinterpret_cast<Qubit*>(qubits->buffer);
+    std::vector<Qubit> handles(buffer, buffer + qubits->count);
+    for (size_t i = 0; i < handles.size(); i++)
+        buffer[i] = this->backendQubits[ToHandle(handles[i])];
+    try {
+        this->sim.DumpRegister(location, qubits);
+    } catch (...) {
+        std::copy(handles.begin(), handles.end(), buffer);
+        throw;
+    }
+    std::copy(handles.begin(), handles.end(), buffer);
+}
+
+
+///
+/// Runtime driver instantiation
+///
+
+namespace Microsoft
+{
+namespace Quantum
+{
+    std::unique_ptr<IRuntimeDriver> CreateAsyncStateSimulator(uint32_t userProvidedSeed)
+    {
+        return std::make_unique<AsyncStateSimulator>(userProvidedSeed);
+    }
+
+} // namespace Quantum
+} // namespace Microsoft
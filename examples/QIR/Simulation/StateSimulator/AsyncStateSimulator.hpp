@@ -0,0 +1,223 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <atomic>
+#include <complex>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "QirRuntimeApi_I.hpp"
+#include "QSharpSimApi_I.hpp"
+#include "../ExtendedGateSet_I.hpp"
+
+#include "SpscQueue.hpp"
+#include "StateSimulator.hpp"
+
+namespace Microsoft
+{
+namespace Quantum
+{
+    // A gate set call recorded by the program thread for the worker, with copies of its qubit and Pauli arrays.
+    struct GateCall
+    {
+        enum Kind { Allocate, Release, Single, Controlled, Rotation, PauliExp, SwapQubits, MultiQubit, Stop };
+        Kind kind = Stop;
+
+        void (StateSimulator::*single)(Qubit) = nullptr;
+        void (StateSimulator::*controlled)(long, Qubit[], Qubit) = nullptr;
+
+        // Qubits are given as handles of the `AsyncStateSimulator`, translated by the worker.
+        long target = 0;
+        std::vector<long> controls;
+        std::vector<long> targets;
+        std::vector<PauliId> paulis;
+        std::vector<std::complex<double>> matrix;
+        double theta = 0.0;
+    };
+
+    // Runs a `StateSimulator` on a dedicated worker thread, so that the thread executing the QIR program does not
+    // wait for the state vector kernels. Gates, allocations and releases are recorded in a lock-free single-producer
+    // single-consumer queue and return at once, while the worker applies them in order. The classical parts of a
+    // hybrid program, such as array manipulation or callable dispatch in the runtime, thereby overlap with the
+    // gates before them.
+    //
+    // Only calls returning information about the state wait for the queue to drain: measurements, result
+    // comparisons, diagnostics and `QubitToString`. Qubits are handed out as handles of this class, as the
+    // simulator's own qubits only exist once the worker gets to the allocation. Exceptions thrown on the worker
+    // are rethrown by the next call that waits.
+    class AsyncStateSimulator : public IRuntimeDriver, public IQuantumGateSet, public IDiagnostics, public IExtendedGateSet
+    {
+        static constexpr size_t QUEUE_CAPACITY = 1024;
+
+        StateSimulator sim;
+        SpscQueue<GateCall, QUEUE_CAPACITY> queue;
+        std::thread worker;
+
+        // Calls recorded by the program thread, and calls completed by the worker.
+        uint64_t numSubmitted = 0;
+        std::atomic<uint64_t> numCompleted{0};
+
+        // Either thread blocks on the condition variable after spinning for a while, announcing it in its flag.
+        std::mutex mutex;
+        std::condition_variable wakeUp;
+        std::atomic<bool> workerSleeping{false};
+        std::atomic<bool> programWaiting{false};
+
+        // First exception thrown by a call on the worker, after which the remaining calls are skipped.
+        std::exception_ptr error;
+
+        // Handles given out by `AllocateQubit` (program thread), and the qubits of the simulator behind the handles
+        // (worker thread).
+        long numHandles = 0;
+        std::vector<long> freeHandles;
+        std::vector<Qubit> backendQubits;
+
+        static Qubit ToQubit(long handle)
+        {
+            return reinterpret_cast<Qubit>(handle + 1);
+        }
+        static long ToHandle(Qubit q)
+        {
+            return reinterpret_cast<intptr_t>(q) - 1;
+        }
+        static void AssignHandles(std::vector<long>& handles, long count, const Qubit qubits[])
+        {
+            handles.resize(count);
+            for (long i = 0; i < count; i++)
+                handles[i] = ToHandle(qubits[i]);
+        }
+        void AssignBackendQubits(std::vector<Qubit>& qubits, const std::vector<long>& handles) const
+        {
+            qubits.resize(handles.size());
+            for (size_t i = 0; i < handles.size(); i++)
+                qubits[i] = this->backendQubits[handles[i]];
+        }
+
+        // Program thread: a slot to fill for the next call, waiting while the queue is full, and its submission.
+        GateCall& Record(GateCall::Kind kind);
+        void Submit();
+        void RecordSingle(void (StateSimulator::*gate)(Qubit), Qubit q);
+        void RecordControlled(void (StateSimulator::*gate)(long, Qubit[], Qubit), long numControls, Qubit controls[], Qubit target);
+
+        // Program thread: waits until the worker has completed all recorded calls.
+        void Synchronize();
+
+        // Worker thread: the scratch arrays of simulator qubits the handles of a call are translated into.
+        std::vector<Qubit> workerControls, workerTargets;
+
+        void RunWorker();
+        void Execute(const GateCall& call);
+
+      public:
+        AsyncStateSimulator(uint32_t userProvidedSeed = 0, uint64_t streamId = 0, NoiseModel noise = NoiseModel());
+        ~AsyncStateSimulator();
+
+        // Direct access to the simulator, e.g. to change its noise model or dump options, once all recorded calls
+        // have been completed. Qubits of the simulator are not the handles of this class.
+        StateSimulator& GetSimulator()
+        {
+            Synchronize();
+            return this->sim;
+        }
+
+
+        ///
+        /// Implementation of IRuntimeDriver
+        ///
+        void ReleaseResult(Result r) override;
+
+        bool AreEqualResults(Result r1, Result r2) override;
+
+        ResultValue GetResultValue(Result r) override;
+
+        Result UseZero() override;
+
+        Result UseOne() override;
+
+        Qubit AllocateQubit() override;
+
+        void ReleaseQubit(Qubit q) override;
+
+        std::string QubitToString(Qubit q) override;
+
+
+        ///
+        /// Implementation of IQuantumGateSet
+        ///
+        void X(Qubit q) override;
+
+        void ControlledX(long numControls, Qubit controls[], Qubit target) override;
+
+        void Y(Qubit q) override;
+
+        void ControlledY(long numControls, Qubit controls[], Qubit target) override;
+
+        void Z(Qubit q) override;
+
+        void ControlledZ(long numControls, Qubit controls[], Qubit target) override;
+
+        void H(Qubit q) override;
+
+        void ControlledH(long numControls, Qubit controls[], Qubit target) override;
+
+        void S(Qubit q) override;
+
+        void ControlledS(long numControls, Qubit controls[], Qubit target) override;
+
+        void AdjointS(Qubit q) override;
+
+        void ControlledAdjointS(long numControls, Qubit controls[], Qubit target) override;
+
+        void T(Qubit q) override;
+
+        void ControlledT(long numControls, Qubit controls[], Qubit target) override;
+
+        void AdjointT(Qubit q) override;
+
+        void ControlledAdjointT(long numControls, Qubit controls[], Qubit target) override;
+
+        void R(PauliId axis, Qubit target, double theta) override;
+
+        void ControlledR(long numControls, Qubit controls[], PauliId axis, Qubit target, double theta) override;
+
+        void Exp(long numTargets, PauliId paulis[], Qubit targets[], double theta) override;
+
+        void ControlledExp(long numControls, Qubit controls[], long numTargets, PauliId paulis[], Qubit targets[], double theta) override;
+
+        Result Measure(long numBases, PauliId bases[], long numTargets, Qubit targets[]) override;
+
+
+        ///
+        /// Implementation of IExtendedGateSet
+        ///
+        void Swap(Qubit q1, Qubit q2) override;
+
+        void Unitary(long numTargets, Qubit targets[], const std::complex<double> matrix[]) override;
+
+        void ControlledUnitary(long numControls, Qubit controls[], long numTargets, Qubit targets[], const std::complex<double> matrix[]) override;
+
+
+        ///
+        /// Implementation of IDiagnostics
+        ///
+        bool Assert(long numTargets, PauliId* bases, Qubit* targets, Result result, const char* failureMessage) override;
+
+        bool AssertProbability(long numTargets, PauliId bases[], Qubit targets[], double probabilityOfZero, double precision, const char* failureMessage) override;
+
+        // Deprecated, use `DumpMachine()` and `DumpRegister()` instead.
+        void GetState(TGetStateCallback callback) override;
+
+        void DumpMachine(const void* location) override;
+
+        void DumpRegister(const void* location, const QirArray* qubits) override;
+
+    }; // class AsyncStateSimulator
+
+} // namespace Quantum
+} // namespace Microsoft
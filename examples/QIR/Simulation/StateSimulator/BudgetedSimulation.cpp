@@ -0,0 +1,265 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include <algorithm>
+#include <cassert>
+#include <memory>
+
+#include "BudgetedSimulator.hpp"
+
+using namespace Microsoft::Quantum;
+
+
+BudgetedSimulator::BudgetedSimulator(uint32_t userProvidedSeed, uint64_t memoryBudget, bool sparseFallback)
+    : memoryBudget(memoryBudget)
+    , sparseFallback(sparseFallback)
+    , dense(std::make_unique<StateSimulator>(userProvidedSeed))
+{
+    this->qbm = new CQubitManager();
+    this->dense->SetMemoryBudget(memoryBudget);
+    this->driver = this->dense.get();
+    this->gateSet = this->dense.get();
+}
+
+void BudgetedSimulator::HandOver()
+{
+    // The state simulator lists the amplitudes over its qubits in order of allocation, which the sparse simulator
+    // allocates in the same order, continuing the same random sequence.
+    auto sparse = std::make_unique<SparseStateSimulator>();
+    sparse->SetMemoryBudget(this->memoryBudget);
+    sparse->SetRngState(this->dense->GetRngState());
+    std::vector<Qubit> qubits;
+    for (size_t i = 0; i < this->allocationOrder.size(); i++)
+        qubits.push_back(sparse->AllocateQubit());
+
+    // Count the non-zero amplitudes first, so that a state too dense for the budget fails before any of them is
+    // copied, with the run left to the state simulator.
+    size_t numAmplitudes = 0;
+    this->dense->GetState([&numAmplitudes](size_t, double re, double im) {
+        numAmplitudes += re != 0.0 || im != 0.0;
+        return true;
+    });
+    sparse->CheckMemoryBudget(numAmplitudes);
+
+    SparseState amplitudes;
+    amplitudes.reserve(numAmplitudes);
+    this->dense->GetState([&amplitudes](size_t idx, double re, double im) {
+        if (re != 0.0 || im != 0.0)
+            amplitudes[idx] = {re, im};
+        return true;
+    });
+    this->dense.reset();
+    sparse->SetState(qubits.size(), qubits.data(), amplitudes);
+
+    for (size_t i = 0; i < qubits.size(); i++)
+        this->backendQubits[this->allocationOrder[i]] = qubits[i];
+    this->sparse = std::move(sparse);
+    this->driver = this->sparse.get();
+    this->gateSet = this->sparse.get();
+}
+
+Qubit BudgetedSimulator::ToBackend(Qubit q)
+{
+    return this->backendQubits.at(q);
+}
+
+std::vector<Qubit> BudgetedSimulator::ToBackend(long numQubits, Qubit qubits[])
+{
+    std::vector<Qubit> translated(numQubits);
+    for (long i = 0; i < numQubits; i++)
+        translated[i] = ToBackend(qubits[i]);
+    return translated;
+}
+
+
+///
+/// Qubit management
+///
+
+Qubit BudgetedSimulator::AllocateQubit()
+{
+    // Beyond the budget, the state simulator throws unless the run is handed over first.
+    if (this->dense && this->sparseFallback && !this->dense->FitsMemoryBudget(this->allocationOrder.size() + 1))
+        HandOver();
+    Qubit backend = this->driver->AllocateQubit();
+    Qubit q = this->qbm->Allocate();
+    this->allocationOrder.push_back(q);
+    this->backendQubits[q] = backend;
+    return q;
+}
+
+void BudgetedSimulator::ReleaseQubit(Qubit q)
+{
+    this->driver->ReleaseQubit(ToBackend(q));
+    this->backendQubits.erase(q);
+    this->allocationOrder.erase(std::find(this->allocationOrder.begin(), this->allocationOrder.end(), q));
+    this->qbm->Release(q);
+}
+
+std::string BudgetedSimulator::QubitToString(Qubit q)
+{
+    return std::to_string(this->qbm->GetQubitId(q));
+}
+
+
+///
+/// Result management
+///
+
+// Both backends represent results the same way, so results stay valid when the run is handed over.
+static Result zero = reinterpret_cast<Result>(0);
+static Result one = reinterpret_cast<Result>(1);
+
+void BudgetedSimulator::ReleaseResult(Result r) {}
+
+bool BudgetedSimulator::AreEqualResults(Result r1, Result r2)
+{
+    return (r1 == r2);
+}
+
+ResultValue BudgetedSimulator::GetResultValue(Result r)
+{
+    return (r == one) ? Result_One : Result_Zero;
+}
+
+Result BudgetedSimulator::UseZero()
+{
+    return zero;
+}
+
+Result BudgetedSimulator::UseOne()
+{
+    return one;
+}
+
+
+///
+/// Supported quantum operations
+///
+
+void BudgetedSimulator::X(Qubit q)
+{
+    this->gateSet->X(ToBackend(q));
+}
+
+void BudgetedSimulator::ControlledX(long numControls, Qubit controls[], Qubit target)
+{
+    this->gateSet->ControlledX(numControls, ToBackend(numControls, controls).data(), ToBackend(target));
+}
+
+void BudgetedSimulator::Y(Qubit q)
+{
+    this->gateSet->Y(ToBackend(q));
+}
+
+void BudgetedSimulator::ControlledY(long numControls, Qubit controls[], Qubit target)
+{
+    this->gateSet->ControlledY(numControls, ToBackend(numControls, controls).data(), ToBackend(target));
+}
+
+void BudgetedSimulator::Z(Qubit q)
+{
+    this->gateSet->Z(ToBackend(q));
+}
+
+void BudgetedSimulator::ControlledZ(long numControls, Qubit controls[], Qubit target)
+{
+    this->gateSet->ControlledZ(numControls, ToBackend(numControls, controls).data(), ToBackend(target));
+}
+
+void BudgetedSimulator::H(Qubit q)
+{
+    this->gateSet->H(ToBackend(q));
+}
+
+void BudgetedSimulator::ControlledH(long numControls, Qubit controls[], Qubit target)
+{
+    this->gateSet->ControlledH(numControls, ToBackend(numControls, controls).data(), ToBackend(target));
+}
+
+void BudgetedSimulator::S(Qubit q)
+{
+    this->gateSet->S(ToBackend(q));
+}
+
+void BudgetedSimulator::ControlledS(long numControls, Qubit controls[], Qubit target)
+{
+    this->gateSet->ControlledS(numControls, ToBackend(numControls, controls).data(), ToBackend(target));
+}
+
+void BudgetedSimulator::AdjointS(Qubit q)
+{
+    this->gateSet->AdjointS(ToBackend(q));
+}
+
+void BudgetedSimulator::ControlledAdjointS(long numControls, Qubit controls[], Qubit target)
+{
+    this->gateSet->ControlledAdjointS(numControls, ToBackend(numControls, controls).data(), ToBackend(target));
+}
+
+void BudgetedSimulator::T(Qubit q)
+{
+    this->gateSet->T(ToBackend(q));
+}
+
+void BudgetedSimulator::ControlledT(long numControls, Qubit controls[], Qubit target)
+{
+    this->gateSet->ControlledT(numControls, ToBackend(numControls, controls).data(), ToBackend(target));
+}
+
+void BudgetedSimulator::AdjointT(Qubit q)
+{
+    this->gateSet->AdjointT(ToBackend(q));
+}
+
+void BudgetedSimulator::ControlledAdjointT(long numControls, Qubit controls[], Qubit target)
+{
+    this->gateSet->ControlledAdjointT(numControls, ToBackend(numControls, controls).data(), ToBackend(target));
+}
+
+void BudgetedSimulator::R(PauliId axis, Qubit q, double theta)
+{
+    this->gateSet->R(axis, ToBackend(q), theta);
+}
+
+void BudgetedSimulator::ControlledR(long numControls, Qubit controls[], PauliId axis, Qubit target, double theta)
+{
+    this->gateSet->ControlledR(numControls, ToBackend(numControls, controls).data(), axis, ToBackend(target), theta);
+}
+
+void BudgetedSimulator::Exp(long numTargets, PauliId paulis[], Qubit targets[], double theta)
+{
+    this->gateSet->Exp(numTargets, paulis, ToBackend(numTargets, targets).data(), theta);
+}
+
+void BudgetedSimulator::ControlledExp(long numControls, Qubit controls[], long numTargets, PauliId paulis[], Qubit targets[], double theta)
+{
+    this->gateSet->ControlledExp(numControls, ToBackend(numControls, controls).data(),
+                                 numTargets, paulis, ToBackend(numTargets, targets).data(), theta);
+}
+
+Result BudgetedSimulator::Measure(long numBases, PauliId bases[], long numTargets, Qubit targets[])
+{
+    assert(numBases == numTargets);
+    return this->gateSet->Measure(numBases, bases, numTargets, ToBackend(numTargets, targets).data());
+}
+
+
+///
+/// Runtime driver instantiation
+///
+
+namespace Microsoft
+{
+namespace Quantum
+{
+    // State simulator limited to `memoryBudget` bytes of state vector (zero for no limit), optionally handing
+    // the run over to the sparse simulator instead of failing once the budget is exceeded.
+    std::unique_ptr<IRuntimeDriver> CreateBudgetedSimulator(uint32_t userProvidedSeed, uint64_t memoryBudget,
+                                                            bool sparseFallback)
+    {
+        return std::make_unique<BudgetedSimulator>(userProvidedSeed, memoryBudget, sparseFallback);
+    }
+
+} // namespace Quantum
+} // namespace Microsoft
@@ -0,0 +1,133 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "QirRuntimeApi_I.hpp"
+#include "QSharpSimApi_I.hpp"
+
+#include "QubitManager.hpp"
+#include "SparseStateSimulator.hpp"
+#include "StateSimulator.hpp"
+
+namespace Microsoft
+{
+namespace Quantum
+{
+    // Runs a StateSimulator within a memory budget for its state vector. Allocating a qubit beyond the budget
+    // throws a runtime error naming the number of qubits and the bytes their state vector would need, before any
+    // memory is allocated. With the sparse fallback enabled, such an allocation instead hands the run over to a
+    // SparseStateSimulator, which only stores the non-zero amplitudes and receives all further operations. This
+    // suits the few basis states of arithmetic and oracle circuits on many qubits. The sparse simulator keeps to the
+    // same budget, so a state with too many non-zero amplitudes still fails predictably, at the hand-over or later.
+    class BudgetedSimulator : public IRuntimeDriver, public IQuantumGateSet
+    {
+        // Associated qubit manager instance to handle qubit representation.
+        CQubitManager *qbm;
+
+        uint64_t memoryBudget;
+        bool sparseFallback;
+        std::unique_ptr<StateSimulator> dense;
+        std::unique_ptr<SparseStateSimulator> sparse;
+
+        // The backend receiving all operations, the state simulator until the run is handed over.
+        IRuntimeDriver* driver;
+        IQuantumGateSet* gateSet;
+
+        // Qubits handed out by this simulator in order of allocation, and the qubit of the backend behind each.
+        std::vector<Qubit> allocationOrder;
+        std::unordered_map<Qubit, Qubit> backendQubits;
+
+        // Moves the state of the state simulator into a sparse simulator, which takes over the run.
+        void HandOver();
+        Qubit ToBackend(Qubit q);
+        std::vector<Qubit> ToBackend(long numQubits, Qubit qubits[]);
+
+      public:
+        // A budget of zero bytes imposes no limit.
+        BudgetedSimulator(uint32_t userProvidedSeed = 0, uint64_t memoryBudget = 0, bool sparseFallback = false);
+        ~BudgetedSimulator()
+        {
+            delete this->qbm;
+        }
+
+        // Whether the run has been handed over to the sparse simulator.
+        bool IsHandedOver() const
+        {
+            return this->sparse != nullptr;
+        }
+
+
+        ///
+        /// Implementation of IRuntimeDriver
+        ///
+        void ReleaseResult(Result r) override;
+
+        bool AreEqualResults(Result r1, Result r2) override;
+
+        ResultValue GetResultValue(Result r) override;
+
+        Result UseZero() override;
+
+        Result UseOne() override;
+
+        Qubit AllocateQubit() override;
+
+        void ReleaseQubit(Qubit q) override;
+
+        std::string QubitToString(Qubit q) override;
+
+
+        ///
+        /// Implementation of IQuantumGateSet
+        ///
+        void X(Qubit q) override;
+
+        void ControlledX(long numControls, Qubit controls[], Qubit target) override;
+
+        void Y(Qubit q) override;
+
+        void ControlledY(long numControls, Qubit controls[], Qubit target) override;
+
+        void Z(Qubit q) override;
+
+        void ControlledZ(long numControls, Qubit controls[], Qubit target) override;
+
+        void H(Qubit q) override;
+
+        void ControlledH(long numControls, Qubit controls[], Qubit target) override;
+
+        void S(Qubit q) override;
+
+        void ControlledS(long numControls, Qubit controls[], Qubit target) override;
+
+        void AdjointS(Qubit q) override;
+
+        void ControlledAdjointS(long numControls, Qubit controls[], Qubit target) override;
+
+        void T(Qubit q) override;
+
+        void ControlledT(long numControls, Qubit controls[], Qubit target) override;
+
+        void AdjointT(Qubit q) override;
+
+        void ControlledAdjointT(long numControls, Qubit controls[], Qubit target) override;
+
+        void R(PauliId axis, Qubit target, double theta) override;
+
+        void ControlledR(long numControls, Qubit controls[], PauliId axis, Qubit target, double theta) override;
+
+        void Exp(long numTargets, PauliId paulis[], Qubit targets[], double theta) override;
+
+        void ControlledExp(long numControls, Qubit controls[], long numTargets, PauliId paulis[], Qubit targets[], double theta) override;
+
+        Result Measure(long numBases, PauliId bases[], long numTargets, Qubit targets[]) override;
+
+    }; // class BudgetedSimulator
+
+} // namespace Quantum
+} // namespace Microsoft
@@ -0,0 +1,179 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "QirRuntimeApi_I.hpp"
+#include "QSharpSimApi_I.hpp"
+
+#include "QubitManager.hpp"
+#include "NoiseModel.hpp"
+#include "RandomGenerator.hpp"
+
+#include "Eigen/Dense"
+
+// Single-qubit superoperator acting on the pair (row bit, column bit) of a qubit in the vectorized density matrix.
+using Superoperator = Eigen::Matrix4cd;
+
+namespace Microsoft
+{
+namespace Quantum
+{
+    // Mixed state simulator for noisy runs. The density matrix ρ of n qubits is stored as a vector of 2^(2n)
+    // entries, ρ_rc at index r·2^n + c, i.e. as a state over 2n bits where the high n bits hold the row and the
+    // low n bits the column. A gate is applied in place as ρ → UρU^†, i.e. U on the row bits and U* on the column
+    // bits, and noise channels from a noise model act right after each operation. For single-qubit gates the gate
+    // and its noise are fused into one 4x4 superoperator applied in a single pass.
+    class DensityMatrixSimulator : public IRuntimeDriver, public IQuantumGateSet
+    {
+        // Associated qubit manager instance to handle qubit representation.
+        CQubitManager *qbm;
+
+        // The register of currently active qubits.
+        short numActiveQubits = 0;
+        std::vector<Qubit> computeRegister;
+
+        // Vectorized density matrix, starting out as the scalar 1.
+        Eigen::VectorXcd rho = Eigen::VectorXcd::Ones(1);
+
+        // Noise channels and their superoperators, cached per operation name.
+        NoiseModel noise;
+        std::unordered_map<std::string, Superoperator> noiseSuperoperators;
+
+        // Per-simulator PRNG used to sample measurement outcomes.
+        RandomGenerator rng;
+
+        // To be called on allocation/deallocation of qubits to update the density matrix.
+        void UpdateState(short qubitIndex, bool remove = false);
+
+        // To be called by quantum gate set operations, `name` selects the noise channels of the operation.
+        void ApplyGate(const Eigen::Matrix2cd& gate, const std::string& name, Qubit target);
+        void ApplyControlledGate(const Eigen::Matrix2cd& gate, const std::string& name, long numControls, Qubit controls[], Qubit target);
+        void ApplyPauliExp(const std::string& name, long numControls, Qubit controls[], long numTargets, PauliId paulis[], Qubit targets[], double theta);
+
+        // In-place kernels on the vectorized density matrix.
+        void ApplySuperoperator(const Superoperator& op, short qubitIndex);
+        void ApplyOneSided(const Eigen::Matrix2cd& gate, long targetMask, long controlMask);
+        void ApplyPauliSum(std::complex<double> alpha, std::complex<double> beta, long xMask, long zMask,
+                           std::complex<double> phase, long controlMask);
+        void ApplyNoise(const std::string& name, short qubitIndex);
+
+        const Superoperator& NoiseSuperoperator(const std::string& name);
+
+        short GetQubitIdx(Qubit q)
+        {
+            return std::distance(
+                this->computeRegister.begin(),
+                std::find(this->computeRegister.begin(), this->computeRegister.end(), q)
+            );
+        }
+
+        // Bits of a qubit in the row and column part of the vectorized density matrix.
+        long RowMask(short qubitIndex) const
+        {
+            return 1L << (2 * this->numActiveQubits - 1 - qubitIndex);
+        }
+        long ColumnMask(short qubitIndex) const
+        {
+            return 1L << (this->numActiveQubits - 1 - qubitIndex);
+        }
+
+      public:
+        DensityMatrixSimulator(uint32_t userProvidedSeed = 0, uint64_t streamId = 0, NoiseModel noise = NoiseModel())
+            : noise(std::move(noise))
+            , rng(userProvidedSeed, streamId)
+        {
+            this->qbm = new CQubitManager();
+        }
+        ~DensityMatrixSimulator()
+        {
+            delete this->qbm;
+        }
+
+        void SetNoiseModel(NoiseModel model)
+        {
+            this->noise = std::move(model);
+            this->noiseSuperoperators.clear();
+        }
+
+        // Reads the noise model from a file, see NoiseModel.hpp for the format.
+        void LoadNoiseModel(const std::string& path)
+        {
+            SetNoiseModel(NoiseModel::FromFile(path));
+        }
+
+
+        ///
+        /// Implementation of IRuntimeDriver
+        ///
+        void ReleaseResult(Result r) override;
+
+        bool AreEqualResults(Result r1, Result r2) override;
+
+        ResultValue GetResultValue(Result r) override;
+
+        Result UseZero() override;
+
+        Result UseOne() override;
+
+        Qubit AllocateQubit() override;
+
+        void ReleaseQubit(Qubit q) override;
+
+        std::string QubitToString(Qubit q) override;
+
+
+        ///
+        /// Implementation of IQuantumGateSet
+        ///
+        void X(Qubit q) override;
+
+        void ControlledX(long numControls, Qubit controls[], Qubit target) override;
+
+        void Y(Qubit q) override;
+
+        void ControlledY(long numControls, Qubit controls[], Qubit target) override;
+
+        void Z(Qubit q) override;
+
+        void ControlledZ(long numControls, Qubit controls[], Qubit target) override;
+
+        void H(Qubit q) override;
+
+        void ControlledH(long numControls, Qubit controls[], Qubit target) override;
+
+        void S(Qubit q) override;
+
+        void ControlledS(long numControls, Qubit controls[], Qubit target) override;
+
+        void AdjointS(Qubit q) override;
+
+        void ControlledAdjointS(long numControls, Qubit controls[], Qubit target) override;
+
+        void T(Qubit q) override;
+
+        void ControlledT(long numControls, Qubit controls[], Qubit target) override;
+
+        void AdjointT(Qubit q) override;
+
+        void ControlledAdjointT(long numControls, Qubit controls[], Qubit target) override;
+
+        void R(PauliId axis, Qubit target, double theta) override;
+
+        void ControlledR(long numControls, Qubit controls[], PauliId axis, Qubit target, double theta) override;
+
+        void Exp(long numTargets, PauliId paulis[], Qubit targets[], double theta) override;
+
+        void ControlledExp(long numControls, Qubit controls[], long numTargets, PauliId paulis[], Qubit targets[], double theta) override;
+
+        Result Measure(long numBases, PauliId bases[], long numTargets, Qubit targets[]) override;
+
+    }; // class DensityMatrixSimulator
+
+} // namespace Quantum
+} // namespace Microsoft
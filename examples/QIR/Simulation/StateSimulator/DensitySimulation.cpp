@@ -0,0 +1,446 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include <bitset>
+#include <cmath>
+#include <complex>
+
+#include "DensityMatrixSimulator.hpp"
+
+using namespace Microsoft::Quantum;
+using namespace Eigen;
+using namespace std::complex_literals;
+
+# define PI 3.14159265358979323846
+
+static bool Parity(long word)
+{
+    return std::bitset<64>(static_cast<uint64_t>(word)).count() % 2;
+}
+
+// Removes the bit at the given position, shifting the higher bits down.
+static long RemoveBit(long word, short position)
+{
+    long low = word & ((1L << position) - 1);
+    return ((word >> (position + 1)) << position) | low;
+}
+
+// The superoperator K ⊗ K* of ρ → KρK^†, indexed by (row bit, column bit) pairs.
+static Superoperator BuildSuperoperator(const Matrix2cd& k)
+{
+    Superoperator op;
+    for (int a = 0; a < 2; a++)
+        for (int b = 0; b < 2; b++)
+            for (int c = 0; c < 2; c++)
+                for (int d = 0; d < 2; d++)
+                    op((a << 1) | b, (c << 1) | d) = k(a, c) * std::conj(k(b, d));
+    return op;
+}
+
+
+///
+/// State manipulation
+///
+
+void DensityMatrixSimulator::UpdateState(short qubitIndex, bool remove)
+{
+    short n = this->numActiveQubits;
+    if (!remove) {
+        // ρ' = ρ ⊗ |0⟩〈0|: the new qubit becomes the lowest row and column bit and is zero in both.
+        VectorXcd extended = VectorXcd::Zero(1L << (2 * (n + 1)));
+        long dim = 1L << n;
+        for (long r = 0; r < dim; r++)
+            for (long c = 0; c < dim; c++)
+                extended(((r << 1) << (n + 1)) | (c << 1)) = this->rho((r << n) | c);
+        this->rho = extended;
+    } else {
+        // ρ' = tr_i[ρ], which is exact for mixed states: sum the entries whose row and column bit of the qubit agree.
+        short position = n - 1 - qubitIndex;
+        VectorXcd reduced = VectorXcd::Zero(1L << (2 * (n - 1)));
+        long dim = 1L << n;
+        for (long r = 0; r < dim; r++) {
+            long rowBit = r & (1L << position);
+            for (long c = 0; c < dim; c++) {
+                if ((c & (1L << position)) != rowBit)
+                    continue;
+                reduced((RemoveBit(r, position) << (n - 1)) | RemoveBit(c, position)) += this->rho((r << n) | c);
+            }
+        }
+        this->rho = reduced;
+    }
+}
+
+void DensityMatrixSimulator::ApplySuperoperator(const Superoperator& op, short qubitIndex)
+{
+    // Each group of four entries ρ_rc sharing all bits but the qubit's row and column bit is mixed by the 4x4 operator.
+    long rowMask = RowMask(qubitIndex), colMask = ColumnMask(qubitIndex);
+    long size = this->rho.size();
+    for (long i = 0; i < size; i++) {
+        if (i & (rowMask | colMask))
+            continue;
+        Vector4cd v(this->rho(i), this->rho(i | colMask), this->rho(i | rowMask), this->rho(i | rowMask | colMask));
+        v = op * v;
+        this->rho(i) = v(0);
+        this->rho(i | colMask) = v(1);
+        this->rho(i | rowMask) = v(2);
+        this->rho(i | rowMask | colMask) = v(3);
+    }
+}
+
+void DensityMatrixSimulator::ApplyOneSided(const Matrix2cd& gate, long targetMask, long controlMask)
+{
+    long size = this->rho.size();
+    for (long i = 0; i < size; i++) {
+        if ((i & targetMask) || (i & controlMask) != controlMask)
+            continue;
+        std::complex<double> a0 = this->rho(i), a1 = this->rho(i | targetMask);
+        this->rho(i) = gate(0, 0) * a0 + gate(0, 1) * a1;
+        this->rho(i | targetMask) = gate(1, 0) * a0 + gate(1, 1) * a1;
+    }
+}
+
+void DensityMatrixSimulator::ApplyPauliSum(std::complex<double> alpha, std::complex<double> beta, long xMask, long zMask,
+                                           std::complex<double> phase, long controlMask)
+{
+    // (α + βP), with P|b⟩ = phase (-1)^|b∧z| |b⊕x⟩ on the selected bits of the vectorized density matrix.
+    long size = this->rho.size();
+    if (xMask == 0) {
+        for (long b = 0; b < size; b++) {
+            if ((b & controlMask) == controlMask)
+                this->rho(b) *= alpha + beta * (Parity(b & zMask) ? -phase : phase);
+        }
+        return;
+    }
+
+    long highBit = 1L;
+    while ((highBit << 1) <= xMask)
+        highBit <<= 1;
+    for (long b = 0; b < size; b++) {
+        if ((b & highBit) || (b & controlMask) != controlMask)
+            continue;
+        long flipped = b ^ xMask;
+        std::complex<double> v = this->rho(b), w = this->rho(flipped);
+        this->rho(b) = alpha * v + beta * (Parity(flipped & zMask) ? -phase : phase) * w;
+        this->rho(flipped) = alpha * w + beta * (Parity(b & zMask) ? -phase : phase) * v;
+    }
+}
+
+const Superoperator& DensityMatrixSimulator::NoiseSuperoperator(const std::string& name)
+{
+    auto it = this->noiseSuperoperators.find(name);
+    if (it == this->noiseSuperoperators.end()) {
+        // Σ_i K_i ⊗ K_i* for each channel, composed in order of application.
+        Superoperator op = Superoperator::Identity();
+        for (const NoiseEntry& entry : this->noise.ChannelsFor(name)) {
+            Superoperator channel = Superoperator::Zero();
+            for (const Matrix2cd& k : NoiseModel::KrausOperators(entry))
+                channel += BuildSuperoperator(k);
+            op = channel * op;
+        }
+        it = this->noiseSuperoperators.emplace(name, op).first;
+    }
+    return it->second;
+}
+
+void DensityMatrixSimulator::ApplyNoise(const std::string& name, short qubitIndex)
+{
+    const Superoperator& op = NoiseSuperoperator(name);
+    if (!op.isIdentity())
+        ApplySuperoperator(op, qubitIndex);
+}
+
+void DensityMatrixSimulator::ApplyGate(const Matrix2cd& gate, const std::string& name, Qubit target)
+{
+    // The gate U ⊗ U* and the noise following it are fused into a single pass.
+    ApplySuperoperator(NoiseSuperoperator(name) * BuildSuperoperator(gate), GetQubitIdx(target));
+}
+
+void DensityMatrixSimulator::ApplyControlledGate(const Matrix2cd& gate, const std::string& name, long numControls, Qubit controls[], Qubit target)
+{
+    if (numControls == 0)
+        return ApplyGate(gate, name, target);
+
+    // ρ → cU ρ cU^†: cU acts on the row bits and cU* on the column bits, each controlled on its own half.
+    short targetIndex = GetQubitIdx(target);
+    long rowControls = 0, colControls = 0;
+    for (long i = 0; i < numControls; i++) {
+        rowControls |= RowMask(GetQubitIdx(controls[i]));
+        colControls |= ColumnMask(GetQubitIdx(controls[i]));
+    }
+    ApplyOneSided(gate, RowMask(targetIndex), rowControls);
+    ApplyOneSided(gate.conjugate(), ColumnMask(targetIndex), colControls);
+
+    for (long i = 0; i < numControls; i++)
+        ApplyNoise(name, GetQubitIdx(controls[i]));
+    ApplyNoise(name, targetIndex);
+}
+
+void DensityMatrixSimulator::ApplyPauliExp(const std::string& name, long numControls, Qubit controls[], long numTargets, PauliId paulis[], Qubit targets[], double theta)
+{
+    // U = exp(iθP) = cos(θ) + i sin(θ) P acts on the row bits, U* = cos(θ) - i sin(θ) P* on the column bits.
+    short n = this->numActiveQubits;
+    long xMask = 0, zMask = 0, controlMask = 0;
+    int numY = 0;
+    for (long i = 0; i < numTargets; i++) {
+        long mask = ColumnMask(GetQubitIdx(targets[i]));
+        if (paulis[i] == PauliId_X || paulis[i] == PauliId_Y)
+            xMask |= mask;
+        if (paulis[i] == PauliId_Z || paulis[i] == PauliId_Y)
+            zMask |= mask;
+        numY += paulis[i] == PauliId_Y;
+    }
+    for (long i = 0; i < numControls; i++)
+        controlMask |= ColumnMask(GetQubitIdx(controls[i]));
+    std::complex<double> phase = std::pow(1i, numY % 4);
+
+    ApplyPauliSum(std::cos(theta), 1i * std::sin(theta), xMask << n, zMask << n, phase, controlMask << n);
+    ApplyPauliSum(std::cos(theta), -1i * std::sin(theta), xMask, zMask, std::conj(phase), controlMask);
+
+    for (long i = 0; i < numControls; i++)
+        ApplyNoise(name, GetQubitIdx(controls[i]));
+    for (long i = 0; i < numTargets; i++) {
+        if (paulis[i] != PauliId_I)
+            ApplyNoise(name, GetQubitIdx(targets[i]));
+    }
+}
+
+
+///
+/// Qubit management
+///
+
+Qubit DensityMatrixSimulator::AllocateQubit()
+{
+    Qubit q = this->qbm->Allocate();
+    this->computeRegister.push_back(q);
+    UpdateState(this->numActiveQubits);  // ρ' = ρ ⊗ |0⟩〈0|
+    this->numActiveQubits++;
+    return q;
+}
+
+void DensityMatrixSimulator::ReleaseQubit(Qubit q)
+{
+    UpdateState(GetQubitIdx(q), /*remove=*/true);  // ρ' = tr_i[ρ]
+    this->numActiveQubits--;
+    this->computeRegister.erase(this->computeRegister.begin() + GetQubitIdx(q));
+    this->qbm->Release(q);
+}
+
+std::string DensityMatrixSimulator::QubitToString(Qubit q)
+{
+    return std::to_string(this->qbm->GetQubitId(q));
+}
+
+
+///
+/// Result management
+///
+
+static Result zero = reinterpret_cast<Result>(0);
+static Result one = reinterpret_cast<Result>(1);
+
+void DensityMatrixSimulator::ReleaseResult(Result r) {}
+
+bool DensityMatrixSimulator::AreEqualResults(Result r1, Result r2)
+{
+    return (r1 == r2);
+}
+
+ResultValue DensityMatrixSimulator::GetResultValue(Result r)
+{
+    return (r == one) ? Result_One : Result_Zero;
+}
+
+Result DensityMatrixSimulator::UseZero()
+{
+    return zero;
+}
+
+Result DensityMatrixSimulator::UseOne()
+{
+    return one;
+}
+
+
+///
+/// Supported quantum operations
+///
+
+static Matrix2cd SelectPauliOp(PauliId axis)
+{
+    switch (axis) {
+        case PauliId_X:
+            return (Matrix2cd() << 0,1,1,0).finished();
+        case PauliId_Y:
+            return (Matrix2cd() << 0,-1i,1i,0).finished();
+        case PauliId_Z:
+            return (Matrix2cd() << 1,0,0,-1).finished();
+        default:
+            return Matrix2cd::Identity();
+    }
+}
+
+void DensityMatrixSimulator::X(Qubit q)
+{
+    ApplyGate(SelectPauliOp(PauliId_X), "X", q);
+}
+
+void DensityMatrixSimulator::ControlledX(long numControls, Qubit controls[], Qubit target)
+{
+    ApplyControlledGate(SelectPauliOp(PauliId_X), "X", numControls, controls, target);
+}
+
+void DensityMatrixSimulator::Y(Qubit q)
+{
+    ApplyGate(SelectPauliOp(PauliId_Y), "Y", q);
+}
+
+void DensityMatrixSimulator::ControlledY(long numControls, Qubit controls[], Qubit target)
+{
+    ApplyControlledGate(SelectPauliOp(PauliId_Y), "Y", numControls, controls, target);
+}
+
+void DensityMatrixSimulator::Z(Qubit q)
+{
+    ApplyGate(SelectPauliOp(PauliId_Z), "Z", q);
+}
+
+void DensityMatrixSimulator::ControlledZ(long numControls, Qubit controls[], Qubit target)
+{
+    ApplyControlledGate(SelectPauliOp(PauliId_Z), "Z", numControls, controls, target);
+}
+
+void DensityMatrixSimulator::H(Qubit q)
+{
+    Matrix2cd h; h << 1, 1,
+                      1,-1;
+    h = h / sqrt(2);
+    ApplyGate(h, "H", q);
+}
+
+void DensityMatrixSimulator::ControlledH(long numControls, Qubit controls[], Qubit target)
+{
+    Matrix2cd h; h << 1, 1,
+                      1,-1;
+    h = h / sqrt(2);
+    ApplyControlledGate(h, "H", numControls, controls, target);
+}
+
+void DensityMatrixSimulator::S(Qubit q)
+{
+    Matrix2cd s; s << 1,  0,
+                      0, 1i;
+    ApplyGate(s, "S", q);
+}
+
+void DensityMatrixSimulator::ControlledS(long numControls, Qubit controls[], Qubit target)
+{
+    Matrix2cd s; s << 1,  0,
+                      0, 1i;
+    ApplyControlledGate(s, "S", numControls, controls, target);
+}
+
+void DensityMatrixSimulator::AdjointS(Qubit q)
+{
+    Matrix2cd sdag; sdag << 1,  0,
+                            0,-1i;
+    ApplyGate(sdag, "Sdag", q);
+}
+
+void DensityMatrixSimulator::ControlledAdjointS(long numControls, Qubit controls[], Qubit target)
+{
+    Matrix2cd sdag; sdag << 1,  0,
+                            0,-1i;
+    ApplyControlledGate(sdag, "Sdag", numControls, controls, target);
+}
+
+void DensityMatrixSimulator::T(Qubit q)
+{
+    Matrix2cd t; t << 1, 0,
+                      0, exp(1i*PI/4.);
+    ApplyGate(t, "T", q);
+}
+
+void DensityMatrixSimulator::ControlledT(long numControls, Qubit controls[], Qubit target)
+{
+    Matrix2cd t; t << 1, 0,
+                      0, exp(1i*PI/4.);
+    ApplyControlledGate(t, "T", numControls, controls, target);
+}
+
+void DensityMatrixSimulator::AdjointT(Qubit q)
+{
+    Matrix2cd tdag; tdag << 1, 0,
+                            0, exp(-1i*PI/4.);
+    ApplyGate(tdag, "Tdag", q);
+}
+
+void DensityMatrixSimulator::ControlledAdjointT(long numControls, Qubit controls[], Qubit target)
+{
+    Matrix2cd tdag; tdag << 1, 0,
+                            0, exp(-1i*PI/4.);
+    ApplyControlledGate(tdag, "Tdag", numControls, controls, target);
+}
+
+void DensityMatrixSimulator::R(PauliId axis, Qubit q, double theta)
+{
+    // R_P(θ) = exp(-iθ/2 P), a single-qubit gate whose noise can be fused.
+    Matrix2cd r = std::cos(theta / 2) * Matrix2cd::Identity() - 1i * std::sin(theta / 2) * SelectPauliOp(axis);
+    ApplyGate(r, "R", q);
+}
+
+void DensityMatrixSimulator::ControlledR(long numControls, Qubit controls[], PauliId axis, Qubit target, double theta)
+{
+    ApplyPauliExp("R", numControls, controls, 1, &axis, &target, -theta / 2);
+}
+
+void DensityMatrixSimulator::Exp(long numTargets, PauliId paulis[], Qubit targets[], double theta)
+{
+    ApplyPauliExp("Exp", 0, nullptr, numTargets, paulis, targets, theta);
+}
+
+void DensityMatrixSimulator::ControlledExp(long numControls, Qubit controls[], long numTargets, PauliId paulis[], Qubit targets[], double theta)
+{
+    ApplyPauliExp("Exp", numControls, controls, numTargets, paulis, targets, theta);
+}
+
+Result DensityMatrixSimulator::Measure(long numBases, PauliId bases[], long numTargets, Qubit targets[])
+{
+    assert(numBases == numTargets);
+    short n = this->numActiveQubits;
+
+    for (long i = 0; i < numTargets; i++)
+        ApplyNoise("Measure", GetQubitIdx(targets[i]));
+
+    long xMask = 0, zMask = 0;
+    int numY = 0;
+    for (long i = 0; i < numTargets; i++) {
+        long mask = ColumnMask(GetQubitIdx(targets[i]));
+        if (bases[i] == PauliId_X || bases[i] == PauliId_Y)
+            xMask |= mask;
+        if (bases[i] == PauliId_Z || bases[i] == PauliId_Y)
+            zMask |= mask;
+        numY += bases[i] == PauliId_Y;
+    }
+    std::complex<double> phase = std::pow(1i, numY % 4);
+
+    // Probability of getting outcome Zero is p(+) = tr(P_+ ρ) = (1 + tr(Pρ))/2, where
+    //     tr(Pρ) = Σ_c 〈c⊕x|P|c⟩ ρ_c,c⊕x = Σ_c phase (-1)^|c∧z| ρ_c,c⊕x.
+    std::complex<double> expectation = 0.0;
+    long dim = 1L << n;
+    for (long c = 0; c < dim; c++)
+        expectation += (Parity(c & zMask) ? -phase : phase) * this->rho((c << n) | (c ^ xMask));
+    double probZero = std::min(1.0, std::max(0.0, (1.0 + std::real(expectation)) / 2));
+
+    // Select measurement outcome via PRNG.
+    double random0to1 = this->rng.NextDouble();
+    Result outcome = random0to1 < probZero ? UseZero() : UseOne();
+
+    // Update the density matrix with ρ' = P_m ρ P_m / p(m), where P_+- = (1 +- P)/2.
+    double sign = (outcome == UseZero()) ? 1.0 : -1.0;
+    ApplyPauliSum(0.5, 0.5 * sign, xMask << n, zMask << n, phase, 0);
+    ApplyPauliSum(0.5, 0.5 * sign, xMask, zMask, std::conj(phase), 0);
+    this->rho /= (outcome == UseZero()) ? probZero : 1 - probZero;
+
+    return outcome;
+}
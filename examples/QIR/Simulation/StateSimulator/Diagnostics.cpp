@@ -0,0 +1,108 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include <complex>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+
+#include "StateSimulator.hpp"
+#include "StateDump.hpp"
+
+using namespace Microsoft::Quantum;
+
+# define TOLERANCE 1e-6
+
+///
+/// Implementation of IDiagnostics
+///
+
+bool StateSimulator::Assert(long numTargets, PauliId* bases, Qubit* targets, Result result, const char* failureMessage)
+{
+    Reinstate(numTargets, targets);
+    ApplyPendingCnots();
+    // The outcome is certain iff 〈Ψ|P|Ψ⟩ = +1 for Zero or -1 for One, the state is only read.
+    // A deviation of 2ε in the expectation value corresponds to a probability of 1-ε for the result.
+    // The Pauli frame flips the sign of the expectation value if it anticommutes with P.
+    PauliMasks masks = GetPauliMasks(numTargets, bases, targets);
+    if (masks.x != 0)
+        ApplyPendingDiagonal();
+    double sign = AnticommutesWithFrame(numTargets, bases, targets) ? -1.0 : 1.0;
+    double expectation = sign * PauliExpectation(masks);
+    double expected = (result == UseZero()) ? 1.0 : -1.0;
+    return std::abs(expectation - expected) < 2 * TOLERANCE;
+}
+
+bool StateSimulator::AssertProbability(long numTargets, PauliId bases[], Qubit targets[], double probabilityOfZero, double precision, const char* failureMessage)
+{
+    Reinstate(numTargets, targets);
+    ApplyPendingCnots();
+    // p(Zero) = (1 + 〈Ψ|P|Ψ⟩)/2, without collapsing the state.
+    PauliMasks masks = GetPauliMasks(numTargets, bases, targets);
+    if (masks.x != 0)
+        ApplyPendingDiagonal();
+    double sign = AnticommutesWithFrame(numTargets, bases, targets) ? -1.0 : 1.0;
+    double probZero = (1 + sign * PauliExpectation(masks)) / 2;
+    return std::abs(probZero - probabilityOfZero) <= precision;
+}
+
+void StateSimulator::GetState(TGetStateCallback callback)
+{
+    Flush();
+    // Basis indices follow the order of allocation, the first allocated qubit being the most significant bit.
+    // Amplitudes are stored in the order of the compute register, which differs once qubits have been swapped.
+    if (this->computeRegister == this->allocationOrder) {
+        for (long idx = 0; idx < this->stateVec.size(); idx++) {
+            if (!callback(idx, this->stateVec(idx).real(), this->stateVec(idx).imag()))
+                break;
+        }
+        return;
+    }
+
+    std::vector<uint64_t> masks(this->numActiveQubits);
+    for (short i = 0; i < this->numActiveQubits; i++)
+        masks[i] = GetQubitMask(this->allocationOrder[i]);
+    for (long idx = 0; idx < this->stateVec.size(); idx++) {
+        uint64_t physical = 0;
+        for (short i = 0; i < this->numActiveQubits; i++) {
+            if (idx & (1L << (this->numActiveQubits - 1 - i)))
+                physical |= masks[i];
+        }
+        if (!callback(idx, this->stateVec(physical).real(), this->stateVec(physical).imag()))
+            break;
+    }
+}
+
+void StateSimulator::DumpMachine(const void* location)
+{
+    Flush();
+    std::vector<int64_t> qubitIds;
+    for (Qubit q : this->computeRegister)
+        qubitIds.push_back(this->qbm->GetQubitId(q));
+
+    std::ofstream file;
+    std::ostream& out = GetOutStream(location, file, this->dumpOptions.binary);
+    WriteDump(out, this->dumpOptions.binary && file.is_open(), qubitIds,
+              [this](uint64_t idx) { return this->stateVec(idx); }, this->stateVec.size(),
+              this->dumpOptions.cutoff, this->dumpOptions.topK);
+}
+
+void StateSimulator::DumpRegister(const void* location, const QirArray* qubits)
+{
+    Flush();
+    long numQubits = qubits->count;
+    Qubit* registerQubits = reinterpret_cast<Qubit*>(qubits->buffer);
+    std::vector<uint64_t> registerBits(numQubits);
+    std::vector<int64_t> qubitIds(numQubits);
+    for (long j = 0; j < numQubits; j++) {
+        registerBits[j] = GetQubitMask(registerQubits[j]);
+        qubitIds[j] = this->qbm->GetQubitId(registerQubits[j]);
+    }
+
+    std::ofstream file;
+    std::ostream& out = GetOutStream(location, file, this->dumpOptions.binary);
+    WriteRegisterDump(out, this->dumpOptions.binary && file.is_open(), qubitIds, registerBits,
+                      [this](uint64_t idx) { return this->stateVec(idx); }, this->stateVec.size(),
+                      this->dumpOptions.cutoff, this->dumpOptions.topK);
+}
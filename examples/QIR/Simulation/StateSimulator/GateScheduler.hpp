@@ -0,0 +1,268 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <algorithm>
+#include <bitset>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+#include "Eigen/Dense"
+
+#include "StateKernels.hpp"
+
+namespace Microsoft
+{
+namespace Quantum
+{
+    // Buffers (controlled) single-qubit gates and applies them in stages ordered by their dependencies, such that
+    // most gates on a mid-sized state need no pass over the whole state vector of their own.
+    //
+    // Two gates depend on each other if they share a qubit, target or control, and commute otherwise. A gate is
+    // placed in the earliest stage after all gates it depends on, which is a graph of the buffered gates by qubit
+    // overlap levelled into stages. Gates with a target below CHUNK_BITS only pair up amplitudes within aligned
+    // chunks of 2^CHUNK_BITS amplitudes, about the size of a per-core cache, so a stage of such local gates runs
+    // all of them on one chunk after the other, with the chunks handed out to the threads one at a time. A thread
+    // done with its chunks thus takes over the remaining ones of the others, and threads only meet at the end of
+    // each stage instead of after every gate. Gates on higher targets form global stages, applied gate by gate
+    // with the usual parallel kernel. A gate on the same target and controls as the last gate on its qubits is
+    // multiplied into that gate instead.
+    //
+    // Loops of a program, such as Grover iterations or Trotter steps, hand the same gates to the scheduler over and
+    // over. The resulting plans, i.e. the stages with their fused gates, are kept in a least recently used cache
+    // of MAX_PLANS entries, looked up by a hash of the buffered gates and verified against the gates themselves,
+    // so that a repeated gate stream is planned only once.
+    class GateScheduler
+    {
+        // Chunks of 2^13 amplitudes (128 KiB) have at most 4096 amplitude pairs per gate, which `ApplyGateKernel`
+        // processes without opening a parallel region of its own.
+        static constexpr int CHUNK_BITS = 13;
+        static constexpr size_t MAX_GATES = 256;
+        static constexpr size_t MAX_PLANS = 64;
+
+        struct ScheduledGate
+        {
+            Eigen::Matrix2cd matrix;
+            uint64_t targetMask, controlMask;
+
+            bool operator==(const ScheduledGate& other) const
+            {
+                return this->targetMask == other.targetMask && this->controlMask == other.controlMask &&
+                       this->matrix == other.matrix;
+            }
+        };
+
+        struct Stage
+        {
+            bool local;
+            std::vector<ScheduledGate> gates;
+        };
+
+        // The stages to run for a stream of gates on a state of the given size, the first `numStages` of `stages`.
+        // Stages beyond these keep their memory for a later plan built in the same place.
+        struct Plan
+        {
+            uint64_t key;
+            uint64_t size;
+            std::vector<ScheduledGate> stream;
+            std::vector<Stage> stages;
+            size_t numStages = 0;
+        };
+
+        // The buffered gates, and a hash of them updated by `Add`.
+        std::vector<ScheduledGate> gates;
+        uint64_t streamHash = 0;
+
+        // Cached plans, the most recently used first, and their index by key.
+        std::list<Plan> plans;
+        std::unordered_map<uint64_t, std::list<Plan>::iterator> planIndex;
+
+        // While planning: the stages with the indices of their gates, of which the first `numStages` are in use, and
+        // for each bit of the basis index the last stage and gate involving it (-1 for none).
+        struct PlannedStage
+        {
+            bool local;
+            std::vector<size_t> gates;
+        };
+        std::vector<PlannedStage> stages;
+        size_t numStages = 0;
+        long lastStage[64];
+        long lastGate[64];
+
+        // Index of the first stage of the given kind at or after `first`, appending a stage if there is none.
+        size_t FindStage(long first, bool local)
+        {
+            for (size_t s = std::max(first, 0L); s < this->numStages; s++) {
+                if (this->stages[s].local == local)
+                    return s;
+            }
+            if (this->numStages == this->stages.size())
+                this->stages.emplace_back();
+            PlannedStage& stage = this->stages[this->numStages];
+            stage.local = local;
+            stage.gates.clear();
+            return this->numStages++;
+        }
+
+        // Places the gate into the stages after the gates it depends on, or fuses it with the preceding gate.
+        void Place(size_t g, uint64_t chunkSize)
+        {
+            const ScheduledGate& gate = this->gates[g];
+            const uint64_t qubits = gate.targetMask | gate.controlMask;
+            const long previous = this->lastGate[std::bitset<64>(gate.targetMask - 1).count()];
+            bool fuse = previous >= 0 && this->gates[previous].targetMask == gate.targetMask &&
+                        this->gates[previous].controlMask == gate.controlMask;
+            long first = -1;
+            for (int bit = 0; bit < 64; bit++) {
+                if (!(qubits & (uint64_t(1) << bit)))
+                    continue;
+                first = std::max(first, this->lastStage[bit]);
+                fuse = fuse && this->lastGate[bit] == previous;
+            }
+            if (fuse) {
+                this->gates[previous].matrix = gate.matrix * this->gates[previous].matrix;
+                return;
+            }
+
+            const size_t s = FindStage(first, gate.targetMask < chunkSize);
+            this->stages[s].gates.push_back(g);
+            for (int bit = 0; bit < 64; bit++) {
+                if (!(qubits & (uint64_t(1) << bit)))
+                    continue;
+                this->lastStage[bit] = s;
+                this->lastGate[bit] = g;
+            }
+        }
+
+        static uint64_t Mix(uint64_t hash, uint64_t value)
+        {
+            return hash ^ (value + 0x9e3779b97f4a7c15 + (hash << 6) + (hash >> 2));
+        }
+
+        // The cached plan of the buffered gates, planning them if there is none, and marks it most recently used.
+        // On a full cache, the least recently used plan makes room, keeping its memory for the new one.
+        const Plan& FindPlan(uint64_t size)
+        {
+            const uint64_t key = Mix(this->streamHash, size);
+            auto found = this->planIndex.find(key);
+            if (found != this->planIndex.end()) {
+                this->plans.splice(this->plans.begin(), this->plans, found->second);
+                if (this->plans.front().size == size && this->plans.front().stream == this->gates)
+                    return this->plans.front();
+                // A different stream with the same hash is planned in place, under the same key.
+            } else if (this->plans.size() == MAX_PLANS) {
+                // The index entry of the evicted plan is rekeyed rather than erased and inserted anew.
+                auto entry = this->planIndex.extract(this->plans.back().key);
+                this->plans.splice(this->plans.begin(), this->plans, std::prev(this->plans.end()));
+                entry.key() = key;
+                this->planIndex.insert(std::move(entry));
+            } else {
+                this->plans.emplace_front();
+                this->planIndex[key] = this->plans.begin();
+            }
+
+            Plan& plan = this->plans.front();
+            plan.key = key;
+            plan.size = size;
+            plan.stream = this->gates;
+            BuildPlan(plan);
+            return plan;
+        }
+
+        // Levels the buffered gates into stages, fusing them in place, and copies the result into the plan.
+        void BuildPlan(Plan& plan)
+        {
+            const uint64_t chunkSize = std::min(plan.size, uint64_t(1) << CHUNK_BITS);
+            std::fill(this->lastStage, this->lastStage + 64, -1);
+            std::fill(this->lastGate, this->lastGate + 64, -1);
+            this->numStages = 0;
+            for (size_t g = 0; g < this->gates.size(); g++)
+                Place(g, chunkSize);
+
+            if (plan.stages.size() < this->numStages)
+                plan.stages.resize(this->numStages);
+            plan.numStages = this->numStages;
+            for (size_t s = 0; s < this->numStages; s++) {
+                plan.stages[s].local = this->stages[s].local;
+                plan.stages[s].gates.clear();
+                for (size_t g : this->stages[s].gates)
+                    plan.stages[s].gates.push_back(this->gates[g]);
+            }
+        }
+
+        static void Execute(const Plan& plan, std::complex<double>* psi, uint64_t size)
+        {
+            const uint64_t chunkSize = std::min(size, uint64_t(1) << CHUNK_BITS);
+            for (size_t s = 0; s < plan.numStages; s++) {
+                const Stage& stage = plan.stages[s];
+                if (!stage.local) {
+                    for (const ScheduledGate& gate : stage.gates)
+                        ApplyGateKernel(psi, size, gate.matrix, gate.targetMask, gate.controlMask);
+                    continue;
+                }
+
+                // Controls above the chunk select whole chunks, the others are handled within the chunk.
+                const long numChunks = static_cast<long>(size / chunkSize);
+                #pragma omp parallel for schedule(dynamic, 1) if(numChunks > 1)
+                for (long c = 0; c < numChunks; c++) {
+                    const uint64_t base = c * chunkSize;
+                    for (const ScheduledGate& gate : stage.gates) {
+                        const uint64_t highControls = gate.controlMask & ~(chunkSize - 1);
+                        if ((base & highControls) != highControls)
+                            continue;
+                        ApplyGateKernel(psi + base, chunkSize, gate.matrix, gate.targetMask,
+                                        gate.controlMask & (chunkSize - 1));
+                    }
+                }
+            }
+        }
+
+      public:
+        bool Empty() const
+        {
+            return this->gates.empty();
+        }
+
+        // Whether the buffer is full and is to be run before adding further gates.
+        bool Full() const
+        {
+            return this->gates.size() == MAX_GATES;
+        }
+
+        void Clear()
+        {
+            this->gates.clear();
+            this->streamHash = 0;
+        }
+
+        // Buffers the gate U on the target bit, controlled on all bits of `controlMask` being set.
+        void Add(const Eigen::Matrix2cd& gate, uint64_t targetMask, uint64_t controlMask = 0)
+        {
+            this->gates.push_back({gate, targetMask, controlMask});
+            this->streamHash = Mix(this->streamHash, targetMask);
+            this->streamHash = Mix(this->streamHash, controlMask);
+            for (int i = 0; i < 4; i++) {
+                uint64_t bits[2];
+                std::memcpy(bits, &gate(i), sizeof(bits));
+                this->streamHash = Mix(Mix(this->streamHash, bits[0]), bits[1]);
+            }
+        }
+
+        // Applies the buffered gates to the state vector and empties the buffer.
+        void Run(std::complex<double>* psi, uint64_t size)
+        {
+            if (this->gates.empty())
+                return;
+            Execute(FindPlan(size), psi, size);
+            this->gates.clear();
+            this->streamHash = 0;
+        }
+    };
+
+} // namespace Quantum
+} // namespace Microsoft
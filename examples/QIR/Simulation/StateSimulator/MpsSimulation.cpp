@@ -0,0 +1,544 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include <cmath>
+#include <complex>
+#include <utility>
+
+#include "MpsSimulator.hpp"
+
+#include "Eigen/SVD"
+
+using namespace Microsoft::Quantum;
+using namespace Eigen;
+using namespace std::complex_literals;
+
+# define PI 3.14159265358979323846
+# define SINGULAR_VALUE_CUTOFF 1e-30
+
+static Matrix2cd SelectPauliOp(PauliId axis)
+{
+    switch (axis) {
+        case PauliId_X:
+            return (Matrix2cd() << 0,1,1,0).finished();
+        case PauliId_Y:
+            return (Matrix2cd() << 0,-1i,1i,0).finished();
+        case PauliId_Z:
+            return (Matrix2cd() << 1,0,0,-1).finished();
+        default:
+            return Matrix2cd::Identity();
+    }
+}
+
+// Kronecker product of the Pauli matrices, the first one acting on the most significant bit.
+static MatrixXcd BuildPauliProduct(const std::vector<PauliId>& paulis)
+{
+    // Each factor is prepended as the new most significant bit, so the list is traversed back to front.
+    MatrixXcd product = MatrixXcd::Ones(1, 1);
+    for (auto it = paulis.rbegin(); it != paulis.rend(); ++it) {
+        Matrix2cd pauli = SelectPauliOp(*it);
+        MatrixXcd next(2 * product.rows(), 2 * product.cols());
+        for (int s = 0; s < 2; s++)
+            for (int t = 0; t < 2; t++)
+                next.block(s * product.rows(), t * product.cols(), product.rows(), product.cols()) = pauli(s, t) * product;
+        product = next;
+    }
+    return product;
+}
+
+// Reorders an operator given for a list of qubits to the order of the sites holding them,
+// where blockPositions[i] is the offset of the i-th qubit within the block.
+static MatrixXcd PermuteOperator(const MatrixXcd& op, const std::vector<int>& blockPositions)
+{
+    long k = blockPositions.size();
+    long dim = 1L << k;
+    std::vector<long> toQubitOrder(dim, 0);
+    for (long b = 0; b < dim; b++) {
+        for (long i = 0; i < k; i++) {
+            if ((b >> (k - 1 - blockPositions[i])) & 1)
+                toQubitOrder[b] |= 1L << (k - 1 - i);
+        }
+    }
+
+    MatrixXcd permuted(dim, dim);
+    for (long r = 0; r < dim; r++)
+        for (long c = 0; c < dim; c++)
+            permuted(r, c) = op(toQubitOrder[r], toQubitOrder[c]);
+    return permuted;
+}
+
+// θ'[s] = Σ_t U_st θ[t]
+static std::vector<MatrixXcd> ApplyToBlock(const MatrixXcd& op, const std::vector<MatrixXcd>& theta)
+{
+    std::vector<MatrixXcd> result(theta.size(), MatrixXcd::Zero(theta[0].rows(), theta[0].cols()));
+    for (size_t s = 0; s < theta.size(); s++) {
+        for (size_t t = 0; t < theta.size(); t++) {
+            if (op(s, t) != 0.0)
+                result[s] += op(s, t) * theta[t];
+        }
+    }
+    return result;
+}
+
+
+///
+/// Chain manipulation
+///
+
+void MpsSimulator::MoveCenter(long site)
+{
+    while (this->center < site) {
+        // Split A_c = Q R with left-normalized Q, and absorb R into the next site.
+        SiteTensor& a = this->sites[this->center];
+        long dl = a[0].rows(), dr = a[0].cols();
+        MatrixXcd m(2 * dl, dr);
+        m << a[0], a[1];
+        HouseholderQR<MatrixXcd> qr(m);
+        long k = std::min(2 * dl, dr);
+        MatrixXcd q = qr.householderQ() * MatrixXcd::Identity(2 * dl, k);
+        MatrixXcd r = qr.matrixQR().topRows(k).triangularView<Upper>();
+        a[0] = q.topRows(dl);
+        a[1] = q.bottomRows(dl);
+        SiteTensor& next = this->sites[this->center + 1];
+        next[0] = r * next[0];
+        next[1] = r * next[1];
+        this->center++;
+    }
+    while (this->center > site) {
+        // Split A_c = L Q with right-normalized Q via the QR decomposition of A_c^†, and absorb L into the previous site.
+        SiteTensor& a = this->sites[this->center];
+        long dl = a[0].rows(), dr = a[0].cols();
+        MatrixXcd m(dl, 2 * dr);
+        m << a[0], a[1];
+        HouseholderQR<MatrixXcd> qr(m.adjoint());
+        long k = std::min(dl, 2 * dr);
+        MatrixXcd q = qr.householderQ() * MatrixXcd::Identity(2 * dr, k);
+        MatrixXcd l = qr.matrixQR().topRows(k).triangularView<Upper>();
+        MatrixXcd qAdj = q.adjoint();
+        a[0] = qAdj.leftCols(dr);
+        a[1] = qAdj.rightCols(dr);
+        SiteTensor& prev = this->sites[this->center - 1];
+        prev[0] = prev[0] * l.adjoint();
+        prev[1] = prev[1] * l.adjoint();
+        this->center--;
+    }
+}
+
+std::vector<MatrixXcd> MpsSimulator::ContractSites(long first, long count) const
+{
+    // θ[s_1..s_k] = A_first[s_1] .. A_first+k-1[s_k], with s_1 as the most significant bit of the block index.
+    std::vector<MatrixXcd> theta = {this->sites[first][0], this->sites[first][1]};
+    for (long j = 1; j < count; j++) {
+        std::vector<MatrixXcd> next(2 * theta.size());
+        for (size_t s = 0; s < theta.size(); s++) {
+            next[2 * s] = theta[s] * this->sites[first + j][0];
+            next[2 * s + 1] = theta[s] * this->sites[first + j][1];
+        }
+        theta.swap(next);
+    }
+    return theta;
+}
+
+void MpsSimulator::DecomposeSites(long first, long count, std::vector<MatrixXcd>& theta)
+{
+    // Peel off one site at a time from the left with a truncated SVD, M = U S V^†, where the rows of M
+    // are indexed by (s_j, left bond) and its columns by (s_j+1..s_k, right bond).
+    for (long j = 0; j < count - 1; j++) {
+        long dl = theta[0].rows(), dr = theta[0].cols();
+        long rest = theta.size() / 2;
+        MatrixXcd m(2 * dl, rest * dr);
+        for (int s = 0; s < 2; s++)
+            for (long r = 0; r < rest; r++)
+                m.block(s * dl, r * dr, dl, dr) = theta[s * rest + r];
+
+        BDCSVD<MatrixXcd> svd(m, ComputeThinU | ComputeThinV);
+        const VectorXd& sigma = svd.singularValues();
+
+        // Keep the fewest singular values such that the relative discarded weight stays below the threshold,
+        // but no more than the maximal bond dimension.
+        double total = sigma.squaredNorm();
+        long keep = sigma.size();
+        double discarded = 0.0;
+        while (keep > 1) {
+            double weight = sigma(keep - 1) * sigma(keep - 1);
+            if (weight > SINGULAR_VALUE_CUTOFF * total && discarded + weight > this->truncationThreshold * total)
+                break;
+            discarded += weight;
+            keep--;
+        }
+        while (keep > std::max(1L, this->maxBondDimension)) {
+            discarded += sigma(keep - 1) * sigma(keep - 1);
+            keep--;
+        }
+        if (total > 0)
+            this->truncationError += discarded / total;
+
+        // Rescale the kept singular values to preserve the norm of the block.
+        double rescale = (total > discarded) ? std::sqrt(total / (total - discarded)) : 1.0;
+        MatrixXcd u = svd.matrixU().leftCols(keep);
+        MatrixXcd sv = (rescale * sigma.head(keep)).asDiagonal() * svd.matrixV().leftCols(keep).adjoint();
+
+        this->sites[first + j][0] = u.topRows(dl);
+        this->sites[first + j][1] = u.bottomRows(dl);
+        std::vector<MatrixXcd> remainder(rest);
+        for (long r = 0; r < rest; r++)
+            remainder[r] = sv.block(0, r * dr, keep, dr);
+        theta.swap(remainder);
+    }
+
+    this->sites[first + count - 1][0] = theta[0];
+    this->sites[first + count - 1][1] = theta[1];
+    this->center = first + count - 1;
+}
+
+void MpsSimulator::SwapSites(long site)
+{
+    // Exchange the states of two neighbouring sites, then their labels, so that each qubit keeps its state.
+    MoveCenter(site);
+    std::vector<MatrixXcd> theta = ContractSites(site, 2);
+    std::swap(theta[1], theta[2]);
+    DecomposeSites(site, 2, theta);
+    std::swap(this->computeRegister[site], this->computeRegister[site + 1]);
+}
+
+long MpsSimulator::GatherSites(const std::vector<Qubit>& qubits, std::vector<int>& blockPositions)
+{
+    // Move the qubits next to the leftmost of them, in order of their position in the chain.
+    std::vector<std::pair<long, int>> bySite;
+    for (size_t i = 0; i < qubits.size(); i++)
+        bySite.push_back({GetSiteIdx(qubits[i]), static_cast<int>(i)});
+    std::sort(bySite.begin(), bySite.end());
+
+    long first = bySite[0].first;
+    blockPositions.assign(qubits.size(), 0);
+    for (size_t j = 1; j < bySite.size(); j++) {
+        long site = GetSiteIdx(qubits[bySite[j].second]);
+        for (; site > first + static_cast<long>(j); site--)
+            SwapSites(site - 1);
+        blockPositions[bySite[j].second] = static_cast<int>(j);
+    }
+    return first;
+}
+
+void MpsSimulator::ApplyOperator(const MatrixXcd& op, const std::vector<Qubit>& qubits)
+{
+    std::vector<int> blockPositions;
+    long first = GatherSites(qubits, blockPositions);
+    long count = qubits.size();
+
+    MoveCenter(first);
+    std::vector<MatrixXcd> theta = ContractSites(first, count);
+    theta = ApplyToBlock(PermuteOperator(op, blockPositions), theta);
+    DecomposeSites(first, count, theta);
+}
+
+void MpsSimulator::ApplyGate(const Matrix2cd& gate, Qubit target)
+{
+    // Unitaries on a single site keep it normalized, so the canonical form is unaffected.
+    SiteTensor& a = this->sites[GetSiteIdx(target)];
+    MatrixXcd a0 = gate(0, 0) * a[0] + gate(0, 1) * a[1];
+    a[1] = gate(1, 0) * a[0] + gate(1, 1) * a[1];
+    a[0] = a0;
+}
+
+void MpsSimulator::ApplyControlledGate(const Matrix2cd& gate, long numControls, Qubit controls[], Qubit target)
+{
+    if (numControls == 0)
+        return ApplyGate(gate, target);
+
+    // cU = 1 + |1..1⟩〈1..1| ⊗ (U - 1), acting on the controls followed by the target.
+    std::vector<Qubit> qubits(controls, controls + numControls);
+    qubits.push_back(target);
+    long dim = 1L << qubits.size();
+    MatrixXcd op = MatrixXcd::Identity(dim, dim);
+    op.bottomRightCorner(2, 2) = gate;
+    ApplyOperator(op, qubits);
+}
+
+void MpsSimulator::ApplyPauliExp(long numControls, Qubit controls[], long numTargets, PauliId paulis[], Qubit targets[], double theta)
+{
+    // exp(iθP) = cos(θ) + i sin(θ) P, identities are dropped from the Pauli product beforehand.
+    std::vector<Qubit> qubits(controls, controls + numControls);
+    std::vector<PauliId> nonTrivial;
+    for (long i = 0; i < numTargets; i++) {
+        if (paulis[i] != PauliId_I) {
+            qubits.push_back(targets[i]);
+            nonTrivial.push_back(paulis[i]);
+        }
+    }
+
+    MatrixXcd pauli = BuildPauliProduct(nonTrivial);
+    MatrixXcd rotation = std::cos(theta) * MatrixXcd::Identity(pauli.rows(), pauli.cols()) + 1i * std::sin(theta) * pauli;
+    if (nonTrivial.empty()) {
+        // A global phase, unless it is controlled.
+        if (numControls == 0)
+            return;
+        Qubit target = controls[numControls - 1];
+        Matrix2cd phase = Matrix2cd::Identity();
+        phase(1, 1) = rotation(0, 0);
+        return ApplyControlledGate(phase, numControls - 1, controls, target);
+    }
+    if (qubits.size() == 1)
+        return ApplyGate(rotation, qubits[0]);
+
+    long dim = 1L << qubits.size();
+    MatrixXcd op = MatrixXcd::Identity(dim, dim);
+    op.bottomRightCorner(rotation.rows(), rotation.cols()) = rotation;
+    ApplyOperator(op, qubits);
+}
+
+long MpsSimulator::GetBondDimension() const
+{
+    long bond = 1;
+    for (const SiteTensor& a : this->sites)
+        bond = std::max(bond, static_cast<long>(std::max(a[0].rows(), a[0].cols())));
+    return bond;
+}
+
+
+///
+/// Qubit management
+///
+
+Qubit MpsSimulator::AllocateQubit()
+{
+    // New qubits are appended to the end of the chain in |0⟩, with trivial bonds.
+    Qubit q = this->qbm->Allocate();
+    this->computeRegister.push_back(q);
+    this->sites.push_back({MatrixXcd::Ones(1, 1), MatrixXcd::Zero(1, 1)});
+    return q;
+}
+
+void MpsSimulator::ReleaseQubit(Qubit q)
+{
+    // Reset the qubit to |0⟩, which leaves it in a product state with the rest of the chain,
+    // and absorb its remaining matrix A[0] into a neighbouring site.
+    PauliId z = PauliId_Z;
+    if (Measure(1, &z, 1, &q) == UseOne())
+        X(q);
+
+    long site = GetSiteIdx(q);
+    MoveCenter(site);
+    MatrixXcd a0 = this->sites[site][0];
+    if (site > 0) {
+        SiteTensor& prev = this->sites[site - 1];
+        prev[0] = prev[0] * a0;
+        prev[1] = prev[1] * a0;
+        this->center = site - 1;
+    } else if (this->sites.size() > 1) {
+        SiteTensor& next = this->sites[site + 1];
+        next[0] = a0 * next[0];
+        next[1] = a0 * next[1];
+    }
+    this->sites.erase(this->sites.begin() + site);
+    this->computeRegister.erase(this->computeRegister.begin() + site);
+    if (this->sites.empty())
+        this->center = 0;
+    this->qbm->Release(q);
+}
+
+std::string MpsSimulator::QubitToString(Qubit q)
+{
+    return std::to_string(this->qbm->GetQubitId(q));
+}
+
+
+///
+/// Result management
+///
+
+static Result zero = reinterpret_cast<Result>(0);
+static Result one = reinterpret_cast<Result>(1);
+
+void MpsSimulator::ReleaseResult(Result r) {}
+
+bool MpsSimulator::AreEqualResults(Result r1, Result r2)
+{
+    return (r1 == r2);
+}
+
+ResultValue MpsSimulator::GetResultValue(Result r)
+{
+    return (r == one) ? Result_One : Result_Zero;
+}
+
+Result MpsSimulator::UseZero()
+{
+    return zero;
+}
+
+Result MpsSimulator::UseOne()
+{
+    return one;
+}
+
+
+///
+/// Supported quantum operations
+///
+
+void MpsSimulator::X(Qubit q)
+{
+    ApplyGate(SelectPauliOp(PauliId_X), q);
+}
+
+void MpsSimulator::ControlledX(long numControls, Qubit controls[], Qubit target)
+{
+    ApplyControlledGate(SelectPauliOp(PauliId_X), numControls, controls, target);
+}
+
+void MpsSimulator::Y(Qubit q)
+{
+    ApplyGate(SelectPauliOp(PauliId_Y), q);
+}
+
+void MpsSimulator::ControlledY(long numControls, Qubit controls[], Qubit target)
+{
+    ApplyControlledGate(SelectPauliOp(PauliId_Y), numControls, controls, target);
+}
+
+void MpsSimulator::Z(Qubit q)
+{
+    ApplyGate(SelectPauliOp(PauliId_Z), q);
+}
+
+void MpsSimulator::ControlledZ(long numControls, Qubit controls[], Qubit target)
+{
+    ApplyControlledGate(SelectPauliOp(PauliId_Z), numControls, controls, target);
+}
+
+void MpsSimulator::H(Qubit q)
+{
+    Matrix2cd h; h << 1, 1,
+                      1,-1;
+    h = h / sqrt(2);
+    ApplyGate(h, q);
+}
+
+void MpsSimulator::ControlledH(long numControls, Qubit controls[], Qubit target)
+{
+    Matrix2cd h; h << 1, 1,
+                      1,-1;
+    h = h / sqrt(2);
+    ApplyControlledGate(h, numControls, controls, target);
+}
+
+void MpsSimulator::S(Qubit q)
+{
+    Matrix2cd s; s << 1,  0,
+                      0, 1i;
+    ApplyGate(s, q);
+}
+
+void MpsSimulator::ControlledS(long numControls, Qubit controls[], Qubit target)
+{
+    Matrix2cd s; s << 1,  0,
+                      0, 1i;
+    ApplyControlledGate(s, numControls, controls, target);
+}
+
+void MpsSimulator::AdjointS(Qubit q)
+{
+    Matrix2cd sdag; sdag << 1,  0,
+                            0,-1i;
+    ApplyGate(sdag, q);
+}
+
+void MpsSimulator::ControlledAdjointS(long numControls, Qubit controls[], Qubit target)
+{
+    Matrix2cd sdag; sdag << 1,  0,
+                            0,-1i;
+    ApplyControlledGate(sdag, numControls, controls, target);
+}
+
+void MpsSimulator::T(Qubit q)
+{
+    Matrix2cd t; t << 1, 0,
+                      0, exp(1i*PI/4.);
+    ApplyGate(t, q);
+}
+
+void MpsSimulator::ControlledT(long numControls, Qubit controls[], Qubit target)
+{
+    Matrix2cd t; t << 1, 0,
+                      0, exp(1i*PI/4.);
+    ApplyControlledGate(t, numControls, controls, target);
+}
+
+void MpsSimulator::AdjointT(Qubit q)
+{
+    Matrix2cd tdag; tdag << 1, 0,
+                            0, exp(-1i*PI/4.);
+    ApplyGate(tdag, q);
+}
+
+void MpsSimulator::ControlledAdjointT(long numControls, Qubit controls[], Qubit target)
+{
+    Matrix2cd tdag; tdag << 1, 0,
+                            0, exp(-1i*PI/4.);
+    ApplyControlledGate(tdag, numControls, controls, target);
+}
+
+void MpsSimulator::R(PauliId axis, Qubit q, double theta)
+{
+    // R_P(θ) = exp(-iθ/2 P)
+    ApplyPauliExp(0, nullptr, 1, &axis, &q, -theta / 2);
+}
+
+void MpsSimulator::ControlledR(long numControls, Qubit controls[], PauliId axis, Qubit target, double theta)
+{
+    ApplyPauliExp(numControls, controls, 1, &axis, &target, -theta / 2);
+}
+
+void MpsSimulator::Exp(long numTargets, PauliId paulis[], Qubit targets[], double theta)
+{
+    ApplyPauliExp(0, nullptr, numTargets, paulis, targets, theta);
+}
+
+void MpsSimulator::ControlledExp(long numControls, Qubit controls[], long numTargets, PauliId paulis[], Qubit targets[], double theta)
+{
+    ApplyPauliExp(numControls, controls, numTargets, paulis, targets, theta);
+}
+
+Result MpsSimulator::Measure(long numBases, PauliId bases[], long numTargets, Qubit targets[])
+{
+    assert(numBases == numTargets);
+
+    std::vector<Qubit> qubits;
+    std::vector<PauliId> nonTrivial;
+    for (long i = 0; i < numTargets; i++) {
+        if (bases[i] != PauliId_I) {
+            qubits.push_back(targets[i]);
+            nonTrivial.push_back(bases[i]);
+        }
+    }
+    if (qubits.empty())
+        return UseZero();
+
+    // With the orthogonality center inside the contracted block, the environment is the identity and
+    //     p(+) = 〈Ψ|P_+|Ψ⟩ = (1 + Σ_s tr(θ[s]^† (Pθ)[s]))/2.
+    std::vector<int> blockPositions;
+    long first = GatherSites(qubits, blockPositions);
+    long count = qubits.size();
+    MoveCenter(first);
+    std::vector<MatrixXcd> theta = ContractSites(first, count);
+    std::vector<MatrixXcd> flipped = ApplyToBlock(PermuteOperator(BuildPauliProduct(nonTrivial), blockPositions), theta);
+
+    double expectation = 0.0;
+    for (size_t s = 0; s < theta.size(); s++)
+        expectation += std::real(theta[s].cwiseProduct(flipped[s].conjugate()).sum());
+    double probZero = std::min(1.0, std::max(0.0, (1.0 + expectation) / 2));
+
+    // Select measurement outcome via PRNG.
+    double random0to1 = this->rng.NextDouble();
+    Result outcome = random0to1 < probZero ? UseZero() : UseOne();
+
+    // Update the block with θ' = 1/√p(m) P_m θ, where P_+- = (1 +- P)/2.
+    double sign = (outcome == UseZero()) ? 1.0 : -1.0;
+    double norm = 2 * sqrt(outcome == UseZero() ? probZero : 1 - probZero);
+    for (size_t s = 0; s < theta.size(); s++)
+        theta[s] = (theta[s] + sign * flipped[s]) / norm;
+    DecomposeSites(first, count, theta);
+
+    return outcome;
+}
@@ -0,0 +1,179 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <vector>
+
+#include "QirRuntimeApi_I.hpp"
+#include "QSharpSimApi_I.hpp"
+
+#include "QubitManager.hpp"
+#include "RandomGenerator.hpp"
+
+#include "Eigen/Dense"
+
+// Site tensor of a matrix product state, one (left bond × right bond) matrix per basis state of the qubit.
+using SiteTensor = std::array<Eigen::MatrixXcd, 2>;
+
+namespace Microsoft
+{
+namespace Quantum
+{
+    // Simulator representing the state as a matrix product state (MPS) over a chain of qubits:
+    //     |Ψ⟩ = Σ A_1[s_1] A_2[s_2] .. A_n[s_n] |s_1 s_2 .. s_n⟩
+    // Memory and gate cost scale with the bond dimension instead of 2^n, so that wide circuits with low
+    // entanglement (e.g. 1D-structured ansätze) can be simulated. Multi-qubit gates are applied by moving the
+    // involved qubits onto neighbouring sites with swaps, contracting them, and splitting the result again with
+    // truncated SVDs. The chain is kept in mixed canonical form, so that the discarded singular value weight is
+    // the actual truncation error, which is accumulated over the run.
+    class MpsSimulator : public IRuntimeDriver, public IQuantumGateSet
+    {
+        // Associated qubit manager instance to handle qubit representation.
+        CQubitManager *qbm;
+
+        // The register of currently active qubits, in order of their sites in the chain.
+        std::vector<Qubit> computeRegister;
+
+        // Site tensors of the chain, matching the compute register.
+        std::vector<SiteTensor> sites;
+
+        // Orthogonality center: sites to its left are left-normalized, sites to its right right-normalized.
+        long center = 0;
+
+        // Truncation settings for the bond dimension and the accumulated discarded weight.
+        long maxBondDimension;
+        double truncationThreshold;
+        double truncationError = 0.0;
+
+        // Per-simulator PRNG used to sample measurement outcomes.
+        RandomGenerator rng;
+
+        // To be called by quantum gate set operations.
+        void ApplyGate(const Eigen::Matrix2cd& gate, Qubit target);
+        void ApplyControlledGate(const Eigen::Matrix2cd& gate, long numControls, Qubit controls[], Qubit target);
+        void ApplyPauliExp(long numControls, Qubit controls[], long numTargets, PauliId paulis[], Qubit targets[], double theta);
+
+        // Applies a 2^k x 2^k operator to k qubits, the first qubit corresponding to the most significant bit.
+        void ApplyOperator(const Eigen::MatrixXcd& op, const std::vector<Qubit>& qubits);
+
+        // Chain manipulation.
+        void MoveCenter(long site);
+        void SwapSites(long site);
+        long GatherSites(const std::vector<Qubit>& qubits, std::vector<int>& blockPositions);
+        std::vector<Eigen::MatrixXcd> ContractSites(long first, long count) const;
+        void DecomposeSites(long first, long count, std::vector<Eigen::MatrixXcd>& theta);
+
+        long GetSiteIdx(Qubit q) const
+        {
+            return std::distance(
+                this->computeRegister.begin(),
+                std::find(this->computeRegister.begin(), this->computeRegister.end(), q)
+            );
+        }
+
+      public:
+        MpsSimulator(uint32_t userProvidedSeed = 0, uint64_t streamId = 0, long maxBondDimension = 64,
+                     double truncationThreshold = 1e-12)
+            : maxBondDimension(maxBondDimension)
+            , truncationThreshold(truncationThreshold)
+            , rng(userProvidedSeed, streamId)
+        {
+            this->qbm = new CQubitManager();
+        }
+        ~MpsSimulator()
+        {
+            delete this->qbm;
+        }
+
+        // Upper limit for bond dimensions, and the largest relative weight of singular values discarded per split.
+        void SetMaxBondDimension(long dimension)
+        {
+            this->maxBondDimension = dimension;
+        }
+        void SetTruncationThreshold(double threshold)
+        {
+            this->truncationThreshold = threshold;
+        }
+
+        // Sum of the discarded weight of all truncations so far, an upper bound on 1 - |〈Ψ_exact|Ψ⟩|^2.
+        double GetTruncationError() const
+        {
+            return this->truncationError;
+        }
+
+        // Largest bond dimension currently present in the chain.
+        long GetBondDimension() const;
+
+
+        ///
+        /// Implementation of IRuntimeDriver
+        ///
+        void ReleaseResult(Result r) override;
+
+        bool AreEqualResults(Result r1, Result r2) override;
+
+        ResultValue GetResultValue(Result r) override;
+
+        Result UseZero() override;
+
+        Result UseOne() override;
+
+        Qubit AllocateQubit() override;
+
+        void ReleaseQubit(Qubit q) override;
+
+        std::string QubitToString(Qubit q) override;
+
+
+        ///
+        /// Implementation of IQuantumGateSet
+        ///
+        void X(Qubit q) override;
+
+        void ControlledX(long numControls, Qubit controls[], Qubit target) override;
+
+        void Y(Qubit q) override;
+
+        void ControlledY(long numControls, Qubit controls[], Qubit target) override;
+
+        void Z(Qubit q) override;
+
+        void ControlledZ(long numControls, Qubit controls[], Qubit target) override;
+
+        void H(Qubit q) override;
+
+        void ControlledH(long numControls, Qubit controls[], Qubit target) override;
+
+        void S(Qubit q) override;
+
+        void ControlledS(long numControls, Qubit controls[], Qubit target) override;
+
+        void AdjointS(Qubit q) override;
+
+        void ControlledAdjointS(long numControls, Qubit controls[], Qubit target) override;
+
+        void T(Qubit q) override;
+
+        void ControlledT(long numControls, Qubit controls[], Qubit target) override;
+
+        void AdjointT(Qubit q) override;
+
+        void ControlledAdjointT(long numControls, Qubit controls[], Qubit target) override;
+
+        void R(PauliId axis, Qubit target, double theta) override;
+
+        void ControlledR(long numControls, Qubit controls[], PauliId axis, Qubit target, double theta) override;
+
+        void Exp(long numTargets, PauliId paulis[], Qubit targets[], double theta) override;
+
+        void ControlledExp(long numControls, Qubit controls[], long numTargets, PauliId paulis[], Qubit targets[], double theta) override;
+
+        Result Measure(long numBases, PauliId bases[], long numTargets, Qubit targets[]) override;
+
+    }; // class MpsSimulator
+
+} // namespace Quantum
+} // namespace Microsoft
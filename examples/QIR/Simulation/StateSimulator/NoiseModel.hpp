@@ -0,0 +1,131 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <cmath>
+#include <complex>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Eigen/Dense"
+
+namespace Microsoft
+{
+namespace Quantum
+{
+    enum class NoiseChannel
+    {
+        Depolarizing,     // ρ → (1-p)ρ + p/3 (XρX + YρY + ZρZ)
+        Dephasing,        // ρ → (1-p)ρ + p ZρZ
+        AmplitudeDamping, // decay |1⟩ → |0⟩ with probability γ
+    };
+
+    struct NoiseEntry
+    {
+        NoiseChannel channel;
+        double probability;
+    };
+
+    // Single-qubit noise channels applied to every qubit an operation acts on, right after the operation.
+    // A noise model file lists one channel per line as `<operation> <channel> <probability>`, e.g.
+    //
+    //     # all operations
+    //     *        depolarizing       0.001
+    //     T        dephasing          0.0005
+    //     X        amplitude_damping  0.0002
+    //     Measure  depolarizing       0.01
+    //
+    // Operation names follow the gate set (X, Y, Z, H, S, Sdag, T, Tdag, R, Exp, Swap, Unitary), controlled variants
+    // share the entry of the base operation, and channels listed for `Measure` act on the measured qubits beforehand.
+    class NoiseModel
+    {
+        std::unordered_map<std::string, std::vector<NoiseEntry>> entries;
+
+        static NoiseChannel ParseChannel(const std::string& name)
+        {
+            if (name == "depolarizing")
+                return NoiseChannel::Depolarizing;
+            if (name == "dephasing")
+                return NoiseChannel::Dephasing;
+            if (name == "amplitude_damping")
+                return NoiseChannel::AmplitudeDamping;
+            throw std::runtime_error("Unknown noise channel \"" + name + "\".");
+        }
+
+      public:
+        // Operations that channels can be listed for, besides `*` for all of them.
+        static constexpr const char* OPERATIONS[] = {"X", "Y", "Z", "H", "S", "Sdag", "T", "Tdag", "R", "Exp", "Swap",
+                                                     "Unitary", "Measure"};
+
+        static NoiseModel FromFile(const std::string& path)
+        {
+            std::ifstream file(path);
+            if (!file)
+                throw std::runtime_error("Cannot open noise model file \"" + path + "\".");
+
+            NoiseModel model;
+            std::string line;
+            while (std::getline(file, line)) {
+                std::istringstream tokens(line.substr(0, line.find('#')));
+                std::string operation, channel;
+                double probability;
+                if (!(tokens >> operation))
+                    continue;
+                if (!(tokens >> channel >> probability) || probability < 0 || probability > 1)
+                    throw std::runtime_error("Invalid noise model entry \"" + line + "\".");
+                model.Add(operation, ParseChannel(channel), probability);
+            }
+            return model;
+        }
+
+        void Add(const std::string& operation, NoiseChannel channel, double probability)
+        {
+            this->entries[operation].push_back({channel, probability});
+        }
+
+        bool IsEmpty() const
+        {
+            return this->entries.empty();
+        }
+
+        // Channels acting after the given operation, in order of application.
+        std::vector<NoiseEntry> ChannelsFor(const std::string& operation) const
+        {
+            std::vector<NoiseEntry> channels;
+            for (const std::string& key : {std::string("*"), operation}) {
+                auto it = this->entries.find(key);
+                if (it != this->entries.end())
+                    channels.insert(channels.end(), it->second.begin(), it->second.end());
+            }
+            return channels;
+        }
+
+        // Kraus operators {K_i} of a channel, ρ → Σ_i K_i ρ K_i^†.
+        static std::vector<Eigen::Matrix2cd> KrausOperators(const NoiseEntry& entry)
+        {
+            using namespace std::complex_literals;
+            const double p = entry.probability;
+            switch (entry.channel) {
+                case NoiseChannel::Depolarizing:
+                    return {std::sqrt(1 - p) * Eigen::Matrix2cd::Identity(),
+                            std::sqrt(p / 3) * (Eigen::Matrix2cd() << 0,1,1,0).finished(),
+                            std::sqrt(p / 3) * (Eigen::Matrix2cd() << 0,-1i,1i,0).finished(),
+                            std::sqrt(p / 3) * (Eigen::Matrix2cd() << 1,0,0,-1).finished()};
+                case NoiseChannel::Dephasing:
+                    return {std::sqrt(1 - p) * Eigen::Matrix2cd::Identity(),
+                            std::sqrt(p) * (Eigen::Matrix2cd() << 1,0,0,-1).finished()};
+                case NoiseChannel::AmplitudeDamping:
+                    return {(Eigen::Matrix2cd() << 1,0,0,std::sqrt(1 - p)).finished(),
+                            (Eigen::Matrix2cd() << 0,std::sqrt(p),0,0).finished()};
+            }
+            return {Eigen::Matrix2cd::Identity()};
+        }
+    };
+
+} // namespace Quantum
+} // namespace Microsoft
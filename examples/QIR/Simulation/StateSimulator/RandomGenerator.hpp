@@ -0,0 +1,116 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+namespace Microsoft
+{
+namespace Quantum
+{
+    // Per-instance pseudo random number generator based on xoshiro256++ (Blackman & Vigna).
+    // Unlike the global rand(), each simulator owns its own generator, so that several simulators
+    // can run in the same process (or on different threads) without sharing hidden state.
+    // Independent streams are obtained by advancing the state by 2^128 steps with `Jump`.
+    class RandomGenerator
+    {
+      public:
+        using StateType = std::array<uint64_t, 4>;
+
+      private:
+        StateType s;
+
+        static uint64_t Rotl(uint64_t x, int k)
+        {
+            return (x << k) | (x >> (64 - k));
+        }
+
+        // SplitMix64 is used to expand a single seed into the full 256 bit state.
+        static uint64_t SplitMix64(uint64_t& x)
+        {
+            uint64_t z = (x += 0x9e3779b97f4a7c15);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+            return z ^ (z >> 31);
+        }
+
+      public:
+        // Streams with different `stream` values but the same `seed` never overlap (up to 2^128 draws each).
+        // Selecting stream k costs k jumps, use `Split` to hand out many consecutive streams cheaply.
+        explicit RandomGenerator(uint64_t seed = 0, uint64_t stream = 0)
+        {
+            Seed(seed);
+            for (uint64_t i = 0; i < stream; i++)
+                Jump();
+        }
+
+        void Seed(uint64_t seed)
+        {
+            for (uint64_t& word : this->s)
+                word = SplitMix64(seed);
+        }
+
+        uint64_t Next()
+        {
+            const uint64_t result = Rotl(this->s[0] + this->s[3], 23) + this->s[0];
+            const uint64_t t = this->s[1] << 17;
+
+            this->s[2] ^= this->s[0];
+            this->s[3] ^= this->s[1];
+            this->s[1] ^= this->s[2];
+            this->s[0] ^= this->s[3];
+            this->s[2] ^= t;
+            this->s[3] = Rotl(this->s[3], 45);
+
+            return result;
+        }
+
+        // Uniform double in [0, 1) with the full 53 bits of mantissa resolution.
+        double NextDouble()
+        {
+            return (this->Next() >> 11) * 0x1.0p-53;
+        }
+
+        // Advance the generator by 2^128 calls to `Next`, i.e. to the start of the next stream.
+        void Jump()
+        {
+            static const uint64_t JUMP[] = {0x180ec6d33cfd0aba, 0xd5a61266f0c9392c,
+                                            0xa9582618e03fc9aa, 0x39abdc4529b1661c};
+
+            StateType jumped = {0, 0, 0, 0};
+            for (uint64_t jumpWord : JUMP) {
+                for (int b = 0; b < 64; b++) {
+                    if (jumpWord & (uint64_t(1) << b)) {
+                        for (int i = 0; i < 4; i++)
+                            jumped[i] ^= this->s[i];
+                    }
+                    this->Next();
+                }
+            }
+            this->s = jumped;
+        }
+
+        // Returns a generator for the current stream and moves this generator on to the next stream.
+        // Repeated calls hand out non-overlapping streams, e.g. one per thread or per shot.
+        RandomGenerator Split()
+        {
+            RandomGenerator stream = *this;
+            this->Jump();
+            return stream;
+        }
+
+        StateType GetState() const
+        {
+            return this->s;
+        }
+
+        void SetState(const StateType& state)
+        {
+            this->s = state;
+        }
+    };
+
+} // namespace Quantum
+} // namespace Microsoft
@@ -0,0 +1,107 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <complex>
+
+// Reductions over the state vector whose result does not depend on the number of threads.
+//
+// A plain `omp parallel for reduction(+:...)` adds up per-thread partial sums, so the rounding, and with it the
+// sampled measurement outcomes under a fixed seed, changes with the thread count. Here the range is cut into
+// blocks whose boundaries only depend on its length. Each block is summed with Neumaier's compensated summation,
+// and the block sums are combined by a pairwise tree of fixed shape, so every run performs the same floating
+// point operations in the same order. This relies on the compiler keeping the order of additions, i.e. it must
+// not be built with -ffast-math or similar flags.
+
+namespace Microsoft
+{
+namespace Quantum
+{
+    // Sum with a running compensation of the rounding error of each addition.
+    class CompensatedSum
+    {
+        double sum = 0.0, compensation = 0.0;
+
+      public:
+        void Add(double value)
+        {
+            double t = this->sum + value;
+            if (std::abs(this->sum) >= std::abs(value))
+                this->compensation += (this->sum - t) + value;
+            else
+                this->compensation += (value - t) + this->sum;
+            this->sum = t;
+        }
+
+        double Value() const
+        {
+            return this->sum + this->compensation;
+        }
+    };
+
+    class CompensatedComplexSum
+    {
+        CompensatedSum re, im;
+
+      public:
+        void Add(std::complex<double> value)
+        {
+            this->re.Add(value.real());
+            this->im.Add(value.imag());
+        }
+
+        std::complex<double> Value() const
+        {
+            return {this->re.Value(), this->im.Value()};
+        }
+    };
+
+    namespace Reduction
+    {
+        // At most this many blocks, so that the partial sums fit on the stack, and at least this many terms per block.
+        constexpr long MAX_BLOCKS = 256;
+        constexpr long MIN_BLOCK_SIZE = 1024;
+
+        template <typename T, typename Accumulator, typename Term>
+        inline T Sum(long count, const Term& term)
+        {
+            const long blockSize = std::max(MIN_BLOCK_SIZE, (count + MAX_BLOCKS - 1) / MAX_BLOCKS);
+            const long numBlocks = (count + blockSize - 1) / blockSize;
+            std::array<T, MAX_BLOCKS> partials = {};
+
+            #pragma omp parallel for if(numBlocks > 1)
+            for (long block = 0; block < numBlocks; block++) {
+                Accumulator acc;
+                const long end = std::min(count, (block + 1) * blockSize);
+                for (long i = block * blockSize; i < end; i++)
+                    acc.Add(term(i));
+                partials[block] = acc.Value();
+            }
+
+            for (long stride = 1; stride < numBlocks; stride *= 2) {
+                for (long i = 0; i + stride < numBlocks; i += 2 * stride)
+                    partials[i] += partials[i + stride];
+            }
+            return partials[0];
+        }
+    } // namespace Reduction
+
+    // Σ_i term(i) for i in [0, count), bit-identical for any number of threads.
+    template <typename Term>
+    inline double DeterministicSum(long count, const Term& term)
+    {
+        return Reduction::Sum<double, CompensatedSum>(count, term);
+    }
+
+    template <typename Term>
+    inline std::complex<double> DeterministicComplexSum(long count, const Term& term)
+    {
+        return Reduction::Sum<std::complex<double>, CompensatedComplexSum>(count, term);
+    }
+
+} // namespace Quantum
+} // namespace Microsoft
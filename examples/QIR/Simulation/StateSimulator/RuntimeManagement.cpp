@@ -1,7 +1,10 @@
 // Copyright (c) Microsoft Corporation. All rights reserved.
 // Licensed under the MIT License.
 
+#include <memory>
+
 #include "StateSimulator.hpp"
+#include "SmallStateSimulator.hpp"
 
 using namespace Microsoft::Quantum;
 
@@ -12,18 +15,48 @@ using namespace Microsoft::Quantum;
 
 Qubit StateSimulator::AllocateQubit()
 {
+    // Factored-out qubits count towards the budget, as any operation on them brings them back into the state.
+    CheckMemoryBudget(this->numActiveQubits + this->classicalQubits.size() + 1);
     Qubit q = this->qbm->Allocate();
-    this->computeRegister.push_back(q);
-    UpdateState(this->numActiveQubits++);  // |Ψ'⟩ = |Ψ⟩ ⊗ |0⟩
+    this->allocationOrder.push_back(q);
+    AddToRegister(q);
     return q;
 }
 
 void StateSimulator::ReleaseQubit(Qubit q)
 {
+    // A factored-out qubit is only dropped.
+    long classical = FindClassical(q);
+    if (classical >= 0)
+        this->classicalQubits.erase(this->classicalQubits.begin() + classical);
+    else
+        RemoveFromRegister(q);
+    this->allocationOrder.erase(std::find(this->allocationOrder.begin(), this->allocationOrder.end(), q));
+    this->qbm->Release(q);
+}
+
+void StateSimulator::AddToRegister(Qubit q)
+{
+    CheckMemoryBudget(this->numActiveQubits + 1);
+    this->computeRegister.push_back(q);
+    this->pauliFrame.push_back(0);
+    for (DiagonalTerm& term : this->diagonalTerms) {
+        // The new qubit takes the lowest bit of the basis index.
+        term.controlMask <<= 1;
+        term.controlValue <<= 1;
+        term.z <<= 1;
+    }
+    UpdateState(this->numActiveQubits++);  // |Ψ'⟩ = |Ψ⟩ ⊗ |0⟩
+}
+
+void StateSimulator::RemoveFromRegister(Qubit q)
+{
+    // The removed qubit is in a product state, so its Pauli frame only changes the global phase and is dropped.
+    ApplyPendingDiagonal();
     UpdateState(GetQubitIdx(q), /*remove=*/true);  // ρ' = tr_i[|Ψ⟩〈Ψ|]
     this->numActiveQubits--;
+    this->pauliFrame.erase(this->pauliFrame.begin() + GetQubitIdx(q));
     this->computeRegister.erase(this->computeRegister.begin() + GetQubitIdx(q));
-    this->qbm->Release(q);
 }
 
 std::string StateSimulator::QubitToString(Qubit q)
@@ -60,3 +93,35 @@ Result StateSimulator::UseOne()
 {
     return one;
 }
+
+
+///
+/// Runtime driver instantiation
+///
+
+namespace Microsoft
+{
+namespace Quantum
+{
+    // Picks a fixed-size simulator for programs declaring at most 10 qubits, rounding up to an even count so
+    // that kernels never run over more than 4x the amplitudes in use. Larger or unknown registers (`numQubits`
+    // of zero) get the dynamically sized StateSimulator. The fixed-size simulator only implements the runtime
+    // driver and the basic gate set, without diagnostics, extended gates, noise or checkpoints, so callers opt
+    // in to it explicitly.
+    std::unique_ptr<IRuntimeDriver> CreateSmallStateSimulator(uint32_t userProvidedSeed, long numQubits)
+    {
+        if (numQubits <= 0 || numQubits > 10)
+            return std::make_unique<StateSimulator>(userProvidedSeed);
+        if (numQubits <= 2)
+            return std::make_unique<SmallStateSimulator<2>>(userProvidedSeed);
+        if (numQubits <= 4)
+            return std::make_unique<SmallStateSimulator<4>>(userProvidedSeed);
+        if (numQubits <= 6)
+            return std::make_unique<SmallStateSimulator<6>>(userProvidedSeed);
+        if (numQubits <= 8)
+            return std::make_unique<SmallStateSimulator<8>>(userProvidedSeed);
+        return std::make_unique<SmallStateSimulator<10>>(userProvidedSeed);
+    }
+
+} // namespace Quantum
+} // namespace Microsoft
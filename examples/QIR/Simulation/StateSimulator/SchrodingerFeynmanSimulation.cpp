@@ -0,0 +1,502 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include "SchrodingerFeynmanSimulator.hpp"
+
+using namespace Microsoft::Quantum;
+using namespace std::complex_literals;
+
+# define PI 3.14159265358979323846
+# define MAX_PATHS 1e18
+
+
+///
+/// Recording
+///
+
+void SchrodingerFeynmanSimulator::Record(const Eigen::Matrix2cd& gate, long numControls, Qubit controls[], Qubit target)
+{
+    RecordedGate recorded;
+    recorded.gate = gate;
+    for (long i = 0; i < numControls; i++)
+        recorded.controls.push_back(GetWire(controls[i]));
+    recorded.targets.push_back(GetWire(target));
+    this->gates.push_back(std::move(recorded));
+}
+
+void SchrodingerFeynmanSimulator::RecordPauliExp(long numControls, Qubit controls[], long numTargets, PauliId paulis[], Qubit targets[], double theta)
+{
+    RecordedGate recorded;
+    recorded.pauliExp = true;
+    recorded.theta = theta;
+    for (long i = 0; i < numControls; i++)
+        recorded.controls.push_back(GetWire(controls[i]));
+    for (long i = 0; i < numTargets; i++) {
+        recorded.targets.push_back(GetWire(targets[i]));
+        recorded.paulis.push_back(paulis[i]);
+    }
+    this->gates.push_back(std::move(recorded));
+}
+
+
+///
+/// Path summation
+///
+
+PauliMasks SchrodingerFeynmanSimulator::GetPauliMasks(const RecordedGate& gate, bool firstHalf) const
+{
+    // Each half takes the factor i^(number of Y) of its part of P = i^|x∧z| X^x Z^z.
+    PauliMasks masks;
+    int numY = 0;
+    for (size_t i = 0; i < gate.targets.size(); i++) {
+        if ((gate.targets[i] < CutPosition()) != firstHalf)
+            continue;
+        const uint64_t mask = GetHalfMask(gate.targets[i]);
+        if (gate.paulis[i] == PauliId_X || gate.paulis[i] == PauliId_Y)
+            masks.x |= mask;
+        if (gate.paulis[i] == PauliId_Z || gate.paulis[i] == PauliId_Y)
+            masks.z |= mask;
+        numY += gate.paulis[i] == PauliId_Y;
+    }
+    masks.phase = std::pow(1i, numY % 4);
+    return masks;
+}
+
+std::vector<SchrodingerFeynmanSimulator::Step> SchrodingerFeynmanSimulator::BuildSteps() const
+{
+    const long cut = CutPosition();
+    std::vector<Step> steps;
+    size_t numCuts = 0;
+    for (const RecordedGate& gate : this->gates) {
+        // Identity factors of a Pauli exponential leave their qubits out of the gate.
+        bool first = false, second = false;
+        uint64_t firstControls = 0, secondControls = 0;
+        for (long wire : gate.controls) {
+            (wire < cut ? first : second) = true;
+            (wire < cut ? firstControls : secondControls) |= GetHalfMask(wire);
+        }
+        for (size_t i = 0; i < gate.targets.size(); i++) {
+            if (!gate.pauliExp || gate.paulis[i] != PauliId_I)
+                (gate.targets[i] < cut ? first : second) = true;
+        }
+
+        Step step;
+        step.gate = &gate;
+        if (!second) {
+            step.kind = Step::First;
+            steps.push_back(std::move(step));
+            continue;
+        }
+        if (!first) {
+            step.kind = Step::Second;
+            steps.push_back(std::move(step));
+            continue;
+        }
+
+        step.kind = Step::Cut;
+        step.cut = numCuts++;
+        step.terms.push_back({1.0, HalfOperator(), HalfOperator()});
+        CutTerm term;
+        term.first.projector = firstControls;
+        term.second.projector = secondControls;
+        if (!gate.pauliExp) {
+            // cU = 1 ⊗ 1 + P_A(U - 1) ⊗ P_B, with U on the half of its target.
+            HalfOperator& op = gate.targets[0] < cut ? term.first : term.second;
+            op.kind = HalfOperator::Gate;
+            op.gate = gate.gate - Eigen::Matrix2cd::Identity();
+            op.target = GetHalfMask(gate.targets[0]);
+            term.coefficient = 1.0;
+            step.terms.push_back(term);
+        } else {
+            // exp(iθP) - 1 = (cos(θ) - 1) 1 ⊗ 1 + i sin(θ) P_A ⊗ P_B on the controlled subspace, where the first
+            // term merges with the identity without controls.
+            if (gate.controls.empty()) {
+                step.terms[0].coefficient = std::cos(gate.theta);
+            } else {
+                term.coefficient = std::cos(gate.theta) - 1.0;
+                step.terms.push_back(term);
+            }
+            term.coefficient = 1i * std::sin(gate.theta);
+            for (bool firstHalf : {true, false}) {
+                HalfOperator& op = firstHalf ? term.first : term.second;
+                op.pauli = GetPauliMasks(gate, firstHalf);
+                if (op.pauli.x != 0 || op.pauli.z != 0 || op.pauli.phase != 1.0)
+                    op.kind = HalfOperator::Pauli;
+            }
+            step.terms.push_back(term);
+        }
+        steps.push_back(std::move(step));
+    }
+    return steps;
+}
+
+void SchrodingerFeynmanSimulator::ApplyToHalf(const RecordedGate& gate, bool firstHalf, std::complex<double>* psi, uint64_t size) const
+{
+    uint64_t controlMask = 0;
+    for (long wire : gate.controls)
+        controlMask |= GetHalfMask(wire);
+    if (!gate.pauliExp) {
+        ApplyGateKernel(psi, size, gate.gate, GetHalfMask(gate.targets[0]), controlMask);
+        return;
+    }
+    // exp(iθP)|Ψ⟩ = cos(θ)|Ψ⟩ + i sin(θ) P|Ψ⟩, with P entirely on this half.
+    PauliMasks masks = GetPauliMasks(gate, firstHalf);
+    ApplyPauliSumKernel(psi, size, std::cos(gate.theta), 1i * std::sin(gate.theta), masks, controlMask);
+}
+
+void SchrodingerFeynmanSimulator::ApplyHalfOperator(const HalfOperator& op, std::complex<double>* psi, uint64_t size)
+{
+    if (op.projector != 0) {
+        const long count = static_cast<long>(size);
+        #pragma omp parallel for if(count > 4096)
+        for (long b = 0; b < count; b++) {
+            if ((b & op.projector) != op.projector)
+                psi[b] = 0.0;
+        }
+    }
+    if (op.kind == HalfOperator::Gate)
+        ApplyGateKernel(psi, size, op.gate, op.target);
+    else if (op.kind == HalfOperator::Pauli)
+        ApplyPauliSumKernel(psi, size, 0.0, 1.0, op.pauli);
+}
+
+std::complex<double> SchrodingerFeynmanSimulator::RunSteps(const std::vector<Step>& steps, size_t begin, size_t end,
+                                                           const std::vector<size_t>& path,
+                                                           std::vector<std::complex<double>>& first,
+                                                           std::vector<std::complex<double>>& second) const
+{
+    std::complex<double> coefficient = 1.0;
+    for (size_t s = begin; s < end; s++) {
+        const Step& step = steps[s];
+        if (step.kind == Step::First) {
+            ApplyToHalf(*step.gate, true, first.data(), first.size());
+        } else if (step.kind == Step::Second) {
+            ApplyToHalf(*step.gate, false, second.data(), second.size());
+        } else {
+            const CutTerm& term = step.terms[path[step.cut]];
+            coefficient *= term.coefficient;
+            if (coefficient == 0.0)
+                return 0.0;
+            ApplyHalfOperator(term.first, first.data(), first.size());
+            ApplyHalfOperator(term.second, second.data(), second.size());
+        }
+    }
+    return coefficient;
+}
+
+double SchrodingerFeynmanSimulator::CountPaths() const
+{
+    double numPaths = 1.0;
+    for (const Step& step : BuildSteps()) {
+        if (step.kind == Step::Cut)
+            numPaths *= step.terms.size();
+    }
+    return numPaths;
+}
+
+std::vector<std::complex<double>> SchrodingerFeynmanSimulator::GetAmplitudes(const std::vector<uint64_t>& basisStates) const
+{
+    const std::vector<Step> steps = BuildSteps();
+    std::vector<size_t> radices;
+    for (const Step& step : steps) {
+        if (step.kind == Step::Cut)
+            radices.push_back(step.terms.size());
+    }
+    if (CountPaths() > MAX_PATHS)
+        throw std::runtime_error("The " + std::to_string(radices.size()) + " gates across the cut give too many paths to sum up.");
+
+    // Split each basis index into the indices of the two halves.
+    const long cut = CutPosition();
+    const long numStates = static_cast<long>(basisStates.size());
+    std::vector<uint64_t> firstIndices(numStates), secondIndices(numStates);
+    for (long i = 0; i < numStates; i++) {
+        if (this->numQubits < 64 && (basisStates[i] >> this->numQubits) != 0)
+            throw std::runtime_error("Basis state " + std::to_string(basisStates[i]) + " exceeds the " + std::to_string(this->numQubits) + " qubits.");
+        firstIndices[i] = basisStates[i] >> (this->numQubits - cut);
+        secondIndices[i] = basisStates[i] & ((uint64_t(1) << (this->numQubits - cut)) - 1);
+    }
+
+    // Paths are grouped by their terms of the first `numGroupCuts` cut gates, which all precede the step `split`.
+    // Within a group, the last digit of a path changes fastest.
+    const size_t numGroupCuts = radices.size() / 2;
+    size_t split = steps.size();
+    long numGroups = 1, numGroupPaths = 1;
+    for (size_t s = 0; s < steps.size(); s++) {
+        if (steps[s].kind == Step::Cut && steps[s].cut == numGroupCuts) {
+            split = s;
+            break;
+        }
+    }
+    for (size_t c = 0; c < radices.size(); c++)
+        (c < numGroupCuts ? numGroups : numGroupPaths) *= radices[c];
+
+    const uint64_t firstSize = uint64_t(1) << cut, secondSize = uint64_t(1) << (this->numQubits - cut);
+    std::vector<std::complex<double>> amplitudes(numStates, 0.0);
+
+    // With a single group, the kernels parallelize over the halves instead.
+    #pragma omp parallel if(numGroups > 1)
+    {
+        std::vector<std::complex<double>> groupFirst, groupSecond, first, second, partial(numStates);
+        std::vector<size_t> path(radices.size());
+
+        #pragma omp for ordered schedule(dynamic, 1)
+        for (long g = 0; g < numGroups; g++) {
+            for (size_t c = numGroupCuts, rest = g; c-- > 0; rest /= radices[c])
+                path[c] = rest % radices[c];
+            groupFirst.assign(firstSize, 0.0);
+            groupSecond.assign(secondSize, 0.0);
+            groupFirst[0] = groupSecond[0] = 1.0;
+            const std::complex<double> groupCoefficient = RunSteps(steps, 0, split, path, groupFirst, groupSecond);
+
+            std::fill(partial.begin(), partial.end(), 0.0);
+            for (long p = 0; p < numGroupPaths && groupCoefficient != 0.0; p++) {
+                for (size_t c = radices.size(), rest = p; c-- > numGroupCuts; rest /= radices[c])
+                    path[c] = rest % radices[c];
+                first = groupFirst;
+                second = groupSecond;
+                const std::complex<double> coefficient = groupCoefficient * RunSteps(steps, split, steps.size(), path, first, second);
+                if (coefficient == 0.0)
+                    continue;
+                for (long i = 0; i < numStates; i++)
+                    partial[i] += coefficient * first[firstIndices[i]] * second[secondIndices[i]];
+            }
+
+            #pragma omp ordered
+            for (long i = 0; i < numStates; i++)
+                amplitudes[i] += partial[i];
+        }
+    }
+    return amplitudes;
+}
+
+
+///
+/// Qubit management
+///
+
+Qubit SchrodingerFeynmanSimulator::AllocateQubit()
+{
+    Qubit q = this->qbm->Allocate();
+    if (GetWire(q) >= MAX_QUBITS) {
+        this->qbm->Release(q);
+        throw std::runtime_error("The Schrödinger-Feynman simulator supports at most 64 qubits.");
+    }
+    this->numQubits = std::max(this->numQubits, GetWire(q) + 1);
+    return q;
+}
+
+void SchrodingerFeynmanSimulator::ReleaseQubit(Qubit q)
+{
+    // The wire stays in the register, returned to |0⟩ by the program.
+    this->qbm->Release(q);
+}
+
+std::string SchrodingerFeynmanSimulator::QubitToString(Qubit q)
+{
+    return std::to_string(this->qbm->GetQubitId(q));
+}
+
+
+///
+/// Result management
+///
+
+static Result zero = reinterpret_cast<Result>(0);
+static Result one = reinterpret_cast<Result>(1);
+
+void SchrodingerFeynmanSimulator::ReleaseResult(Result r) {}
+
+bool SchrodingerFeynmanSimulator::AreEqualResults(Result r1, Result r2)
+{
+    return (r1 == r2);
+}
+
+ResultValue SchrodingerFeynmanSimulator::GetResultValue(Result r)
+{
+    return (r == one) ? Result_One : Result_Zero;
+}
+
+Result SchrodingerFeynmanSimulator::UseZero()
+{
+    return zero;
+}
+
+Result SchrodingerFeynmanSimulator::UseOne()
+{
+    return one;
+}
+
+
+///
+/// Supported quantum operations
+///
+
+static Eigen::Matrix2cd SelectPauliOp(PauliId axis)
+{
+    switch (axis) {
+        case PauliId_X:
+            return (Eigen::Matrix2cd() << 0,1,1,0).finished();
+        case PauliId_Y:
+            return (Eigen::Matrix2cd() << 0,-1i,1i,0).finished();
+        case PauliId_Z:
+            return (Eigen::Matrix2cd() << 1,0,0,-1).finished();
+        default:
+            return Eigen::Matrix2cd::Identity();
+    }
+}
+
+void SchrodingerFeynmanSimulator::X(Qubit q)
+{
+    Record(SelectPauliOp(PauliId_X), 0, nullptr, q);
+}
+
+void SchrodingerFeynmanSimulator::ControlledX(long numControls, Qubit controls[], Qubit target)
+{
+    Record(SelectPauliOp(PauliId_X), numControls, controls, target);
+}
+
+void SchrodingerFeynmanSimulator::Y(Qubit q)
+{
+    Record(SelectPauliOp(PauliId_Y), 0, nullptr, q);
+}
+
+void SchrodingerFeynmanSimulator::ControlledY(long numControls, Qubit controls[], Qubit target)
+{
+    Record(SelectPauliOp(PauliId_Y), numControls, controls, target);
+}
+
+void SchrodingerFeynmanSimulator::Z(Qubit q)
+{
+    Record(SelectPauliOp(PauliId_Z), 0, nullptr, q);
+}
+
+void SchrodingerFeynmanSimulator::ControlledZ(long numControls, Qubit controls[], Qubit target)
+{
+    Record(SelectPauliOp(PauliId_Z), numControls, controls, target);
+}
+
+void SchrodingerFeynmanSimulator::H(Qubit q)
+{
+    Eigen::Matrix2cd h; h << 1, 1,
+                             1,-1;
+    h = h / sqrt(2);
+    Record(h, 0, nullptr, q);
+}
+
+void SchrodingerFeynmanSimulator::ControlledH(long numControls, Qubit controls[], Qubit target)
+{
+    Eigen::Matrix2cd h; h << 1, 1,
+                             1,-1;
+    h = h / sqrt(2);
+    Record(h, numControls, controls, target);
+}
+
+void SchrodingerFeynmanSimulator::S(Qubit q)
+{
+    Eigen::Matrix2cd s; s << 1,  0,
+                             0, 1i;
+    Record(s, 0, nullptr, q);
+}
+
+void SchrodingerFeynmanSimulator::ControlledS(long numControls, Qubit controls[], Qubit target)
+{
+    Eigen::Matrix2cd s; s << 1,  0,
+                             0, 1i;
+    Record(s, numControls, controls, target);
+}
+
+void SchrodingerFeynmanSimulator::AdjointS(Qubit q)
+{
+    Eigen::Matrix2cd sdag; sdag << 1,  0,
+                                   0,-1i;
+    Record(sdag, 0, nullptr, q);
+}
+
+void SchrodingerFeynmanSimulator::ControlledAdjointS(long numControls, Qubit controls[], Qubit target)
+{
+    Eigen::Matrix2cd sdag; sdag << 1,  0,
+                                   0,-1i;
+    Record(sdag, numControls, controls, target);
+}
+
+void SchrodingerFeynmanSimulator::T(Qubit q)
+{
+    Eigen::Matrix2cd t; t << 1, 0,
+                             0, exp(1i*PI/4.);
+    Record(t, 0, nullptr, q);
+}
+
+void SchrodingerFeynmanSimulator::ControlledT(long numControls, Qubit controls[], Qubit target)
+{
+    Eigen::Matrix2cd t; t << 1, 0,
+                             0, exp(1i*PI/4.);
+    Record(t, numControls, controls, target);
+}
+
+void SchrodingerFeynmanSimulator::AdjointT(Qubit q)
+{
+    Eigen::Matrix2cd tdag; tdag << 1, 0,
+                                   0, exp(-1i*PI/4.);
+    Record(tdag, 0, nullptr, q);
+}
+
+void SchrodingerFeynmanSimulator::ControlledAdjointT(long numControls, Qubit controls[], Qubit target)
+{
+    Eigen::Matrix2cd tdag; tdag << 1, 0,
+                                   0, exp(-1i*PI/4.);
+    Record(tdag, numControls, controls, target);
+}
+
+void SchrodingerFeynmanSimulator::R(PauliId axis, Qubit q, double theta)
+{
+    ControlledR(0, nullptr, axis, q, theta);
+}
+
+void SchrodingerFeynmanSimulator::ControlledR(long numControls, Qubit controls[], PauliId axis, Qubit target, double theta)
+{
+    // R_P(θ) = exp(-iθ/2 P) = cos(θ/2) - i sin(θ/2) P
+    Eigen::Matrix2cd r = std::cos(theta / 2) * Eigen::Matrix2cd::Identity() - 1i * std::sin(theta / 2) * SelectPauliOp(axis);
+    if (axis == PauliId_I)
+        r = std::exp(-1i * theta / 2.0) * Eigen::Matrix2cd::Identity();
+    Record(r, numControls, controls, target);
+}
+
+void SchrodingerFeynmanSimulator::Exp(long numTargets, PauliId paulis[], Qubit targets[], double theta)
+{
+    RecordPauliExp(0, nullptr, numTargets, paulis, targets, theta);
+}
+
+void SchrodingerFeynmanSimulator::ControlledExp(long numControls, Qubit controls[], long numTargets, PauliId paulis[], Qubit targets[], double theta)
+{
+    RecordPauliExp(numControls, controls, numTargets, paulis, targets, theta);
+}
+
+Result SchrodingerFeynmanSimulator::Measure(long numBases, PauliId bases[], long numTargets, Qubit targets[])
+{
+    throw std::runtime_error("The Schrödinger-Feynman simulator only computes amplitudes and does not support measurements.");
+}
+
+
+///
+/// Runtime driver instantiation
+///
+
+namespace Microsoft
+{
+namespace Quantum
+{
+    // Simulator recording the gates of a program, whose output amplitudes are computed by `GetAmplitudes`.
+    std::unique_ptr<IRuntimeDriver> CreateSchrodingerFeynmanSimulator()
+    {
+        return std::make_unique<SchrodingerFeynmanSimulator>();
+    }
+
+} // namespace Quantum
+} // namespace Microsoft
@@ -0,0 +1,211 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <complex>
+#include <cstdint>
+#include <vector>
+
+#include "QirRuntimeApi_I.hpp"
+#include "QSharpSimApi_I.hpp"
+
+#include "QubitManager.hpp"
+#include "StateKernels.hpp"
+
+#include "Eigen/Dense"
+
+namespace Microsoft
+{
+namespace Quantum
+{
+    // Computes amplitudes of selected basis states at the end of a circuit too wide for a state vector, by
+    // hybrid Schrödinger-Feynman simulation. The gates of the program are recorded, and the register is cut into
+    // two halves. Gates within a half are applied to a state vector of that half with the kernels of the
+    // StateSimulator. A gate across the cut is split into a sum of products of operators on either half,
+    //     cU = 1 ⊗ 1 + P_A(U - 1) ⊗ P_B
+    // for a gate U controlled on the qubits of the projectors P_A and P_B onto their |1..1⟩, and
+    //     exp(iθ P_A ⊗ P_B) = cos(θ) 1 ⊗ 1 + i sin(θ) P_A ⊗ P_B
+    // for Pauli exponentials. Each choice of a term for every cut gate is a Feynman path, along which the halves
+    // evolve independently, and the amplitude of |x_A x_B⟩ is the sum over all paths of ψ_A(x_A) ψ_B(x_B).
+    //
+    // Memory thus stays within a few state vectors of n/2 qubits per thread, while the run time grows with the
+    // number of paths, i.e. exponentially in the number of gates across the cut. Paths are summed in parallel,
+    // grouped by their terms of the first half of the cut gates: the state of both halves up to the middle cut gate
+    // is computed once per group and shared by all its paths. Groups are added up in a fixed order, so amplitudes do
+    // not depend on the number of threads.
+    //
+    // Measurements are not supported. Qubits are numbered in order of their ids, which the qubit manager hands out
+    // from zero, and a released qubit keeps its place in the register, to be handed out again. As the program has
+    // to return qubits to |0⟩ before releasing them, the qubits reusing it continue on the same wire.
+    class SchrodingerFeynmanSimulator : public IRuntimeDriver, public IQuantumGateSet
+    {
+        static constexpr long MAX_QUBITS = 64;
+
+        // A gate as recorded: a controlled single-qubit gate, or a controlled Pauli exponential exp(iθP) on the
+        // `paulis` of the `targets` (gate and paulis unused, respectively). Qubits are given by their wire.
+        struct RecordedGate
+        {
+            Eigen::Matrix2cd gate;
+            std::vector<long> controls;
+            std::vector<long> targets;
+            std::vector<PauliId> paulis;
+            double theta = 0.0;
+            bool pauliExp = false;
+        };
+
+        // The operator of a term on one half, applied as: zero all amplitudes outside the |1..1⟩ subspace of the
+        // `projector` bits, then apply `gate` to the `target` bit or the Pauli product of `pauli`, if any.
+        struct HalfOperator
+        {
+            uint64_t projector = 0;
+            enum { None, Gate, Pauli } kind = None;
+            Eigen::Matrix2cd gate;
+            uint64_t target = 0;
+            PauliMasks pauli;
+        };
+
+        // A term c O_A ⊗ O_B of a gate across the cut.
+        struct CutTerm
+        {
+            std::complex<double> coefficient;
+            HalfOperator first, second;
+        };
+
+        // A gate applied to the halves: within the first or second half, or across the cut as a sum of terms, where
+        // `cut` numbers the gates across the cut.
+        struct Step
+        {
+            enum { First, Second, Cut } kind;
+            const RecordedGate* gate;
+            size_t cut = 0;
+            std::vector<CutTerm> terms;
+        };
+
+        // Associated qubit manager instance to handle qubit representation.
+        CQubitManager *qbm;
+
+        // Number of wires, i.e. one more than the largest qubit id handed out, and the recorded gates.
+        long numQubits = 0;
+        std::vector<RecordedGate> gates;
+
+        // Qubits in the first half of the register, the others make up the second half.
+        long CutPosition() const
+        {
+            return this->numQubits / 2;
+        }
+
+        // Bit of a wire in the basis index of its half, the first wire of a half being the most significant bit.
+        uint64_t GetHalfMask(long wire) const
+        {
+            const long cut = CutPosition();
+            return uint64_t(1) << (wire < cut ? cut - 1 - wire : this->numQubits - 1 - wire);
+        }
+
+        long GetWire(Qubit q) const
+        {
+            return this->qbm->GetQubitId(q);
+        }
+
+        void Record(const Eigen::Matrix2cd& gate, long numControls, Qubit controls[], Qubit target);
+        void RecordPauliExp(long numControls, Qubit controls[], long numTargets, PauliId paulis[], Qubit targets[], double theta);
+
+        // Sorts the recorded gates by the halves they act on and splits the gates across the cut into their terms.
+        std::vector<Step> BuildSteps() const;
+        PauliMasks GetPauliMasks(const RecordedGate& gate, bool firstHalf) const;
+        void ApplyToHalf(const RecordedGate& gate, bool firstHalf, std::complex<double>* psi, uint64_t size) const;
+        static void ApplyHalfOperator(const HalfOperator& op, std::complex<double>* psi, uint64_t size);
+
+        // Applies the steps [begin, end) to both halves, taking the term of each cut gate from the path, and returns
+        // the product of the coefficients of these terms.
+        std::complex<double> RunSteps(const std::vector<Step>& steps, size_t begin, size_t end,
+                                      const std::vector<size_t>& path, std::vector<std::complex<double>>& first,
+                                      std::vector<std::complex<double>>& second) const;
+
+      public:
+        SchrodingerFeynmanSimulator()
+        {
+            this->qbm = new CQubitManager();
+        }
+        ~SchrodingerFeynmanSimulator()
+        {
+            delete this->qbm;
+        }
+
+        // Number of Feynman paths summed up for the gates recorded so far.
+        double CountPaths() const;
+
+        // Amplitudes of the given basis states at the end of the recorded gates. The first qubit (id 0) is the most
+        // significant bit of a basis index, as for `GetState`.
+        std::vector<std::complex<double>> GetAmplitudes(const std::vector<uint64_t>& basisStates) const;
+
+
+        ///
+        /// Implementation of IRuntimeDriver
+        ///
+        void ReleaseResult(Result r) override;
+
+        bool AreEqualResults(Result r1, Result r2) override;
+
+        ResultValue GetResultValue(Result r) override;
+
+        Result UseZero() override;
+
+        Result UseOne() override;
+
+        Qubit AllocateQubit() override;
+
+        void ReleaseQubit(Qubit q) override;
+
+        std::string QubitToString(Qubit q) override;
+
+
+        ///
+        /// Implementation of IQuantumGateSet
+        ///
+        void X(Qubit q) override;
+
+        void ControlledX(long numControls, Qubit controls[], Qubit target) override;
+
+        void Y(Qubit q) override;
+
+        void ControlledY(long numControls, Qubit controls[], Qubit target) override;
+
+        void Z(Qubit q) override;
+
+        void ControlledZ(long numControls, Qubit controls[], Qubit target) override;
+
+        void H(Qubit q) override;
+
+        void ControlledH(long numControls, Qubit controls[], Qubit target) override;
+
+        void S(Qubit q) override;
+
+        void ControlledS(long numControls, Qubit controls[], Qubit target) override;
+
+        void AdjointS(Qubit q) override;
+
+        void ControlledAdjointS(long numControls, Qubit controls[], Qubit target) override;
+
+        void T(Qubit q) override;
+
+        void ControlledT(long numControls, Qubit controls[], Qubit target) override;
+
+        void AdjointT(Qubit q) override;
+
+        void ControlledAdjointT(long numControls, Qubit controls[], Qubit target) override;
+
+        void R(PauliId axis, Qubit target, double theta) override;
+
+        void ControlledR(long numControls, Qubit controls[], PauliId axis, Qubit target, double theta) override;
+
+        void Exp(long numTargets, PauliId paulis[], Qubit targets[], double theta) override;
+
+        void ControlledExp(long numControls, Qubit controls[], long numTargets, PauliId paulis[], Qubit targets[], double theta) override;
+
+        Result Measure(long numBases, PauliId bases[], long numTargets, Qubit targets[]) override;
+
+    }; // class SchrodingerFeynmanSimulator
+
+} // namespace Quantum
+} // namespace Microsoft
@@ -0,0 +1,56 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "NoiseModel.hpp"
+#include "StateSimulator.hpp"
+
+namespace Microsoft
+{
+namespace Quantum
+{
+    // Keeps `StateSimulator` instances alive between runs of a program, e.g. in a shot loop. A returned simulator
+    // is reset rather than destroyed, so it keeps the amplitude buffer of its largest run, and acquiring it again
+    // allocates nothing. Acquire and Return may be called from several threads.
+    class SimulatorPool
+    {
+        NoiseModel noise;
+        std::vector<std::unique_ptr<StateSimulator>> idle;
+        std::mutex mutex;
+
+      public:
+        explicit SimulatorPool(NoiseModel noise = NoiseModel())
+            : noise(std::move(noise))
+        {}
+
+        // Hands out a simulator in the initial state for the given seed, creating one if none is idle.
+        std::unique_ptr<StateSimulator> Acquire(uint32_t userProvidedSeed = 0, uint64_t streamId = 0)
+        {
+            std::unique_ptr<StateSimulator> sim;
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                if (!this->idle.empty()) {
+                    sim = std::move(this->idle.back());
+                    this->idle.pop_back();
+                }
+            }
+            if (!sim)
+                return std::make_unique<StateSimulator>(userProvidedSeed, streamId, this->noise);
+            sim->Reset(userProvidedSeed, streamId);
+            return sim;
+        }
+
+        void Return(std::unique_ptr<StateSimulator> sim)
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->idle.push_back(std::move(sim));
+        }
+    };
+
+} // namespace Quantum
+} // namespace Microsoft
@@ -0,0 +1,383 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+#include "QirRuntimeApi_I.hpp"
+#include "QSharpSimApi_I.hpp"
+
+#include "QubitManager.hpp"
+#include "RandomGenerator.hpp"
+#include "StateKernels.hpp"
+
+#include "Eigen/Dense"
+
+namespace Microsoft
+{
+namespace Quantum
+{
+    // State simulator for programs using at most `MaxQubits` qubits at once, e.g. calibration circuits and unit
+    // tests. The 2^MaxQubits amplitudes are stored inline in the simulator object, so no memory is allocated when
+    // qubits come and go, and each qubit keeps a fixed bit of the basis index. Unused bits stay |0⟩, so all kernels
+    // run over the full, compile-time sized array, which the compiler can unroll and vectorize.
+    template <int MaxQubits>
+    class SmallStateSimulator : public IRuntimeDriver, public IQuantumGateSet
+    {
+        static_assert(MaxQubits > 0 && MaxQubits <= 16, "SmallStateSimulator is meant for at most 16 qubits.");
+        static constexpr uint64_t Size = uint64_t(1) << MaxQubits;
+
+        // Associated qubit manager instance to handle qubit representation.
+        CQubitManager *qbm;
+
+        // The currently active qubits and the bit of the basis index holding each of them.
+        std::array<Qubit, MaxQubits> computeRegister = {};
+        std::array<short, MaxQubits> bits = {};
+        short numActiveQubits = 0;
+        uint32_t usedBits = 0;
+
+        // Amplitudes of the state, starting out as the basis state |0..0⟩.
+        std::array<std::complex<double>, Size> stateVec = {1.0};
+
+        // Per-simulator PRNG used to sample measurement outcomes.
+        RandomGenerator rng;
+
+        short GetQubitIdx(Qubit q) const
+        {
+            return std::distance(
+                this->computeRegister.begin(),
+                std::find(this->computeRegister.begin(), this->computeRegister.begin() + this->numActiveQubits, q)
+            );
+        }
+
+        uint64_t GetQubitMask(Qubit q) const
+        {
+            return uint64_t(1) << this->bits[GetQubitIdx(q)];
+        }
+
+        uint64_t GetControlMask(long numControls, const Qubit controls[]) const
+        {
+            uint64_t mask = 0;
+            for (long i = 0; i < numControls; i++)
+                mask |= GetQubitMask(controls[i]);
+            return mask;
+        }
+
+        PauliMasks GetPauliMasks(long numTargets, const PauliId paulis[], const Qubit targets[]) const
+        {
+            PauliMasks masks;
+            for (long i = 0; i < numTargets; i++) {
+                uint64_t mask = GetQubitMask(targets[i]);
+                if (paulis[i] == PauliId_X || paulis[i] == PauliId_Y)
+                    masks.x |= mask;
+                if (paulis[i] == PauliId_Z || paulis[i] == PauliId_Y)
+                    masks.z |= mask;
+                if (paulis[i] == PauliId_Y)
+                    masks.phase *= std::complex<double>(0.0, 1.0);
+            }
+            return masks;
+        }
+
+        // |Ψ'⟩ = cU|Ψ⟩ for a single-qubit gate U, updating each pair of amplitudes differing in the target bit.
+        void ApplyGate(const Eigen::Matrix2cd& gate, uint64_t targetMask, uint64_t controlMask = 0)
+        {
+            const std::complex<double> g00 = gate(0,0), g01 = gate(0,1), g10 = gate(1,0), g11 = gate(1,1);
+            for (uint64_t k = 0; k < Size / 2; k++) {
+                uint64_t low = k & (targetMask - 1), i0 = ((k ^ low) << 1) | low, i1 = i0 | targetMask;
+                if ((i0 & controlMask) != controlMask)
+                    continue;
+                std::complex<double> a0 = this->stateVec[i0], a1 = this->stateVec[i1];
+                this->stateVec[i0] = g00 * a0 + g01 * a1;
+                this->stateVec[i1] = g10 * a0 + g11 * a1;
+            }
+        }
+
+        // |Ψ'⟩ = (α + βP)|Ψ⟩ on the subspace selected by `controlMask`, see `ApplyPauliSumKernel`.
+        void ApplyPauliSum(std::complex<double> alpha, std::complex<double> beta, const PauliMasks& masks,
+                           uint64_t controlMask = 0)
+        {
+            const std::complex<double> plus = beta * masks.phase, minus = -plus;
+            const uint64_t lowBit = masks.x & (~masks.x + 1);
+            for (uint64_t b = 0; b < Size; b++) {
+                if ((b & lowBit) || (b & controlMask) != controlMask)
+                    continue;
+                if (masks.x == 0) {
+                    this->stateVec[b] *= alpha + (Parity(b & masks.z) ? minus : plus);
+                } else {
+                    uint64_t flipped = b ^ masks.x;
+                    std::complex<double> v = this->stateVec[b], w = this->stateVec[flipped];
+                    this->stateVec[b] = alpha * v + (Parity(flipped & masks.z) ? minus : plus) * w;
+                    this->stateVec[flipped] = alpha * w + (Parity(b & masks.z) ? minus : plus) * v;
+                }
+            }
+        }
+
+        // 〈Ψ|P|Ψ⟩ of a Pauli product, see `ParityOverlapKernel`.
+        double PauliExpectation(const PauliMasks& masks) const
+        {
+            std::complex<double> overlap = 0.0;
+            for (uint64_t b = 0; b < Size; b++) {
+                std::complex<double> term = std::conj(this->stateVec[b ^ masks.x]) * this->stateVec[b];
+                overlap += Parity(b & masks.z) ? -term : term;
+            }
+            return std::real(masks.phase * overlap);
+        }
+
+        void ApplyPauliExp(uint64_t controlMask, long numTargets, PauliId paulis[], Qubit targets[], double theta)
+        {
+            // exp(iθP)|Ψ⟩ = cos(θ)|Ψ⟩ + i sin(θ) P|Ψ⟩
+            ApplyPauliSum(std::cos(theta), std::complex<double>(0.0, std::sin(theta)),
+                          GetPauliMasks(numTargets, paulis, targets), controlMask);
+        }
+
+        static Eigen::Matrix2cd SelectGate(char name)
+        {
+            using namespace std::complex_literals;
+            constexpr double pi = 3.14159265358979323846;
+            switch (name) {
+                case 'X':
+                    return (Eigen::Matrix2cd() << 0, 1, 1, 0).finished();
+                case 'Y':
+                    return (Eigen::Matrix2cd() << 0, -1i, 1i, 0).finished();
+                case 'Z':
+                    return (Eigen::Matrix2cd() << 1, 0, 0, -1).finished();
+                case 'H':
+                    return (Eigen::Matrix2cd() << 1, 1, 1, -1).finished() / std::sqrt(2.0);
+                case 'S':
+                    return (Eigen::Matrix2cd() << 1, 0, 0, 1i).finished();
+                case 's':
+                    return (Eigen::Matrix2cd() << 1, 0, 0, -1i).finished();
+                case 'T':
+                    return (Eigen::Matrix2cd() << 1, 0, 0, std::exp(1i * pi / 4.)).finished();
+                case 't':
+                    return (Eigen::Matrix2cd() << 1, 0, 0, std::exp(-1i * pi / 4.)).finished();
+                default:
+                    return Eigen::Matrix2cd::Identity();
+            }
+        }
+
+      public:
+        SmallStateSimulator(uint32_t userProvidedSeed = 0, uint64_t streamId = 0)
+            : rng(userProvidedSeed, streamId)
+        {
+            this->qbm = new CQubitManager();
+        }
+        ~SmallStateSimulator()
+        {
+            delete this->qbm;
+        }
+
+
+        ///
+        /// Implementation of IRuntimeDriver
+        ///
+        void ReleaseResult(Result r) override {}
+
+        bool AreEqualResults(Result r1, Result r2) override
+        {
+            return (r1 == r2);
+        }
+
+        ResultValue GetResultValue(Result r) override
+        {
+            return (r == UseOne()) ? Result_One : Result_Zero;
+        }
+
+        Result UseZero() override
+        {
+            return reinterpret_cast<Result>(0);
+        }
+
+        Result UseOne() override
+        {
+            return reinterpret_cast<Result>(1);
+        }
+
+        Qubit AllocateQubit() override
+        {
+            // Hand out the lowest free bit, which is |0⟩ in all stored amplitudes.
+            if (this->numActiveQubits == MaxQubits)
+                throw std::runtime_error("This simulator supports at most " + std::to_string(MaxQubits) + " active qubits.");
+            short bit = 0;
+            while (this->usedBits & (1u << bit))
+                bit++;
+            this->usedBits |= 1u << bit;
+
+            Qubit q = this->qbm->Allocate();
+            this->computeRegister[this->numActiveQubits] = q;
+            this->bits[this->numActiveQubits++] = bit;
+            return q;
+        }
+
+        void ReleaseQubit(Qubit q) override
+        {
+            // Reset the qubit to |0⟩ so that its bit can be handed out again. The released qubit is in a product state,
+            // (α|0⟩ + β|1⟩) ⊗ |Φ⟩, so both halves of the state are proportional to |Φ⟩. As in the StateSimulator, the
+            // half with the larger norm is kept, which draws nothing from the PRNG.
+            const uint64_t mask = GetQubitMask(q);
+            double norm0 = 0.0, norm1 = 0.0;
+            for (uint64_t k = 0; k < Size / 2; k++) {
+                uint64_t low = k & (mask - 1), i0 = ((k ^ low) << 1) | low;
+                norm0 += std::norm(this->stateVec[i0]);
+                norm1 += std::norm(this->stateVec[i0 | mask]);
+            }
+            const uint64_t kept = norm1 > norm0 ? mask : 0;
+            const double scale = 1 / std::sqrt(std::max(norm0, norm1));
+            for (uint64_t k = 0; k < Size / 2; k++) {
+                uint64_t low = k & (mask - 1), i0 = ((k ^ low) << 1) | low;
+                this->stateVec[i0] = scale * this->stateVec[i0 | kept];
+                this->stateVec[i0 | mask] = 0.0;
+            }
+
+            short idx = GetQubitIdx(q);
+            this->usedBits &= ~(1u << this->bits[idx]);
+            for (short i = idx; i + 1 < this->numActiveQubits; i++) {
+                this->computeRegister[i] = this->computeRegister[i + 1];
+                this->bits[i] = this->bits[i + 1];
+            }
+            this->numActiveQubits--;
+            this->qbm->Release(q);
+        }
+
+        std::string QubitToString(Qubit q) override
+        {
+            return std::to_string(this->qbm->GetQubitId(q));
+        }
+
+
+        ///
+        /// Implementation of IQuantumGateSet
+        ///
+        void X(Qubit q) override
+        {
+            ApplyGate(SelectGate('X'), GetQubitMask(q));
+        }
+
+        void ControlledX(long numControls, Qubit controls[], Qubit target) override
+        {
+            ApplyGate(SelectGate('X'), GetQubitMask(target), GetControlMask(numControls, controls));
+        }
+
+        void Y(Qubit q) override
+        {
+            ApplyGate(SelectGate('Y'), GetQubitMask(q));
+        }
+
+        void ControlledY(long numControls, Qubit controls[], Qubit target) override
+        {
+            ApplyGate(SelectGate('Y'), GetQubitMask(target), GetControlMask(numControls, controls));
+        }
+
+        void Z(Qubit q) override
+        {
+            ApplyGate(SelectGate('Z'), GetQubitMask(q));
+        }
+
+        void ControlledZ(long numControls, Qubit controls[], Qubit target) override
+        {
+            ApplyGate(SelectGate('Z'), GetQubitMask(target), GetControlMask(numControls, controls));
+        }
+
+        void H(Qubit q) override
+        {
+            ApplyGate(SelectGate('H'), GetQubitMask(q));
+        }
+
+        void ControlledH(long numControls, Qubit controls[], Qubit target) override
+        {
+            ApplyGate(SelectGate('H'), GetQubitMask(target), GetControlMask(numControls, controls));
+        }
+
+        void S(Qubit q) override
+        {
+            ApplyGate(SelectGate('S'), GetQubitMask(q));
+        }
+
+        void ControlledS(long numControls, Qubit controls[], Qubit target) override
+        {
+            ApplyGate(SelectGate('S'), GetQubitMask(target), GetControlMask(numControls, controls));
+        }
+
+        void AdjointS(Qubit q) override
+        {
+            ApplyGate(SelectGate('s'), GetQubitMask(q));
+        }
+
+        void ControlledAdjointS(long numControls, Qubit controls[], Qubit target) override
+        {
+            ApplyGate(SelectGate('s'), GetQubitMask(target), GetControlMask(numControls, controls));
+        }
+
+        void T(Qubit q) override
+        {
+            ApplyGate(SelectGate('T'), GetQubitMask(q));
+        }
+
+        void ControlledT(long numControls, Qubit controls[], Qubit target) override
+        {
+            ApplyGate(SelectGate('T'), GetQubitMask(target), GetControlMask(numControls, controls));
+        }
+
+        void AdjointT(Qubit q) override
+        {
+            ApplyGate(SelectGate('t'), GetQubitMask(q));
+        }
+
+        void ControlledAdjointT(long numControls, Qubit controls[], Qubit target) override
+        {
+            ApplyGate(SelectGate('t'), GetQubitMask(target), GetControlMask(numControls, controls));
+        }
+
+        void R(PauliId axis, Qubit target, double theta) override
+        {
+            // R_P(θ) = exp(-iθ/2 P)
+            ApplyPauliExp(0, 1, &axis, &target, -theta / 2);
+        }
+
+        void ControlledR(long numControls, Qubit controls[], PauliId axis, Qubit target, double theta) override
+        {
+            ApplyPauliExp(GetControlMask(numControls, controls), 1, &axis, &target, -theta / 2);
+        }
+
+        void Exp(long numTargets, PauliId paulis[], Qubit targets[], double theta) override
+        {
+            ApplyPauliExp(0, numTargets, paulis, targets, theta);
+        }
+
+        void ControlledExp(long numControls, Qubit controls[], long numTargets, PauliId paulis[], Qubit targets[], double theta) override
+        {
+            ApplyPauliExp(GetControlMask(numControls, controls), numTargets, paulis, targets, theta);
+        }
+
+        Result Measure(long numBases, PauliId bases[], long numTargets, Qubit targets[]) override
+        {
+            assert(numBases == numTargets);
+
+            // Probability of getting outcome Zero is p(+) = 〈Ψ|P_+|Ψ⟩ = (1 + 〈Ψ|P|Ψ⟩)/2.
+            PauliMasks masks = GetPauliMasks(numTargets, bases, targets);
+            double probZero = std::min(1.0, std::max(0.0, (1 + PauliExpectation(masks)) / 2));
+
+            // Select measurement outcome via PRNG.
+            double random0to1 = this->rng.NextDouble();
+            Result outcome = random0to1 < probZero ? UseZero() : UseOne();
+
+            // Update state vector with |Ψ'⟩ = 1/√p(m) P_m|Ψ⟩, where P_+- = (1 +- P)/2.
+            double prob = (outcome == UseZero()) ? probZero : 1 - probZero;
+            double scale = 1 / (2 * std::sqrt(prob));
+            ApplyPauliSum(scale, (outcome == UseZero()) ? scale : -scale, masks);
+
+            return outcome;
+        }
+
+    }; // class SmallStateSimulator
+
+} // namespace Quantum
+} // namespace Microsoft
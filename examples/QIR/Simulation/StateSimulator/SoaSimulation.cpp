@@ -0,0 +1,507 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include <cmath>
+#include <complex>
+#include <fstream>
+
+#include "SoaStateSimulator.hpp"
+#include "StateDump.hpp"
+
+using namespace Microsoft::Quantum;
+using namespace std::complex_literals;
+
+# define PI 3.14159265358979323846
+# define TOLERANCE 1e-6
+
+
+///
+/// State manipulation
+///
+
+void SoaStateSimulator::ApplyGate(const Eigen::Matrix2cd& gate, uint64_t targetMask, uint64_t controlMask)
+{
+    const double g00r = gate(0,0).real(), g00i = gate(0,0).imag(), g01r = gate(0,1).real(), g01i = gate(0,1).imag();
+    const double g10r = gate(1,0).real(), g10i = gate(1,0).imag(), g11r = gate(1,1).real(), g11i = gate(1,1).imag();
+    const uint64_t laneControl = controlMask % LANES, blockControl = controlMask / LANES;
+    const long numBlocks = static_cast<long>(this->blocks.size());
+
+    if (targetMask >= LANES) {
+        // The two amplitudes of each pair sit in the same lane of two different blocks, so the update is a plain
+        // element-wise operation on the real and imaginary arrays. Lanes failing a control keep their values.
+        const uint64_t blockTarget = targetMask / LANES;
+        #pragma omp parallel for if(numBlocks > 512)
+        for (long k = 0; k < numBlocks / 2; k++) {
+            uint64_t low = k & (blockTarget - 1), b0 = ((k ^ low) << 1) | low;
+            if ((b0 & blockControl) != blockControl)
+                continue;
+            AmplitudeBlock& x = this->blocks[b0];
+            AmplitudeBlock& y = this->blocks[b0 | blockTarget];
+            #pragma omp simd
+            for (int l = 0; l < LANES; l++) {
+                const bool active = (l & laneControl) == laneControl;
+                const double xr = x.re[l], xi = x.im[l], yr = y.re[l], yi = y.im[l];
+                const double nxr = g00r * xr - g00i * xi + g01r * yr - g01i * yi;
+                const double nxi = g00r * xi + g00i * xr + g01r * yi + g01i * yr;
+                const double nyr = g10r * xr - g10i * xi + g11r * yr - g11i * yi;
+                const double nyi = g10r * xi + g10i * xr + g11r * yi + g11i * yr;
+                x.re[l] = active ? nxr : xr;
+                x.im[l] = active ? nxi : xi;
+                y.re[l] = active ? nyr : yr;
+                y.im[l] = active ? nyi : yi;
+            }
+        }
+    } else {
+        // Targets among the lowest bits pair up lanes within each block. Every lane is updated from itself and its
+        // partner lane l ⊕ target, with the diagonal and off-diagonal entry of the gate for its row, so a block is
+        // one element-wise operation on a copy of it and the same copy with its lanes permuted.
+        double diagR[LANES], diagI[LANES], offR[LANES], offI[LANES];
+        for (uint64_t l = 0; l < LANES; l++) {
+            const bool high = (l & targetMask) != 0;
+            diagR[l] = high ? g11r : g00r;
+            diagI[l] = high ? g11i : g00i;
+            offR[l] = high ? g10r : g01r;
+            offI[l] = high ? g10i : g01i;
+        }
+        #pragma omp parallel for if(numBlocks > 1024)
+        for (long b = 0; b < numBlocks; b++) {
+            if ((uint64_t(b) & blockControl) != blockControl)
+                continue;
+            AmplitudeBlock& x = this->blocks[b];
+            const AmplitudeBlock y = x;
+            #pragma omp simd
+            for (uint64_t l = 0; l < LANES; l++) {
+                const bool active = (l & laneControl) == laneControl;
+                const uint64_t p = l ^ targetMask;
+                const double nr = diagR[l] * y.re[l] - diagI[l] * y.im[l] + offR[l] * y.re[p] - offI[l] * y.im[p];
+                const double ni = diagR[l] * y.im[l] + diagI[l] * y.re[l] + offR[l] * y.im[p] + offI[l] * y.re[p];
+                x.re[l] = active ? nr : y.re[l];
+                x.im[l] = active ? ni : y.im[l];
+            }
+        }
+    }
+}
+
+void SoaStateSimulator::PairLanes(const PauliMasks& masks, uint64_t& laneFlip, double laneSign[LANES])
+{
+    laneFlip = masks.x % LANES;
+    for (uint64_t l = 0; l < LANES; l++)
+        laneSign[l] = Parity((l ^ laneFlip) & masks.z % LANES) ? -1.0 : 1.0;
+}
+
+void SoaStateSimulator::ApplyPauliSum(std::complex<double> alpha, std::complex<double> beta, const PauliMasks& masks,
+                                      uint64_t controlMask)
+{
+    // ψ'(b) = α ψ(b) + β phase (-1)^|(b⊕x)∧z| ψ(b⊕x). With b split into its block B and lane l, the partner of
+    // block B is the whole block B ⊕ x_B, read with the lanes permuted to l ⊕ x_l, and the sign splits into a
+    // factor of the partner block and one of the lane, which is the same for all blocks.
+    const double ar = alpha.real(), ai = alpha.imag();
+    const std::complex<double> c = beta * masks.phase;
+    const uint64_t blockFlip = masks.x / LANES, blockZ = masks.z / LANES;
+    const uint64_t laneControl = controlMask % LANES, blockControl = controlMask / LANES;
+    uint64_t laneFlip;
+    double laneSign[LANES];
+    PairLanes(masks, laneFlip, laneSign);
+
+    // Updates block x from itself and its partner block y, whose block sign is given.
+    auto update = [&](AmplitudeBlock& x, const AmplitudeBlock& self, const AmplitudeBlock& y, double blockSign) {
+        const double cr = blockSign * c.real(), ci = blockSign * c.imag();
+        #pragma omp simd
+        for (uint64_t l = 0; l < LANES; l++) {
+            const bool active = (l & laneControl) == laneControl;
+            const uint64_t p = l ^ laneFlip;
+            const double yr = laneSign[l] * y.re[p], yi = laneSign[l] * y.im[p];
+            const double nr = ar * self.re[l] - ai * self.im[l] + cr * yr - ci * yi;
+            const double ni = ar * self.im[l] + ai * self.re[l] + cr * yi + ci * yr;
+            x.re[l] = active ? nr : self.re[l];
+            x.im[l] = active ? ni : self.im[l];
+        }
+    };
+
+    const long numBlocks = static_cast<long>(this->blocks.size());
+    if (blockFlip == 0) {
+        #pragma omp parallel for if(numBlocks > 512)
+        for (long b = 0; b < numBlocks; b++) {
+            if ((uint64_t(b) & blockControl) != blockControl)
+                continue;
+            const AmplitudeBlock self = this->blocks[b];
+            update(this->blocks[b], self, self, Parity(b & blockZ) ? -1.0 : 1.0);
+        }
+        return;
+    }
+
+    const uint64_t lowBit = blockFlip & (~blockFlip + 1);
+    #pragma omp parallel for if(numBlocks > 512)
+    for (long k = 0; k < numBlocks / 2; k++) {
+        uint64_t low = k & (lowBit - 1), b0 = ((k ^ low) << 1) | low, b1 = b0 ^ blockFlip;
+        if ((b0 & blockControl) != blockControl)
+            continue;
+        const AmplitudeBlock x0 = this->blocks[b0], x1 = this->blocks[b1];
+        update(this->blocks[b0], x0, x1, Parity(b1 & blockZ) ? -1.0 : 1.0);
+        update(this->blocks[b1], x1, x0, Parity(b0 & blockZ) ? -1.0 : 1.0);
+    }
+}
+
+double SoaStateSimulator::PauliExpectation(const PauliMasks& masks) const
+{
+    // 〈Ψ|P|Ψ⟩ = phase Σ_b (-1)^|b∧z| conj(ψ(b⊕x)) ψ(b), summed block by block with the partner block read with
+    // permuted lanes as in `ApplyPauliSum`. The sign of b is that of its partner with respect to x.
+    const uint64_t blockFlip = masks.x / LANES, blockZ = masks.z / LANES;
+    uint64_t laneFlip;
+    double laneSign[LANES];
+    PairLanes(masks, laneFlip, laneSign);
+    std::complex<double> overlap = DeterministicComplexSum(this->blocks.size(), [&](long b) {
+        const AmplitudeBlock& x = this->blocks[b];
+        const AmplitudeBlock& y = this->blocks[b ^ blockFlip];
+        double re = 0.0, im = 0.0;
+        #pragma omp simd reduction(+:re, im)
+        for (uint64_t l = 0; l < LANES; l++) {
+            const uint64_t p = l ^ laneFlip;
+            const double sign = laneSign[p];
+            re += sign * (y.re[p] * x.re[l] + y.im[p] * x.im[l]);
+            im += sign * (y.re[p] * x.im[l] - y.im[p] * x.re[l]);
+        }
+        return Parity(b & blockZ) ? std::complex<double>(-re, -im) : std::complex<double>(re, im);
+    });
+    return std::real(masks.phase * overlap);
+}
+
+PauliMasks SoaStateSimulator::GetPauliMasks(long numTargets, const PauliId paulis[], const Qubit targets[]) const
+{
+    PauliMasks masks;
+    for (long i = 0; i < numTargets; i++) {
+        uint64_t mask = GetQubitMask(targets[i]);
+        if (paulis[i] == PauliId_X || paulis[i] == PauliId_Y)
+            masks.x |= mask;
+        if (paulis[i] == PauliId_Z || paulis[i] == PauliId_Y)
+            masks.z |= mask;
+        if (paulis[i] == PauliId_Y)
+            masks.phase *= 1i;
+    }
+    return masks;
+}
+
+uint64_t SoaStateSimulator::GetStorageIndex(uint64_t idx) const
+{
+    const size_t numQubits = this->computeRegister.size();
+    uint64_t storageIdx = 0;
+    for (size_t i = 0; i < numQubits; i++) {
+        if (idx & (uint64_t(1) << (numQubits - 1 - i)))
+            storageIdx |= uint64_t(1) << this->bits[i];
+    }
+    return storageIdx;
+}
+
+
+///
+/// Qubit management
+///
+
+Qubit SoaStateSimulator::AllocateQubit()
+{
+    // Reuse the bit of a released qubit (already reset to |0⟩), or add a bit on top, which doubles the state with
+    // zero amplitudes.
+    short bit;
+    if (!this->freeBits.empty()) {
+        bit = this->freeBits.back();
+        this->freeBits.pop_back();
+    } else {
+        bit = this->numBits++;
+        uint64_t numBlocks = std::max<uint64_t>(1, (uint64_t(1) << this->numBits) / LANES);
+        this->blocks.resize(numBlocks, AmplitudeBlock{});
+    }
+
+    Qubit q = this->qbm->Allocate();
+    this->computeRegister.push_back(q);
+    this->bits.push_back(bit);
+    return q;
+}
+
+void SoaStateSimulator::ReleaseQubit(Qubit q)
+{
+    // Reset the qubit to |0⟩ so that its bit can be handed out again. The released qubit is in a product state, so
+    // both halves of the state are proportional to the remaining state. As in the StateSimulator, the half with
+    // the larger norm is moved into the |0⟩ half, which draws nothing from the PRNG.
+    PauliMasks z;
+    z.z = GetQubitMask(q);
+    const double norm0 = (1 + PauliExpectation(z)) / 2, norm1 = 1 - norm0;
+    Eigen::Matrix2cd reset = Eigen::Matrix2cd::Zero();
+    if (norm1 > norm0)
+        reset(0,1) = 1 / sqrt(norm1);
+    else
+        reset(0,0) = 1 / sqrt(norm0);
+    ApplyGate(reset, z.z);
+
+    short idx = GetQubitIdx(q);
+    this->freeBits.push_back(this->bits[idx]);
+    this->computeRegister.erase(this->computeRegister.begin() + idx);
+    this->bits.erase(this->bits.begin() + idx);
+    this->qbm->Release(q);
+
+    // Drop unused bits from the top, their upper halves of the state are all zero.
+    for (auto it = std::find(this->freeBits.begin(), this->freeBits.end(), this->numBits - 1);
+         it != this->freeBits.end();
+         it = std::find(this->freeBits.begin(), this->freeBits.end(), this->numBits - 1)) {
+        this->freeBits.erase(it);
+        this->numBits--;
+    }
+    this->blocks.resize(std::max<uint64_t>(1, (uint64_t(1) << this->numBits) / LANES));
+}
+
+std::string SoaStateSimulator::QubitToString(Qubit q)
+{
+    return std::to_string(this->qbm->GetQubitId(q));
+}
+
+
+///
+/// Result management
+///
+
+static Result zero = reinterpret_cast<Result>(0);
+static Result one = reinterpret_cast<Result>(1);
+
+void SoaStateSimulator::ReleaseResult(Result r) {}
+
+bool SoaStateSimulator::AreEqualResults(Result r1, Result r2)
+{
+    return (r1 == r2);
+}
+
+ResultValue SoaStateSimulator::GetResultValue(Result r)
+{
+    return (r == one) ? Result_One : Result_Zero;
+}
+
+Result SoaStateSimulator::UseZero()
+{
+    return zero;
+}
+
+Result SoaStateSimulator::UseOne()
+{
+    return one;
+}
+
+
+///
+/// Supported quantum operations
+///
+
+static Eigen::Matrix2cd SelectPauliOp(PauliId axis)
+{
+    switch (axis) {
+        case PauliId_X:
+            return (Eigen::Matrix2cd() << 0,1,1,0).finished();
+        case PauliId_Y:
+            return (Eigen::Matrix2cd() << 0,-1i,1i,0).finished();
+        case PauliId_Z:
+            return (Eigen::Matrix2cd() << 1,0,0,-1).finished();
+        default:
+            return Eigen::Matrix2cd::Identity();
+    }
+}
+
+void SoaStateSimulator::X(Qubit q)
+{
+    ApplyGate(SelectPauliOp(PauliId_X), GetQubitMask(q));
+}
+
+void SoaStateSimulator::ControlledX(long numControls, Qubit controls[], Qubit target)
+{
+    ApplyGate(SelectPauliOp(PauliId_X), GetQubitMask(target), GetControlMask(numControls, controls));
+}
+
+void SoaStateSimulator::Y(Qubit q)
+{
+    ApplyGate(SelectPauliOp(PauliId_Y), GetQubitMask(q));
+}
+
+void SoaStateSimulator::ControlledY(long numControls, Qubit controls[], Qubit target)
+{
+    ApplyGate(SelectPauliOp(PauliId_Y), GetQubitMask(target), GetControlMask(numControls, controls));
+}
+
+void SoaStateSimulator::Z(Qubit q)
+{
+    ApplyGate(SelectPauliOp(PauliId_Z), GetQubitMask(q));
+}
+
+void SoaStateSimulator::ControlledZ(long numControls, Qubit controls[], Qubit target)
+{
+    ApplyGate(SelectPauliOp(PauliId_Z), GetQubitMask(target), GetControlMask(numControls, controls));
+}
+
+void SoaStateSimulator::H(Qubit q)
+{
+    Eigen::Matrix2cd h; h << 1, 1,
+                             1,-1;
+    h = h / sqrt(2);
+    ApplyGate(h, GetQubitMask(q));
+}
+
+void SoaStateSimulator::ControlledH(long numControls, Qubit controls[], Qubit target)
+{
+    Eigen::Matrix2cd h; h << 1, 1,
+                             1,-1;
+    h = h / sqrt(2);
+    ApplyGate(h, GetQubitMask(target), GetControlMask(numControls, controls));
+}
+
+void SoaStateSimulator::S(Qubit q)
+{
+    Eigen::Matrix2cd s; s << 1,  0,
+                             0, 1i;
+    ApplyGate(s, GetQubitMask(q));
+}
+
+void SoaStateSimulator::ControlledS(long numControls, Qubit controls[], Qubit target)
+{
+    Eigen::Matrix2cd s; s << 1,  0,
+                             0, 1i;
+    ApplyGate(s, GetQubitMask(target), GetControlMask(numControls, controls));
+}
+
+void SoaStateSimulator::AdjointS(Qubit q)
+{
+    Eigen::Matrix2cd sdag; sdag << 1,  0,
+                                   0,-1i;
+    ApplyGate(sdag, GetQubitMask(q));
+}
+
+void SoaStateSimulator::ControlledAdjointS(long numControls, Qubit controls[], Qubit target)
+{
+    Eigen::Matrix2cd sdag; sdag << 1,  0,
+                                   0,-1i;
+    ApplyGate(sdag, GetQubitMask(target), GetControlMask(numControls, controls));
+}
+
+void SoaStateSimulator::T(Qubit q)
+{
+    Eigen::Matrix2cd t; t << 1, 0,
+                             0, exp(1i*PI/4.);
+    ApplyGate(t, GetQubitMask(q));
+}
+
+void SoaStateSimulator::ControlledT(long numControls, Qubit controls[], Qubit target)
+{
+    Eigen::Matrix2cd t; t << 1, 0,
+                             0, exp(1i*PI/4.);
+    ApplyGate(t, GetQubitMask(target), GetControlMask(numControls, controls));
+}
+
+void SoaStateSimulator::AdjointT(Qubit q)
+{
+    Eigen::Matrix2cd tdag; tdag << 1, 0,
+                                   0, exp(-1i*PI/4.);
+    ApplyGate(tdag, GetQubitMask(q));
+}
+
+void SoaStateSimulator::ControlledAdjointT(long numControls, Qubit controls[], Qubit target)
+{
+    Eigen::Matrix2cd tdag; tdag << 1, 0,
+                                   0, exp(-1i*PI/4.);
+    ApplyGate(tdag, GetQubitMask(target), GetControlMask(numControls, controls));
+}
+
+void SoaStateSimulator::R(PauliId axis, Qubit q, double theta)
+{
+    // R_P(θ) = exp(-iθ/2 P) = cos(θ/2) - i sin(θ/2) P
+    ControlledR(0, nullptr, axis, q, theta);
+}
+
+void SoaStateSimulator::ControlledR(long numControls, Qubit controls[], PauliId axis, Qubit target, double theta)
+{
+    Eigen::Matrix2cd r = cos(theta / 2) * Eigen::Matrix2cd::Identity() - 1i * sin(theta / 2) * SelectPauliOp(axis);
+    ApplyGate(r, GetQubitMask(target), GetControlMask(numControls, controls));
+}
+
+void SoaStateSimulator::Exp(long numTargets, PauliId paulis[], Qubit targets[], double theta)
+{
+    ControlledExp(0, nullptr, numTargets, paulis, targets, theta);
+}
+
+void SoaStateSimulator::ControlledExp(long numControls, Qubit controls[], long numTargets, PauliId paulis[], Qubit targets[], double theta)
+{
+    // exp(iθP)|Ψ⟩ = cos(θ)|Ψ⟩ + i sin(θ) P|Ψ⟩
+    ApplyPauliSum(cos(theta), 1i*sin(theta), GetPauliMasks(numTargets, paulis, targets),
+                  GetControlMask(numControls, controls));
+}
+
+Result SoaStateSimulator::Measure(long numBases, PauliId bases[], long numTargets, Qubit targets[])
+{
+    assert(numBases == numTargets);
+
+    // Probability of getting outcome Zero is p(+) = 〈Ψ|P_+|Ψ⟩ = (1 + 〈Ψ|P|Ψ⟩)/2.
+    PauliMasks masks = GetPauliMasks(numTargets, bases, targets);
+    double probZero = std::min(1.0, std::max(0.0, (1 + PauliExpectation(masks)) / 2));
+
+    // Select measurement outcome via PRNG.
+    double random0to1 = this->rng.NextDouble();
+    Result outcome = random0to1 < probZero ? UseZero() : UseOne();
+
+    // Update state vector with |Ψ'⟩ = 1/√p(m) P_m|Ψ⟩, where P_+- = (1 +- P)/2.
+    double prob = (outcome == UseZero()) ? probZero : 1 - probZero;
+    double scale = 1 / (2 * sqrt(prob));
+    ApplyPauliSum(scale, (outcome == UseZero()) ? scale : -scale, masks);
+
+    return outcome;
+}
+
+
+///
+/// Implementation of IDiagnostics
+///
+
+bool SoaStateSimulator::Assert(long numTargets, PauliId* bases, Qubit* targets, Result result, const char* failureMessage)
+{
+    double expectation = PauliExpectation(GetPauliMasks(numTargets, bases, targets));
+    double expected = (result == UseZero()) ? 1.0 : -1.0;
+    return std::abs(expectation - expected) < 2 * TOLERANCE;
+}
+
+bool SoaStateSimulator::AssertProbability(long numTargets, PauliId bases[], Qubit targets[], double probabilityOfZero, double precision, const char* failureMessage)
+{
+    double probZero = (1 + PauliExpectation(GetPauliMasks(numTargets, bases, targets))) / 2;
+    return std::abs(probZero - probabilityOfZero) <= precision;
+}
+
+void SoaStateSimulator::GetState(TGetStateCallback callback)
+{
+    // Basis indices follow the order of allocation, the first allocated qubit being the most significant bit.
+    uint64_t size = uint64_t(1) << this->computeRegister.size();
+    for (uint64_t idx = 0; idx < size; idx++) {
+        std::complex<double> a = GetAmplitude(GetStorageIndex(idx));
+        if (!callback(idx, a.real(), a.imag()))
+            break;
+    }
+}
+
+void SoaStateSimulator::DumpMachine(const void* location)
+{
+    std::vector<int64_t> qubitIds;
+    for (Qubit q : this->computeRegister)
+        qubitIds.push_back(this->qbm->GetQubitId(q));
+
+    std::ofstream file;
+    std::ostream& out = GetOutStream(location, file, false);
+    WriteDump(out, false, qubitIds, [this](uint64_t idx) { return GetAmplitude(GetStorageIndex(idx)); },
+              uint64_t(1) << this->computeRegister.size(), this->dumpCutoff, 0);
+}
+
+void SoaStateSimulator::DumpRegister(const void* location, const QirArray* qubits)
+{
+    long numQubits = qubits->count;
+    Qubit* registerQubits = reinterpret_cast<Qubit*>(qubits->buffer);
+    std::vector<uint64_t> registerBits(numQubits);
+    std::vector<int64_t> qubitIds(numQubits);
+    for (long j = 0; j < numQubits; j++) {
+        registerBits[j] = GetQubitMask(registerQubits[j]);
+        qubitIds[j] = this->qbm->GetQubitId(registerQubits[j]);
+    }
+
+    std::ofstream file;
+    std::ostream& out = GetOutStream(location, file, false);
+    WriteRegisterDump(out, false, qubitIds, registerBits, [this](uint64_t idx) { return GetAmplitude(idx); },
+                      this->blocks.size() * LANES, this->dumpCutoff, 0);
+}
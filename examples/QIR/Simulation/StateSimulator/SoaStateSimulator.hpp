@@ -0,0 +1,215 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <algorithm>
+#include <complex>
+#include <vector>
+
+#include "QirRuntimeApi_I.hpp"
+#include "QSharpSimApi_I.hpp"
+
+#include "QubitManager.hpp"
+#include "RandomGenerator.hpp"
+#include "StateKernels.hpp"
+
+#include "Eigen/Dense"
+
+namespace Microsoft
+{
+namespace Quantum
+{
+    // Amplitudes of LANES consecutive basis states, stored as separate arrays of real and imaginary parts. With one
+    // block per SIMD register (8 doubles for AVX-512), a complex multiply-add on a block needs no shuffles.
+    constexpr int LANES = 8;
+    struct alignas(64) AmplitudeBlock
+    {
+        double re[LANES];
+        double im[LANES];
+    };
+
+    // State simulator with the same semantics as `StateSimulator`, but keeping the state vector in a split
+    // real/imaginary (structure of arrays) layout, blocked to the vector width. Gates on qubits above the lowest
+    // log2(LANES) bits pair up whole blocks lane by lane, which vectorizes without any data rearrangement, and gates
+    // on the lowest bits, as well as Pauli products, pair each block with a block of lanes in a fixed permutation.
+    // Amplitudes are converted to complex numbers only where they leave the simulator, in `GetState` and the dumps.
+    //
+    // As in the sparse backend, each qubit occupies a fixed bit of the basis index, so allocating a qubit only
+    // appends zero blocks. Released qubits are reset to |0⟩, and the state shrinks while the top bit is unused.
+    class SoaStateSimulator : public IRuntimeDriver, public IQuantumGateSet, public IDiagnostics
+    {
+        // Associated qubit manager instance to handle qubit representation.
+        CQubitManager *qbm;
+
+        // The register of currently active qubits, in order of allocation, and the bit each of them occupies.
+        std::vector<Qubit> computeRegister;
+        std::vector<short> bits;
+
+        // Bits of released qubits below the highest bit in use, reset to |0⟩ and available for reuse.
+        std::vector<short> freeBits;
+        short numBits = 0;
+
+        // The 2^numBits amplitudes, padded to at least one block. Unused lanes and bits hold zero amplitudes.
+        std::vector<AmplitudeBlock> blocks = std::vector<AmplitudeBlock>(1, AmplitudeBlock{{1.0}, {0.0}});
+
+        // Per-simulator PRNG used to sample measurement outcomes.
+        RandomGenerator rng;
+
+        // Output settings of `DumpMachine` and `DumpRegister`.
+        double dumpCutoff = 0.0;
+
+        std::complex<double> GetAmplitude(uint64_t idx) const
+        {
+            const AmplitudeBlock& block = this->blocks[idx / LANES];
+            return {block.re[idx % LANES], block.im[idx % LANES]};
+        }
+        void SetAmplitude(uint64_t idx, std::complex<double> value)
+        {
+            AmplitudeBlock& block = this->blocks[idx / LANES];
+            block.re[idx % LANES] = value.real();
+            block.im[idx % LANES] = value.imag();
+        }
+
+        // Index into the amplitudes of the basis state `idx` over the active qubits in allocation order, the first
+        // allocated qubit being the most significant bit.
+        uint64_t GetStorageIndex(uint64_t idx) const;
+
+        // To be called by quantum gate set operations.
+        void ApplyGate(const Eigen::Matrix2cd& gate, uint64_t targetMask, uint64_t controlMask = 0);
+
+        // Lane part of the x mask of a Pauli product, and the sign (-1)^|(l⊕x)∧z| of the lane part for each lane l.
+        static void PairLanes(const PauliMasks& masks, uint64_t& laneFlip, double laneSign[LANES]);
+
+        // |Ψ'⟩ = (α + βP)|Ψ⟩ on the subspace selected by `controlMask`, see `ApplyPauliSumKernel`.
+        void ApplyPauliSum(std::complex<double> alpha, std::complex<double> beta, const PauliMasks& masks,
+                           uint64_t controlMask = 0);
+
+        // 〈Ψ|P|Ψ⟩ of a Pauli product.
+        double PauliExpectation(const PauliMasks& masks) const;
+
+        PauliMasks GetPauliMasks(long numTargets, const PauliId paulis[], const Qubit targets[]) const;
+
+        short GetQubitIdx(Qubit q) const
+        {
+            return std::distance(
+                this->computeRegister.begin(),
+                std::find(this->computeRegister.begin(), this->computeRegister.end(), q)
+            );
+        }
+
+        uint64_t GetQubitMask(Qubit q) const
+        {
+            return uint64_t(1) << this->bits[GetQubitIdx(q)];
+        }
+
+        uint64_t GetControlMask(long numControls, const Qubit controls[]) const
+        {
+            uint64_t mask = 0;
+            for (long i = 0; i < numControls; i++)
+                mask |= GetQubitMask(controls[i]);
+            return mask;
+        }
+
+      public:
+        SoaStateSimulator(uint32_t userProvidedSeed = 0, uint64_t streamId = 0)
+            : rng(userProvidedSeed, streamId)
+        {
+            this->qbm = new CQubitManager();
+        }
+        ~SoaStateSimulator()
+        {
+            delete this->qbm;
+        }
+
+        // Only basis states with an amplitude magnitude above the cutoff are listed by the dumps.
+        void SetDumpCutoff(double cutoff)
+        {
+            this->dumpCutoff = cutoff;
+        }
+
+
+        ///
+        /// Implementation of IRuntimeDriver
+        ///
+        void ReleaseResult(Result r) override;
+
+        bool AreEqualResults(Result r1, Result r2) override;
+
+        ResultValue GetResultValue(Result r) override;
+
+        Result UseZero() override;
+
+        Result UseOne() override;
+
+        Qubit AllocateQubit() override;
+
+        void ReleaseQubit(Qubit q) override;
+
+        std::string QubitToString(Qubit q) override;
+
+
+        ///
+        /// Implementation of IQuantumGateSet
+        ///
+        void X(Qubit q) override;
+
+        void ControlledX(long numControls, Qubit controls[], Qubit target) override;
+
+        void Y(Qubit q) override;
+
+        void ControlledY(long numControls, Qubit controls[], Qubit target) override;
+
+        void Z(Qubit q) override;
+
+        void ControlledZ(long numControls, Qubit controls[], Qubit target) override;
+
+        void H(Qubit q) override;
+
+        void ControlledH(long numControls, Qubit controls[], Qubit target) override;
+
+        void S(Qubit q) override;
+
+        void ControlledS(long numControls, Qubit controls[], Qubit target) override;
+
+        void AdjointS(Qubit q) override;
+
+        void ControlledAdjointS(long numControls, Qubit controls[], Qubit target) override;
+
+        void T(Qubit q) override;
+
+        void ControlledT(long numControls, Qubit controls[], Qubit target) override;
+
+        void AdjointT(Qubit q) override;
+
+        void ControlledAdjointT(long numControls, Qubit controls[], Qubit target) override;
+
+        void R(PauliId axis, Qubit target, double theta) override;
+
+        void ControlledR(long numControls, Qubit controls[], PauliId axis, Qubit target, double theta) override;
+
+        void Exp(long numTargets, PauliId paulis[], Qubit targets[], double theta) override;
+
+        void ControlledExp(long numControls, Qubit controls[], long numTargets, PauliId paulis[], Qubit targets[], double theta) override;
+
+        Result Measure(long numBases, PauliId bases[], long numTargets, Qubit targets[]) override;
+
+
+        ///
+        /// Implementation of IDiagnostics
+        ///
+        bool Assert(long numTargets, PauliId* bases, Qubit* targets, Result result, const char* failureMessage) override;
+
+        bool AssertProbability(long numTargets, PauliId bases[], Qubit targets[], double probabilityOfZero, double precision, const char* failureMessage) override;
+
+        // Deprecated, use `DumpMachine()` and `DumpRegister()` instead.
+        void GetState(TGetStateCallback callback) override;
+
+        void DumpMachine(const void* location) override;
+
+        void DumpRegister(const void* location, const QirArray* qubits) override;
+
+    }; // class SoaStateSimulator
+
+} // namespace Quantum
+} // namespace Microsoft
@@ -0,0 +1,436 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include <cmath>
+#include <complex>
+#include <stdexcept>
+#include <string>
+
+#include "SparseStateSimulator.hpp"
+#include "StateKernels.hpp"
+
+using namespace Microsoft::Quantum;
+using namespace std::complex_literals;
+
+# define PI 3.14159265358979323846
+# define MAX_SPARSE_QUBITS 64
+
+
+///
+/// State manipulation
+///
+
+void SparseStateSimulator::Prune()
+{
+    for (auto it = this->amplitudes.begin(); it != this->amplitudes.end();) {
+        if (std::norm(it->second) < this->pruneThreshold)
+            it = this->amplitudes.erase(it);
+        else
+            ++it;
+    }
+}
+
+void SparseStateSimulator::CheckMemoryBudget(size_t numAmplitudes) const
+{
+    if (this->memoryBudget == 0 || StateBytes(numAmplitudes) <= this->memoryBudget)
+        return;
+    throw std::runtime_error("The sparse state of " + std::to_string(this->computeRegister.size()) + " qubits with " +
+                             std::to_string(numAmplitudes) + " amplitudes needs " + std::to_string(StateBytes(numAmplitudes)) +
+                             " bytes, exceeding the memory budget of " + std::to_string(this->memoryBudget) + " bytes.");
+}
+
+void SparseStateSimulator::SetState(long numQubits, Qubit qubits[], const SparseState& state)
+{
+    if (numQubits != static_cast<long>(this->computeRegister.size()))
+        throw std::runtime_error("State does not match the compute register.");
+
+    CheckMemoryBudget(state.size());
+
+    std::vector<uint64_t> masks(numQubits);
+    for (long i = 0; i < numQubits; i++)
+        masks[i] = GetQubitMask(qubits[i]);
+    this->amplitudes.clear();
+    this->amplitudes.reserve(state.size());
+    for (const auto& entry : state) {
+        uint64_t idx = 0;
+        for (long i = 0; i < numQubits; i++) {
+            if (entry.first & (uint64_t(1) << (numQubits - 1 - i)))
+                idx |= masks[i];
+        }
+        this->amplitudes[idx] = entry.second;
+    }
+    Prune();
+}
+
+void SparseStateSimulator::ApplyGate(const Eigen::Matrix2cd& gate, Qubit target)
+{
+    ApplyControlledGate(gate, 0, nullptr, target);
+}
+
+void SparseStateSimulator::ApplyControlledGate(const Eigen::Matrix2cd& gate, long numControls, Qubit controls[], Qubit target)
+{
+    uint64_t controlMask = GetControlMask(numControls, controls);
+    uint64_t targetMask = GetQubitMask(target);
+
+    if (gate(0, 1) == 0.0 && gate(1, 0) == 0.0) {
+        // Diagonal gates only rescale the stored amplitudes in place.
+        for (auto& entry : this->amplitudes) {
+            if ((entry.first & controlMask) == controlMask)
+                entry.second *= (entry.first & targetMask) ? gate(1, 1) : gate(0, 0);
+        }
+    } else {
+        // Each stored amplitude of |..b..⟩ contributes G_0b to |..0..⟩ and G_1b to |..1..⟩.
+        SparseState updated;
+        updated.reserve(2 * this->amplitudes.size());
+        for (const auto& entry : this->amplitudes) {
+            if ((entry.first & controlMask) != controlMask) {
+                updated[entry.first] += entry.second;
+                continue;
+            }
+            int b = (entry.first & targetMask) ? 1 : 0;
+            uint64_t idx0 = entry.first & ~targetMask;
+            if (gate(0, b) != 0.0)
+                updated[idx0] += gate(0, b) * entry.second;
+            if (gate(1, b) != 0.0)
+                updated[idx0 | targetMask] += gate(1, b) * entry.second;
+            // The old amplitudes stay until the new ones are complete, so both count towards the budget.
+            CheckMemoryBudget(this->amplitudes.size() + updated.size());
+        }
+        this->amplitudes.swap(updated);
+    }
+
+    Prune();
+}
+
+static PauliMasks BuildPauliMasks(long numTargets, PauliId paulis[], const std::vector<uint64_t>& targetMasks)
+{
+    PauliMasks masks;
+    int numY = 0;
+    for (long i = 0; i < numTargets; i++) {
+        if (paulis[i] == PauliId_X || paulis[i] == PauliId_Y)
+            masks.x |= targetMasks[i];
+        if (paulis[i] == PauliId_Z || paulis[i] == PauliId_Y)
+            masks.z |= targetMasks[i];
+        numY += paulis[i] == PauliId_Y;
+    }
+    masks.phase = std::pow(1i, numY % 4);
+    return masks;
+}
+
+void SparseStateSimulator::ApplyPauliExp(uint64_t controlMask, long numTargets, PauliId paulis[], Qubit targets[], double theta)
+{
+    // exp(iθP)|Ψ⟩ = cos(θ)|Ψ⟩ + i sin(θ) P|Ψ⟩
+    std::vector<uint64_t> targetMasks(numTargets);
+    for (long i = 0; i < numTargets; i++)
+        targetMasks[i] = GetQubitMask(targets[i]);
+    PauliMasks masks = BuildPauliMasks(numTargets, paulis, targetMasks);
+    Amplitude c = std::cos(theta), s = 1i * std::sin(theta) * masks.phase;
+
+    if (masks.x == 0) {
+        // Products of Z only are diagonal and rescale the stored amplitudes in place.
+        for (auto& entry : this->amplitudes) {
+            if ((entry.first & controlMask) == controlMask)
+                entry.second *= c + (Parity(entry.first & masks.z) ? -s : s);
+        }
+    } else {
+        SparseState updated;
+        updated.reserve(2 * this->amplitudes.size());
+        for (const auto& entry : this->amplitudes) {
+            if ((entry.first & controlMask) != controlMask) {
+                updated[entry.first] += entry.second;
+                continue;
+            }
+            updated[entry.first] += c * entry.second;
+            updated[entry.first ^ masks.x] += (Parity(entry.first & masks.z) ? -s : s) * entry.second;
+            CheckMemoryBudget(this->amplitudes.size() + updated.size());
+        }
+        this->amplitudes.swap(updated);
+    }
+
+    Prune();
+}
+
+SparseState SparseStateSimulator::ApplyPauli(long numTargets, PauliId paulis[], Qubit targets[]) const
+{
+    std::vector<uint64_t> targetMasks(numTargets);
+    for (long i = 0; i < numTargets; i++)
+        targetMasks[i] = GetQubitMask(targets[i]);
+    PauliMasks masks = BuildPauliMasks(numTargets, paulis, targetMasks);
+
+    SparseState result;
+    result.reserve(this->amplitudes.size());
+    for (const auto& entry : this->amplitudes)
+        result[entry.first ^ masks.x] = (Parity(entry.first & masks.z) ? -masks.phase : masks.phase) * entry.second;
+    return result;
+}
+
+
+///
+/// Qubit management
+///
+
+Qubit SparseStateSimulator::AllocateQubit()
+{
+    // Reuse the bit of a released qubit (already reset to |0⟩), or extend the basis index by one bit.
+    short bit;
+    if (!this->freeBits.empty()) {
+        bit = this->freeBits.back();
+        this->freeBits.pop_back();
+    } else {
+        if (this->numBits == MAX_SPARSE_QUBITS)
+            throw std::runtime_error("The sparse state simulator supports at most 64 active qubits.");
+        bit = this->numBits++;
+    }
+
+    Qubit q = this->qbm->Allocate();
+    this->computeRegister.push_back(q);
+    this->bits.push_back(bit);
+    return q;
+}
+
+void SparseStateSimulator::ReleaseQubit(Qubit q)
+{
+    // Reset the qubit to |0⟩ so that its bit can be handed out again. As in the StateSimulator, the half of the
+    // state with the larger norm is kept and renormalized, which draws nothing from the PRNG.
+    const uint64_t mask = GetQubitMask(q);
+    double norm0 = 0.0, norm1 = 0.0;
+    for (const auto& entry : this->amplitudes)
+        ((entry.first & mask) ? norm1 : norm0) += std::norm(entry.second);
+    const bool keepOne = norm1 > norm0;
+    const double scale = 1 / std::sqrt(keepOne ? norm1 : norm0);
+    if (keepOne) {
+        SparseState updated;
+        updated.reserve(this->amplitudes.size());
+        for (const auto& entry : this->amplitudes)
+            if (entry.first & mask)
+                updated.emplace(entry.first & ~mask, scale * entry.second);
+        this->amplitudes.swap(updated);
+    } else {
+        for (auto it = this->amplitudes.begin(); it != this->amplitudes.end();) {
+            if (it->first & mask) {
+                it = this->amplitudes.erase(it);
+            } else {
+                it->second *= scale;
+                ++it;
+            }
+        }
+    }
+
+    short idx = GetQubitIdx(q);
+    this->freeBits.push_back(this->bits[idx]);
+    this->computeRegister.erase(this->computeRegister.begin() + idx);
+    this->bits.erase(this->bits.begin() + idx);
+    this->qbm->Release(q);
+}
+
+std::string SparseStateSimulator::QubitToString(Qubit q)
+{
+    return std::to_string(this->qbm->GetQubitId(q));
+}
+
+
+///
+/// Result management
+///
+
+static Result zero = reinterpret_cast<Result>(0);
+static Result one = reinterpret_cast<Result>(1);
+
+void SparseStateSimulator::ReleaseResult(Result r) {}
+
+bool SparseStateSimulator::AreEqualResults(Result r1, Result r2)
+{
+    return (r1 == r2);
+}
+
+ResultValue SparseStateSimulator::GetResultValue(Result r)
+{
+    return (r == one) ? Result_One : Result_Zero;
+}
+
+Result SparseStateSimulator::UseZero()
+{
+    return zero;
+}
+
+Result SparseStateSimulator::UseOne()
+{
+    return one;
+}
+
+
+///
+/// Supported quantum operations
+///
+
+static Eigen::Matrix2cd SelectPauliOp(PauliId axis)
+{
+    switch (axis) {
+        case PauliId_X:
+            return (Eigen::Matrix2cd() << 0,1,1,0).finished();
+        case PauliId_Y:
+            return (Eigen::Matrix2cd() << 0,-1i,1i,0).finished();
+        case PauliId_Z:
+            return (Eigen::Matrix2cd() << 1,0,0,-1).finished();
+        default:
+            return Eigen::Matrix2cd::Identity();
+    }
+}
+
+void SparseStateSimulator::X(Qubit q)
+{
+    ApplyGate(SelectPauliOp(PauliId_X), q);
+}
+
+void SparseStateSimulator::ControlledX(long numControls, Qubit controls[], Qubit target)
+{
+    ApplyControlledGate(SelectPauliOp(PauliId_X), numControls, controls, target);
+}
+
+void SparseStateSimulator::Y(Qubit q)
+{
+    ApplyGate(SelectPauliOp(PauliId_Y), q);
+}
+
+void SparseStateSimulator::ControlledY(long numControls, Qubit controls[], Qubit target)
+{
+    ApplyControlledGate(SelectPauliOp(PauliId_Y), numControls, controls, target);
+}
+
+void SparseStateSimulator::Z(Qubit q)
+{
+    ApplyGate(SelectPauliOp(PauliId_Z), q);
+}
+
+void SparseStateSimulator::ControlledZ(long numControls, Qubit controls[], Qubit target)
+{
+    ApplyControlledGate(SelectPauliOp(PauliId_Z), numControls, controls, target);
+}
+
+void SparseStateSimulator::H(Qubit q)
+{
+    Eigen::Matrix2cd h; h << 1, 1,
+                             1,-1;
+    h = h / sqrt(2);
+    ApplyGate(h, q);
+}
+
+void SparseStateSimulator::ControlledH(long numControls, Qubit controls[], Qubit target)
+{
+    Eigen::Matrix2cd h; h << 1, 1,
+                             1,-1;
+    h = h / sqrt(2);
+    ApplyControlledGate(h, numControls, controls, target);
+}
+
+void SparseStateSimulator::S(Qubit q)
+{
+    Eigen::Matrix2cd s; s << 1,  0,
+                             0, 1i;
+    ApplyGate(s, q);
+}
+
+void SparseStateSimulator::ControlledS(long numControls, Qubit controls[], Qubit target)
+{
+    Eigen::Matrix2cd s; s << 1,  0,
+                             0, 1i;
+    ApplyControlledGate(s, numControls, controls, target);
+}
+
+void SparseStateSimulator::AdjointS(Qubit q)
+{
+    Eigen::Matrix2cd sdag; sdag << 1,  0,
+                                   0,-1i;
+    ApplyGate(sdag, q);
+}
+
+void SparseStateSimulator::ControlledAdjointS(long numControls, Qubit controls[], Qubit target)
+{
+    Eigen::Matrix2cd sdag; sdag << 1,  0,
+                                   0,-1i;
+    ApplyControlledGate(sdag, numControls, controls, target);
+}
+
+void SparseStateSimulator::T(Qubit q)
+{
+    Eigen::Matrix2cd t; t << 1, 0,
+                             0, exp(1i*PI/4.);
+    ApplyGate(t, q);
+}
+
+void SparseStateSimulator::ControlledT(long numControls, Qubit controls[], Qubit target)
+{
+    Eigen::Matrix2cd t; t << 1, 0,
+                             0, exp(1i*PI/4.);
+    ApplyControlledGate(t, numControls, controls, target);
+}
+
+void SparseStateSimulator::AdjointT(Qubit q)
+{
+    Eigen::Matrix2cd tdag; tdag << 1, 0,
+                                   0, exp(-1i*PI/4.);
+    ApplyGate(tdag, q);
+}
+
+void SparseStateSimulator::ControlledAdjointT(long numControls, Qubit controls[], Qubit target)
+{
+    Eigen::Matrix2cd tdag; tdag << 1, 0,
+                                   0, exp(-1i*PI/4.);
+    ApplyControlledGate(tdag, numControls, controls, target);
+}
+
+void SparseStateSimulator::R(PauliId axis, Qubit q, double theta)
+{
+    // R_P(θ) = exp(-iθ/2 P)
+    ApplyPauliExp(0, 1, &axis, &q, -theta / 2);
+}
+
+void SparseStateSimulator::ControlledR(long numControls, Qubit controls[], PauliId axis, Qubit target, double theta)
+{
+    ApplyPauliExp(GetControlMask(numControls, controls), 1, &axis, &target, -theta / 2);
+}
+
+void SparseStateSimulator::Exp(long numTargets, PauliId paulis[], Qubit targets[], double theta)
+{
+    ApplyPauliExp(0, numTargets, paulis, targets, theta);
+}
+
+void SparseStateSimulator::ControlledExp(long numControls, Qubit controls[], long numTargets, PauliId paulis[], Qubit targets[], double theta)
+{
+    ApplyPauliExp(GetControlMask(numControls, controls), numTargets, paulis, targets, theta);
+}
+
+Result SparseStateSimulator::Measure(long numBases, PauliId bases[], long numTargets, Qubit targets[])
+{
+    assert(numBases == numTargets);
+
+    // Probability of getting outcome Zero is p(+) = 〈Ψ|P_+|Ψ⟩ = (1 + 〈Ψ|P|Ψ⟩)/2.
+    SparseState flipped = ApplyPauli(numTargets, bases, targets);
+    double expectation = 0.0;
+    size_t numAdded = 0;
+    for (const auto& entry : flipped) {
+        auto it = this->amplitudes.find(entry.first);
+        if (it != this->amplitudes.end())
+            expectation += std::real(std::conj(it->second) * entry.second);
+        else
+            numAdded++;
+    }
+    // Flipped amplitudes missing from the state are added to it below, while the flipped state is still held.
+    CheckMemoryBudget(this->amplitudes.size() + numAdded + flipped.size());
+    double probZero = std::min(1.0, std::max(0.0, (1.0 + expectation) / 2));
+
+    // Select measurement outcome via PRNG.
+    double random0to1 = this->rng.NextDouble();
+    Result outcome = random0to1 < probZero ? UseZero() : UseOne();
+
+    // Update state vector with |Ψ'⟩ = 1/√p(m) P_m|Ψ⟩, where P_+- = (1 +- P)/2.
+    double sign = (outcome == UseZero()) ? 1.0 : -1.0;
+    double norm = 2 * sqrt(outcome == UseZero() ? probZero : 1 - probZero);
+    for (auto& entry : this->amplitudes)
+        entry.second /= norm;
+    for (const auto& entry : flipped)
+        this->amplitudes[entry.first] += sign * entry.second / norm;
+
+    Prune();
+    return outcome;
+}
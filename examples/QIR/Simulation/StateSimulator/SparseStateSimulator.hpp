@@ -0,0 +1,213 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <algorithm>
+#include <complex>
+#include <unordered_map>
+#include <vector>
+
+#include "QirRuntimeApi_I.hpp"
+#include "QSharpSimApi_I.hpp"
+
+#include "QubitManager.hpp"
+#include "RandomGenerator.hpp"
+
+#include "Eigen/Dense"
+
+using Amplitude = std::complex<double>;
+using SparseState = std::unordered_map<uint64_t, Amplitude>;
+
+namespace Microsoft
+{
+namespace Quantum
+{
+    // State simulator storing only the non-zero amplitudes of the state as a map from basis index to amplitude.
+    // Reversible arithmetic and oracle circuits often keep a handful of basis states over many qubits, for which
+    // the gate kernels below only visit the stored entries. Up to 64 qubits can be active at once.
+    class SparseStateSimulator : public IRuntimeDriver, public IQuantumGateSet
+    {
+        // Associated qubit manager instance to handle qubit representation.
+        CQubitManager *qbm;
+
+        // The register of currently active qubits and the bit of the basis index holding each of them.
+        std::vector<Qubit> computeRegister;
+        std::vector<short> bits;
+
+        // Bits of released qubits, reset to |0⟩ and available for reuse.
+        std::vector<short> freeBits;
+        short numBits = 0;
+
+        // Non-zero amplitudes of the state, starting out as the basis state |0..0⟩.
+        SparseState amplitudes = {{0, 1.0}};
+
+        // Amplitudes with squared magnitude below the threshold are dropped after each operation.
+        double pruneThreshold;
+
+        // Limit on the bytes of the stored amplitudes, zero for no limit. A stored amplitude takes a hash node of its
+        // basis index, amplitude and next pointer plus the allocation header, and about one bucket pointer, which
+        // BYTES_PER_AMPLITUDE rounds up to cover buckets reserved ahead of time.
+        static constexpr uint64_t BYTES_PER_AMPLITUDE = 64;
+        uint64_t memoryBudget = 0;
+
+        // Per-simulator PRNG used to sample measurement outcomes.
+        RandomGenerator rng;
+
+        // To be called by quantum gate set operations.
+        void ApplyGate(const Eigen::Matrix2cd& gate, Qubit target);
+        void ApplyControlledGate(const Eigen::Matrix2cd& gate, long numControls, Qubit controls[], Qubit target);
+
+        // Applies exp(iθP) for the Pauli product P, restricted to basis states with all controls set.
+        void ApplyPauliExp(uint64_t controlMask, long numTargets, PauliId paulis[], Qubit targets[], double theta);
+
+        // Returns P|Ψ⟩ for the Pauli product P.
+        SparseState ApplyPauli(long numTargets, PauliId paulis[], Qubit targets[]) const;
+
+        void Prune();
+
+        short GetQubitIdx(Qubit q) const
+        {
+            return std::distance(
+                this->computeRegister.begin(),
+                std::find(this->computeRegister.begin(), this->computeRegister.end(), q)
+            );
+        }
+
+        uint64_t GetQubitMask(Qubit q) const
+        {
+            return uint64_t(1) << this->bits[GetQubitIdx(q)];
+        }
+
+        uint64_t GetControlMask(long numControls, Qubit controls[]) const
+        {
+            uint64_t mask = 0;
+            for (long i = 0; i < numControls; i++)
+                mask |= GetQubitMask(controls[i]);
+            return mask;
+        }
+
+      public:
+        SparseStateSimulator(uint32_t userProvidedSeed = 0, uint64_t streamId = 0, double pruneThreshold = 1e-24)
+            : pruneThreshold(pruneThreshold)
+            , rng(userProvidedSeed, streamId)
+        {
+            this->qbm = new CQubitManager();
+        }
+        ~SparseStateSimulator()
+        {
+            delete this->qbm;
+        }
+
+        void SetPruneThreshold(double threshold)
+        {
+            this->pruneThreshold = threshold;
+        }
+
+        // Limit the stored amplitudes to the given number of bytes, zero for no limit. This covers the amplitudes of
+        // the state and those built up by an operation while the old ones are still held. An operation that would
+        // exceed the budget throws a runtime error, as the StateSimulator does, leaving the state as it was.
+        void SetMemoryBudget(uint64_t bytes)
+        {
+            this->memoryBudget = bytes;
+        }
+
+        // Bytes taken by the given number of stored amplitudes.
+        static uint64_t StateBytes(size_t numAmplitudes)
+        {
+            return numAmplitudes * BYTES_PER_AMPLITUDE;
+        }
+
+        // Throws if the given number of amplitudes exceeds the memory budget.
+        void CheckMemoryBudget(size_t numAmplitudes) const;
+
+        // Fetch or restore the PRNG state, e.g. to continue the random sequence of another backend.
+        RandomGenerator::StateType GetRngState() const
+        {
+            return this->rng.GetState();
+        }
+        void SetRngState(const RandomGenerator::StateType& state)
+        {
+            this->rng.SetState(state);
+        }
+
+        // Overwrite the state with the given amplitudes over all active qubits, e.g. when taking over a run from
+        // another backend. Basis indices follow the order of `qubits`, the first being the most significant bit.
+        void SetState(long numQubits, Qubit qubits[], const SparseState& state);
+
+        // Number of stored (non-zero) amplitudes.
+        size_t NumAmplitudes() const
+        {
+            return this->amplitudes.size();
+        }
+
+
+        ///
+        /// Implementation of IRuntimeDriver
+        ///
+        void ReleaseResult(Result r) override;
+
+        bool AreEqualResults(Result r1, Result r2) override;
+
+        ResultValue GetResultValue(Result r) override;
+
+        Result UseZero() override;
+
+        Result UseOne() override;
+
+        Qubit AllocateQubit() override;
+
+        void ReleaseQubit(Qubit q) override;
+
+        std::string QubitToString(Qubit q) override;
+
+
+        ///
+        /// Implementation of IQuantumGateSet
+        ///
+        void X(Qubit q) override;
+
+        void ControlledX(long numControls, Qubit controls[], Qubit target) override;
+
+        void Y(Qubit q) override;
+
+        void ControlledY(long numControls, Qubit controls[], Qubit target) override;
+
+        void Z(Qubit q) override;
+
+        void ControlledZ(long numControls, Qubit controls[], Qubit target) override;
+
+        void H(Qubit q) override;
+
+        void ControlledH(long numControls, Qubit controls[], Qubit target) override;
+
+        void S(Qubit q) override;
+
+        void ControlledS(long numControls, Qubit controls[], Qubit target) override;
+
+        void AdjointS(Qubit q) override;
+
+        void ControlledAdjointS(long numControls, Qubit controls[], Qubit target) override;
+
+        void T(Qubit q) override;
+
+        void ControlledT(long numControls, Qubit controls[], Qubit target) override;
+
+        void AdjointT(Qubit q) override;
+
+        void ControlledAdjointT(long numControls, Qubit controls[], Qubit target) override;
+
+        void R(PauliId axis, Qubit target, double theta) override;
+
+        void ControlledR(long numControls, Qubit controls[], PauliId axis, Qubit target, double theta) override;
+
+        void Exp(long numTargets, PauliId paulis[], Qubit targets[], double theta) override;
+
+        void ControlledExp(long numControls, Qubit controls[], long numTargets, PauliId paulis[], Qubit targets[], double theta) override;
+
+        Result Measure(long numBases, PauliId bases[], long numTargets, Qubit targets[]) override;
+
+    }; // class SparseStateSimulator
+
+} // namespace Quantum
+} // namespace Microsoft
@@ -0,0 +1,66 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace Microsoft
+{
+namespace Quantum
+{
+    // Lock-free ring buffer between exactly one producer and one consumer thread. Slots are filled and read in place,
+    // so elements holding containers keep their capacity when a slot is reused, and a warmed-up queue allocates
+    // nothing. The two indices live on separate cache lines, as each one is only written by one of the threads.
+    template <typename T, size_t Capacity>
+    class SpscQueue
+    {
+        static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two.");
+
+        std::vector<T> slots = std::vector<T>(Capacity);
+
+        // Number of elements popped by the consumer and pushed by the producer so far.
+        alignas(64) std::atomic<size_t> head{0};
+        alignas(64) std::atomic<size_t> tail{0};
+
+      public:
+        // Producer: the next free slot to be filled, or nullptr if the queue is full.
+        T* Back()
+        {
+            size_t t = this->tail.load(std::memory_order_relaxed);
+            if (t - this->head.load(std::memory_order_acquire) == Capacity)
+                return nullptr;
+            return &this->slots[t & (Capacity - 1)];
+        }
+
+        // Producer: publishes the slot returned by `Back`.
+        void Push()
+        {
+            this->tail.store(this->tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        // Consumer: the oldest element, or nullptr if the queue is empty.
+        T* Front()
+        {
+            size_t h = this->head.load(std::memory_order_relaxed);
+            if (h == this->tail.load(std::memory_order_acquire))
+                return nullptr;
+            return &this->slots[h & (Capacity - 1)];
+        }
+
+        // Consumer: hands the slot returned by `Front` back to the producer.
+        void Pop()
+        {
+            this->head.store(this->head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        bool Empty() const
+        {
+            return this->head.load(std::memory_order_acquire) == this->tail.load(std::memory_order_acquire);
+        }
+    };
+
+} // namespace Quantum
+} // namespace Microsoft
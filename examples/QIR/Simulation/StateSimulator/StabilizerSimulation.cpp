@@ -0,0 +1,628 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include <bitset>
+#include <cmath>
+#include <complex>
+#include <stdexcept>
+
+#include "StabilizerSimulator.hpp"
+
+using namespace Microsoft::Quantum;
+using namespace std::complex_literals;
+
+# define PI 3.14159265358979323846
+# define CLIFFORD_ANGLE_TOLERANCE 1e-12
+# define MAX_PROMOTION_QUBITS 30
+
+static int PopCount(uint64_t word)
+{
+    return static_cast<int>(std::bitset<64>(word).count());
+}
+
+static bool GetBit(const std::vector<uint64_t>& words, short col)
+{
+    return (words[col / 64] >> (col % 64)) & 1;
+}
+
+static void FlipBit(std::vector<uint64_t>& words, short col)
+{
+    words[col / 64] ^= uint64_t(1) << (col % 64);
+}
+
+// Power of i picked up by the single-qubit Pauli product (x1,z1)·(x2,z2), see the function g in CHP.
+static int PhaseExponent(bool x1, bool z1, bool x2, bool z2)
+{
+    if (!x1 && !z1)
+        return 0;
+    if (x1 && z1)
+        return z2 - x2;
+    if (x1)
+        return z2 * (2 * x2 - 1);
+    return x2 * (1 - 2 * z2);
+}
+
+
+///
+/// Tableau manipulation
+///
+
+template <typename TRow, typename TUpdate>
+static void ForEachRow(std::vector<TRow>& destabilizers, std::vector<TRow>& stabilizers, TUpdate update)
+{
+    for (TRow& row : destabilizers)
+        update(row);
+    for (TRow& row : stabilizers)
+        update(row);
+}
+
+void StabilizerSimulator::ApplyH(short col)
+{
+    ForEachRow(this->destabilizers, this->stabilizers, [col](PauliRow& row) {
+        bool x = GetBit(row.x, col), z = GetBit(row.z, col);
+        row.r ^= x && z;
+        if (x != z) {
+            FlipBit(row.x, col);
+            FlipBit(row.z, col);
+        }
+    });
+}
+
+void StabilizerSimulator::ApplyS(short col)
+{
+    ForEachRow(this->destabilizers, this->stabilizers, [col](PauliRow& row) {
+        bool x = GetBit(row.x, col), z = GetBit(row.z, col);
+        row.r ^= x && z;
+        if (x)
+            FlipBit(row.z, col);
+    });
+}
+
+void StabilizerSimulator::ApplyX(short col)
+{
+    ForEachRow(this->destabilizers, this->stabilizers, [col](PauliRow& row) {
+        row.r ^= GetBit(row.z, col);
+    });
+}
+
+void StabilizerSimulator::ApplyZ(short col)
+{
+    ForEachRow(this->destabilizers, this->stabilizers, [col](PauliRow& row) {
+        row.r ^= GetBit(row.x, col);
+    });
+}
+
+void StabilizerSimulator::ApplyCNOT(short control, short target)
+{
+    ForEachRow(this->destabilizers, this->stabilizers, [control, target](PauliRow& row) {
+        bool xc = GetBit(row.x, control), zc = GetBit(row.z, control);
+        bool xt = GetBit(row.x, target), zt = GetBit(row.z, target);
+        row.r ^= xc && zt && (xt == zc);
+        if (xc)
+            FlipBit(row.x, target);
+        if (zt)
+            FlipBit(row.z, control);
+    });
+}
+
+void StabilizerSimulator::ApplyAdjointS(short col)
+{
+    // S† = Z·S
+    ApplyS(col);
+    ApplyZ(col);
+}
+
+void StabilizerSimulator::ApplyCZ(short control, short target)
+{
+    // CZ = (1 ⊗ H) CNOT (1 ⊗ H)
+    ApplyH(target);
+    ApplyCNOT(control, target);
+    ApplyH(target);
+}
+
+void StabilizerSimulator::ApplyCY(short control, short target)
+{
+    // CY = (1 ⊗ S) CNOT (1 ⊗ S†)
+    ApplyAdjointS(target);
+    ApplyCNOT(control, target);
+    ApplyS(target);
+}
+
+// Sets h to the product i·h, the rowsum operation of CHP.
+static void MultiplyRows(std::vector<uint64_t>& hx, std::vector<uint64_t>& hz, bool& hr,
+                         const std::vector<uint64_t>& ix, const std::vector<uint64_t>& iz, bool ir, short numColumns)
+{
+    int phase = 2 * hr + 2 * ir;
+    for (short j = 0; j < numColumns; j++)
+        phase += PhaseExponent(GetBit(ix, j), GetBit(iz, j), GetBit(hx, j), GetBit(hz, j));
+    hr = ((phase % 4) + 4) % 4 == 2;
+
+    for (size_t w = 0; w < hx.size(); w++) {
+        hx[w] ^= ix[w];
+        hz[w] ^= iz[w];
+    }
+}
+
+bool StabilizerSimulator::MeasureColumn(short col)
+{
+    short n = static_cast<short>(this->stabilizers.size());
+
+    // The outcome is random iff some stabilizer anticommutes with Z on the measured column.
+    short p = 0;
+    while (p < n && !GetBit(this->stabilizers[p].x, col))
+        p++;
+
+    if (p < n) {
+        PauliRow& pivot = this->stabilizers[p];
+        for (short i = 0; i < n; i++) {
+            if (i != p && GetBit(this->stabilizers[i].x, col)) {
+                PauliRow& row = this->stabilizers[i];
+                MultiplyRows(row.x, row.z, row.r, pivot.x, pivot.z, pivot.r, this->numColumns);
+            }
+            if (GetBit(this->destabilizers[i].x, col)) {
+                PauliRow& row = this->destabilizers[i];
+                MultiplyRows(row.x, row.z, row.r, pivot.x, pivot.z, pivot.r, this->numColumns);
+            }
+        }
+
+        // The pivot moves to the destabilizers and is replaced by ±Z on the measured column.
+        this->destabilizers[p] = pivot;
+        std::fill(pivot.x.begin(), pivot.x.end(), 0);
+        std::fill(pivot.z.begin(), pivot.z.end(), 0);
+        FlipBit(pivot.z, col);
+        pivot.r = (this->rng.Next() >> 63) != 0;
+        return pivot.r;
+    }
+
+    // Deterministic outcome: Z on the measured column is the product of the stabilizers
+    // whose paired destabilizers anticommute with it.
+    PauliRow scratch;
+    scratch.x.assign(this->stabilizers[0].x.size(), 0);
+    scratch.z.assign(this->stabilizers[0].z.size(), 0);
+    for (short i = 0; i < n; i++) {
+        if (GetBit(this->destabilizers[i].x, col)) {
+            const PauliRow& row = this->stabilizers[i];
+            MultiplyRows(scratch.x, scratch.z, scratch.r, row.x, row.z, row.r, this->numColumns);
+        }
+    }
+    return scratch.r;
+}
+
+short StabilizerSimulator::MapPauliToZ(long numTargets, PauliId paulis[], Qubit targets[])
+{
+    // Basis changes take each X or Y to Z, then CNOTs collect the parity onto the first target.
+    short first = -1;
+    for (long i = 0; i < numTargets; i++) {
+        if (paulis[i] == PauliId_I)
+            continue;
+        short col = GetColumn(targets[i]);
+        if (paulis[i] == PauliId_X) {
+            ApplyH(col);
+        } else if (paulis[i] == PauliId_Y) {
+            ApplyAdjointS(col);
+            ApplyH(col);
+        }
+        if (first < 0)
+            first = col;
+        else
+            ApplyCNOT(col, first);
+    }
+    return first;
+}
+
+void StabilizerSimulator::UnmapPauliToZ(long numTargets, PauliId paulis[], Qubit targets[])
+{
+    short first = -1;
+    for (long i = 0; i < numTargets && first < 0; i++) {
+        if (paulis[i] != PauliId_I)
+            first = GetColumn(targets[i]);
+    }
+
+    for (long i = numTargets - 1; i >= 0; i--) {
+        if (paulis[i] == PauliId_I)
+            continue;
+        short col = GetColumn(targets[i]);
+        if (col != first)
+            ApplyCNOT(col, first);
+        if (paulis[i] == PauliId_X) {
+            ApplyH(col);
+        } else if (paulis[i] == PauliId_Y) {
+            ApplyH(col);
+            ApplyS(col);
+        }
+    }
+}
+
+bool StabilizerSimulator::TryApplyCliffordExp(long numTargets, PauliId paulis[], Qubit targets[], double theta)
+{
+    // exp(iθP) is Clifford iff θ is a multiple of π/4, and up to global phase
+    //     exp(iπ/4 Z) = S†,  exp(iπ/2 Z) = Z,  exp(i3π/4 Z) = S
+    double quarterTurns = std::round(theta / (PI / 4));
+    if (std::abs(theta - quarterTurns * PI / 4) > CLIFFORD_ANGLE_TOLERANCE)
+        return false;
+
+    short col = MapPauliToZ(numTargets, paulis, targets);
+    if (col >= 0) {
+        switch (((static_cast<long>(quarterTurns) % 4) + 4) % 4) {
+            case 1:
+                ApplyAdjointS(col);
+                break;
+            case 2:
+                ApplyZ(col);
+                break;
+            case 3:
+                ApplyS(col);
+                break;
+        }
+    }
+    UnmapPauliToZ(numTargets, paulis, targets);
+    return true;
+}
+
+
+///
+/// Hand-off to the state vector simulator
+///
+
+State StabilizerSimulator::ToStateVector()
+{
+    if (this->numColumns > MAX_PROMOTION_QUBITS)
+        throw std::runtime_error("Cannot promote a stabilizer state of " + std::to_string(this->numColumns)
+                                 + " qubits to a state vector.");
+
+    // The stabilizer state is the unique joint +1 eigenvector of the stabilizers, so projecting any state with
+    // non-zero overlap yields it: |Ψ⟩ ∝ Π_i (1 + S_i)/2 |Φ⟩. A generic |Φ⟩ is drawn from a fixed-seed generator
+    // to leave the measurement stream untouched.
+    long dim = 1L << this->numColumns;
+    RandomGenerator generic;
+    State psi(dim), projected(dim);
+    for (long b = 0; b < dim; b++)
+        psi(b) = std::complex<double>(generic.NextDouble() - 0.5, generic.NextDouble() - 0.5);
+
+    for (const PauliRow& row : this->stabilizers) {
+        // Column j of the tableau is bit j of the basis index here, with
+        //     (-1)^r X^x Z^z |b⟩ = (-1)^r i^|x∧z| (-1)^|b∧z| |b⊕x⟩, Y = iXZ.
+        uint64_t xMask = row.x[0], zMask = row.z[0];
+        std::complex<double> phase = (row.r ? -1.0 : 1.0) * std::pow(1i, PopCount(xMask & zMask) % 4);
+        for (long b = 0; b < dim; b++)
+            projected(b ^ xMask) = (PopCount(b & zMask) % 2 ? -phase : phase) * psi(b);
+        psi = (psi + projected) / 2;
+    }
+
+    // Released columns are in |0⟩, so the active qubits are read off the slice where those bits vanish.
+    // The first qubit of the compute register becomes the most significant bit, matching StateSimulator.
+    short numActive = static_cast<short>(this->computeRegister.size());
+    State state(1L << numActive);
+    for (long i = 0; i < state.size(); i++) {
+        long b = 0;
+        for (short k = 0; k < numActive; k++) {
+            if ((i >> (numActive - 1 - k)) & 1)
+                b |= 1L << this->columns[k];
+        }
+        state(i) = psi(b);
+    }
+
+    // Fix the global phase such that the largest amplitude is real and positive.
+    Eigen::Index maxIdx;
+    state.cwiseAbs().maxCoeff(&maxIdx);
+    state *= std::abs(state(maxIdx)) / state(maxIdx);
+    return state.normalized();
+}
+
+void StabilizerSimulator::Promote()
+{
+    if (this->promoted)
+        return;
+
+    State state = ToStateVector();
+    this->promoted = std::make_unique<StateSimulator>();
+    this->promoted->SetRngState(this->rng.GetState());
+    for (Qubit q : this->computeRegister)
+        this->promotedQubits[q] = this->promoted->AllocateQubit();
+    this->promoted->SetStateVector(state);
+
+    this->destabilizers.clear();
+    this->stabilizers.clear();
+    this->computeRegister.clear();
+    this->columns.clear();
+    this->freeColumns.clear();
+    this->numColumns = 0;
+}
+
+Qubit StabilizerSimulator::ToPromoted(Qubit q)
+{
+    return this->promotedQubits.at(q);
+}
+
+std::vector<Qubit> StabilizerSimulator::ToPromoted(long numQubits, Qubit qubits[])
+{
+    std::vector<Qubit> translated(numQubits);
+    for (long i = 0; i < numQubits; i++)
+        translated[i] = ToPromoted(qubits[i]);
+    return translated;
+}
+
+
+///
+/// Qubit management
+///
+
+Qubit StabilizerSimulator::AllocateQubit()
+{
+    Qubit q = this->qbm->Allocate();
+    if (this->promoted) {
+        this->promotedQubits[q] = this->promoted->AllocateQubit();
+        return q;
+    }
+
+    // Reuse a released column (already reset to |0⟩) or append a new one in |0⟩, which adds the
+    // destabilizer X and the stabilizer Z on that column.
+    short col;
+    if (!this->freeColumns.empty()) {
+        col = this->freeColumns.back();
+        this->freeColumns.pop_back();
+    } else {
+        col = this->numColumns++;
+        size_t numWords = (this->numColumns + 63) / 64;
+        ForEachRow(this->destabilizers, this->stabilizers, [numWords](PauliRow& row) {
+            row.x.resize(numWords, 0);
+            row.z.resize(numWords, 0);
+        });
+        PauliRow destabilizer, stabilizer;
+        destabilizer.x.assign(numWords, 0);
+        destabilizer.z.assign(numWords, 0);
+        stabilizer = destabilizer;
+        FlipBit(destabilizer.x, col);
+        FlipBit(stabilizer.z, col);
+        this->destabilizers.push_back(destabilizer);
+        this->stabilizers.push_back(stabilizer);
+    }
+
+    this->computeRegister.push_back(q);
+    this->columns.push_back(col);
+    return q;
+}
+
+void StabilizerSimulator::ReleaseQubit(Qubit q)
+{
+    if (this->promoted) {
+        this->promoted->ReleaseQubit(ToPromoted(q));
+        this->promotedQubits.erase(q);
+    } else {
+        // Reset the column to |0⟩ so that it can be handed out again.
+        short idx = GetQubitIdx(q);
+        short col = this->columns[idx];
+        if (MeasureColumn(col))
+            ApplyX(col);
+        this->freeColumns.push_back(col);
+        this->computeRegister.erase(this->computeRegister.begin() + idx);
+        this->columns.erase(this->columns.begin() + idx);
+    }
+    this->qbm->Release(q);
+}
+
+std::string StabilizerSimulator::QubitToString(Qubit q)
+{
+    return std::to_string(this->qbm->GetQubitId(q));
+}
+
+
+///
+/// Result management
+///
+
+static Result zero = reinterpret_cast<Result>(0);
+static Result one = reinterpret_cast<Result>(1);
+
+void StabilizerSimulator::ReleaseResult(Result r) {}
+
+bool StabilizerSimulator::AreEqualResults(Result r1, Result r2)
+{
+    return (r1 == r2);
+}
+
+ResultValue StabilizerSimulator::GetResultValue(Result r)
+{
+    return (r == one) ? Result_One : Result_Zero;
+}
+
+Result StabilizerSimulator::UseZero()
+{
+    return zero;
+}
+
+Result StabilizerSimulator::UseOne()
+{
+    return one;
+}
+
+
+///
+/// Supported quantum operations
+///
+
+void StabilizerSimulator::X(Qubit q)
+{
+    if (this->promoted)
+        return this->promoted->X(ToPromoted(q));
+    ApplyX(GetColumn(q));
+}
+
+void StabilizerSimulator::ControlledX(long numControls, Qubit controls[], Qubit target)
+{
+    if (!this->promoted && numControls == 0)
+        return X(target);
+    if (!this->promoted && numControls == 1)
+        return ApplyCNOT(GetColumn(controls[0]), GetColumn(target));
+    Promote();
+    this->promoted->ControlledX(numControls, ToPromoted(numControls, controls).data(), ToPromoted(target));
+}
+
+void StabilizerSimulator::Y(Qubit q)
+{
+    if (this->promoted)
+        return this->promoted->Y(ToPromoted(q));
+    short col = GetColumn(q);
+    ApplyZ(col);
+    ApplyX(col);
+}
+
+void StabilizerSimulator::ControlledY(long numControls, Qubit controls[], Qubit target)
+{
+    if (!this->promoted && numControls == 0)
+        return Y(target);
+    if (!this->promoted && numControls == 1)
+        return ApplyCY(GetColumn(controls[0]), GetColumn(target));
+    Promote();
+    this->promoted->ControlledY(numControls, ToPromoted(numControls, controls).data(), ToPromoted(target));
+}
+
+void StabilizerSimulator::Z(Qubit q)
+{
+    if (this->promoted)
+        return this->promoted->Z(ToPromoted(q));
+    ApplyZ(GetColumn(q));
+}
+
+void StabilizerSimulator::ControlledZ(long numControls, Qubit controls[], Qubit target)
+{
+    if (!this->promoted && numControls == 0)
+        return Z(target);
+    if (!this->promoted && numControls == 1)
+        return ApplyCZ(GetColumn(controls[0]), GetColumn(target));
+    Promote();
+    this->promoted->ControlledZ(numControls, ToPromoted(numControls, controls).data(), ToPromoted(target));
+}
+
+void StabilizerSimulator::H(Qubit q)
+{
+    if (this->promoted)
+        return this->promoted->H(ToPromoted(q));
+    ApplyH(GetColumn(q));
+}
+
+void StabilizerSimulator::ControlledH(long numControls, Qubit controls[], Qubit target)
+{
+    if (!this->promoted && numControls == 0)
+        return H(target);
+    Promote();
+    this->promoted->ControlledH(numControls, ToPromoted(numControls, controls).data(), ToPromoted(target));
+}
+
+void StabilizerSimulator::S(Qubit q)
+{
+    if (this->promoted)
+        return this->promoted->S(ToPromoted(q));
+    ApplyS(GetColumn(q));
+}
+
+void StabilizerSimulator::ControlledS(long numControls, Qubit controls[], Qubit target)
+{
+    if (!this->promoted && numControls == 0)
+        return S(target);
+    Promote();
+    this->promoted->ControlledS(numControls, ToPromoted(numControls, controls).data(), ToPromoted(target));
+}
+
+void StabilizerSimulator::AdjointS(Qubit q)
+{
+    if (this->promoted)
+        return this->promoted->AdjointS(ToPromoted(q));
+    ApplyAdjointS(GetColumn(q));
+}
+
+void StabilizerSimulator::ControlledAdjointS(long numControls, Qubit controls[], Qubit target)
+{
+    if (!this->promoted && numControls == 0)
+        return AdjointS(target);
+    Promote();
+    this->promoted->ControlledAdjointS(numControls, ToPromoted(numControls, controls).data(), ToPromoted(target));
+}
+
+void StabilizerSimulator::T(Qubit q)
+{
+    Promote();
+    this->promoted->T(ToPromoted(q));
+}
+
+void StabilizerSimulator::ControlledT(long numControls, Qubit controls[], Qubit target)
+{
+    Promote();
+    this->promoted->ControlledT(numControls, ToPromoted(numControls, controls).data(), ToPromoted(target));
+}
+
+void StabilizerSimulator::AdjointT(Qubit q)
+{
+    Promote();
+    this->promoted->AdjointT(ToPromoted(q));
+}
+
+void StabilizerSimulator::ControlledAdjointT(long numControls, Qubit controls[], Qubit target)
+{
+    Promote();
+    this->promoted->ControlledAdjointT(numControls, ToPromoted(numControls, controls).data(), ToPromoted(target));
+}
+
+void StabilizerSimulator::R(PauliId axis, Qubit q, double theta)
+{
+    // R_P(θ) = exp(-iθ/2 P)
+    if (!this->promoted && TryApplyCliffordExp(1, &axis, &q, -theta / 2))
+        return;
+    Promote();
+    this->promoted->R(axis, ToPromoted(q), theta);
+}
+
+void StabilizerSimulator::ControlledR(long numControls, Qubit controls[], PauliId axis, Qubit target, double theta)
+{
+    if (!this->promoted && numControls == 0)
+        return R(axis, target, theta);
+    Promote();
+    this->promoted->ControlledR(numControls, ToPromoted(numControls, controls).data(), axis, ToPromoted(target), theta);
+}
+
+void StabilizerSimulator::Exp(long numTargets, PauliId paulis[], Qubit targets[], double theta)
+{
+    if (!this->promoted && TryApplyCliffordExp(numTargets, paulis, targets, theta))
+        return;
+    Promote();
+    this->promoted->Exp(numTargets, paulis, ToPromoted(numTargets, targets).data(), theta);
+}
+
+void StabilizerSimulator::ControlledExp(long numControls, Qubit controls[], long numTargets, PauliId paulis[], Qubit targets[], double theta)
+{
+    if (!this->promoted && numControls == 0)
+        return Exp(numTargets, paulis, targets, theta);
+    Promote();
+    this->promoted->ControlledExp(numControls, ToPromoted(numControls, controls).data(),
+                                  numTargets, paulis, ToPromoted(numTargets, targets).data(), theta);
+}
+
+Result StabilizerSimulator::Measure(long numBases, PauliId bases[], long numTargets, Qubit targets[])
+{
+    assert(numBases == numTargets);
+    if (this->promoted)
+        return this->promoted->Measure(numBases, bases, numTargets, ToPromoted(numTargets, targets).data());
+
+    // Multi-qubit Pauli measurements are reduced to a Z measurement on a single column.
+    short col = MapPauliToZ(numTargets, bases, targets);
+    bool outcome = col >= 0 && MeasureColumn(col);
+    UnmapPauliToZ(numTargets, bases, targets);
+    return outcome ? UseOne() : UseZero();
+}
+
+
+///
+/// Runtime driver instantiation
+///
+
+namespace Microsoft
+{
+namespace Quantum
+{
+    std::unique_ptr<IRuntimeDriver> CreateStabilizerSimulator(uint32_t userProvidedSeed)
+    {
+        return std::make_unique<StabilizerSimulator>(userProvidedSeed);
+    }
+
+} // namespace Quantum
+} // namespace Microsoft
@@ -0,0 +1,181 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "QirRuntimeApi_I.hpp"
+#include "QSharpSimApi_I.hpp"
+
+#include "QubitManager.hpp"
+#include "RandomGenerator.hpp"
+#include "StateSimulator.hpp"
+
+namespace Microsoft
+{
+namespace Quantum
+{
+    // Stabilizer simulator based on the CHP tableau representation (Aaronson & Gottesman, 2004).
+    // Clifford gates cost O(n) and measurements O(n^2), so that large Clifford circuits can be simulated.
+    // The first time a non-Clifford operation arrives, the tableau is converted into a state vector and the
+    // run is handed off to a StateSimulator, which then receives all further operations.
+    class StabilizerSimulator : public IRuntimeDriver, public IQuantumGateSet
+    {
+        // A Pauli operator (-1)^r X^x Z^z over all tableau columns, bit-packed into 64 bit words.
+        struct PauliRow
+        {
+            std::vector<uint64_t> x, z;
+            bool r = false;
+        };
+
+        // Associated qubit manager instance to handle qubit representation.
+        CQubitManager *qbm;
+
+        // The register of currently active qubits and the tableau column holding each of them.
+        std::vector<Qubit> computeRegister;
+        std::vector<short> columns;
+
+        // Columns of released qubits, reset to |0⟩ and available for reuse.
+        std::vector<short> freeColumns;
+
+        // The tableau: row i of the destabilizers is paired with row i of the stabilizers.
+        short numColumns = 0;
+        std::vector<PauliRow> destabilizers;
+        std::vector<PauliRow> stabilizers;
+
+        RandomGenerator rng;
+
+        // State vector simulator taking over after the first non-Clifford operation,
+        // together with the translation of qubits handed out by this simulator to its qubits.
+        std::unique_ptr<StateSimulator> promoted;
+        std::unordered_map<Qubit, Qubit> promotedQubits;
+
+        // Tableau updates for Clifford operations acting on columns.
+        void ApplyH(short col);
+        void ApplyS(short col);
+        void ApplyX(short col);
+        void ApplyZ(short col);
+        void ApplyCNOT(short control, short target);
+        void ApplyAdjointS(short col);
+        void ApplyCZ(short control, short target);
+        void ApplyCY(short control, short target);
+
+        // Z basis measurement of a single column.
+        bool MeasureColumn(short col);
+
+        // Conjugates the Pauli product onto a Z on the first non-identity target, returns that column or -1.
+        short MapPauliToZ(long numTargets, PauliId paulis[], Qubit targets[]);
+        void UnmapPauliToZ(long numTargets, PauliId paulis[], Qubit targets[]);
+
+        // Applies exp(iθP) for a Pauli product P, returns false if θ is not a multiple of π/4.
+        bool TryApplyCliffordExp(long numTargets, PauliId paulis[], Qubit targets[], double theta);
+
+        // Converts the tableau into a state vector and hands off the run to a StateSimulator.
+        void Promote();
+        State ToStateVector();
+        Qubit ToPromoted(Qubit q);
+        std::vector<Qubit> ToPromoted(long numQubits, Qubit qubits[]);
+
+        short GetQubitIdx(Qubit q)
+        {
+            return std::distance(
+                this->computeRegister.begin(),
+                std::find(this->computeRegister.begin(), this->computeRegister.end(), q)
+            );
+        }
+
+        short GetColumn(Qubit q)
+        {
+            return this->columns[GetQubitIdx(q)];
+        }
+
+      public:
+        StabilizerSimulator(uint32_t userProvidedSeed = 0, uint64_t streamId = 0)
+            : rng(userProvidedSeed, streamId)
+        {
+            this->qbm = new CQubitManager();
+        }
+        ~StabilizerSimulator()
+        {
+            delete this->qbm;
+        }
+
+        // Whether the run has been handed off to the state vector simulator.
+        bool IsPromoted() const
+        {
+            return this->promoted != nullptr;
+        }
+
+
+        ///
+        /// Implementation of IRuntimeDriver
+        ///
+        void ReleaseResult(Result r) override;
+
+        bool AreEqualResults(Result r1, Result r2) override;
+
+        ResultValue GetResultValue(Result r) override;
+
+        Result UseZero() override;
+
+        Result UseOne() override;
+
+        Qubit AllocateQubit() override;
+
+        void ReleaseQubit(Qubit q) override;
+
+        std::string QubitToString(Qubit q) override;
+
+
+        ///
+        /// Implementation of IQuantumGateSet
+        ///
+        void X(Qubit q) override;
+
+        void ControlledX(long numControls, Qubit controls[], Qubit target) override;
+
+        void Y(Qubit q) override;
+
+        void ControlledY(long numControls, Qubit controls[], Qubit target) override;
+
+        void Z(Qubit q) override;
+
+        void ControlledZ(long numControls, Qubit controls[], Qubit target) override;
+
+        void H(Qubit q) override;
+
+        void ControlledH(long numControls, Qubit controls[], Qubit target) override;
+
+        void S(Qubit q) override;
+
+        void ControlledS(long numControls, Qubit controls[], Qubit target) override;
+
+        void AdjointS(Qubit q) override;
+
+        void ControlledAdjointS(long numControls, Qubit controls[], Qubit target) override;
+
+        void T(Qubit q) override;
+
+        void ControlledT(long numControls, Qubit controls[], Qubit target) override;
+
+        void AdjointT(Qubit q) override;
+
+        void ControlledAdjointT(long numControls, Qubit controls[], Qubit target) override;
+
+        void R(PauliId axis, Qubit target, double theta) override;
+
+        void ControlledR(long numControls, Qubit controls[], PauliId axis, Qubit target, double theta) override;
+
+        void Exp(long numTargets, PauliId paulis[], Qubit targets[], double theta) override;
+
+        void ControlledExp(long numControls, Qubit controls[], long numTargets, PauliId paulis[], Qubit targets[], double theta) override;
+
+        Result Measure(long numBases, PauliId bases[], long numTargets, Qubit targets[]) override;
+
+    }; // class StabilizerSimulator
+
+} // namespace Quantum
+} // namespace Microsoft
@@ -0,0 +1,191 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <complex>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <iterator>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "RandomGenerator.hpp"
+
+#include "Eigen/Dense"
+
+namespace Microsoft
+{
+namespace Quantum
+{
+    // Binary checkpoint of a state vector simulation, in native byte order:
+    //
+    //     header     magic, version, number of qubits, PRNG state and offset of the amplitudes
+    //     qubit ids  one int64 per qubit of the compute register, in register order
+    //     allocation one int64 per qubit of the compute register, the same ids in order of allocation
+    //     padding    up to the next multiple of 64 bytes
+    //     amplitudes 2^n complex doubles of the state vector
+    //
+    // The amplitudes are aligned so that a memory mapped checkpoint can be read in place as a state vector.
+    class StateCheckpoint
+    {
+        struct Header
+        {
+            char magic[8];
+            uint32_t version;
+            uint32_t numQubits;
+            uint64_t rngState[4];
+            uint64_t amplitudeOffset;
+        };
+
+        static constexpr char MAGIC[8] = {'Q', 'I', 'R', 'S', 'T', 'A', 'T', 'E'};
+        static constexpr uint32_t VERSION = 2;
+        static constexpr uint64_t ALIGNMENT = 64;
+
+        const char* data = nullptr;
+        size_t size = 0;
+#ifdef _WIN32
+        std::vector<char> buffer;
+#endif
+
+        const Header& GetHeader() const
+        {
+            return *reinterpret_cast<const Header*>(this->data);
+        }
+
+        static uint64_t AmplitudeOffset(uint32_t numQubits)
+        {
+            uint64_t end = sizeof(Header) + 2 * numQubits * sizeof(int64_t);
+            return (end + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+        }
+
+      public:
+        // Maps the checkpoint file into memory, throws `std::runtime_error` if it is not a valid checkpoint.
+        explicit StateCheckpoint(const std::string& path)
+        {
+#ifdef _WIN32
+            std::ifstream file(path, std::ios::binary);
+            if (!file)
+                throw std::runtime_error("Cannot open checkpoint file \"" + path + "\".");
+            this->buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+            this->data = this->buffer.data();
+            this->size = this->buffer.size();
+#else
+            int fd = open(path.c_str(), O_RDONLY);
+            struct stat info;
+            if (fd < 0 || fstat(fd, &info) != 0) {
+                if (fd >= 0)
+                    close(fd);
+                throw std::runtime_error("Cannot open checkpoint file \"" + path + "\".");
+            }
+            this->size = static_cast<size_t>(info.st_size);
+            void* mapping = this->size > 0 ? mmap(nullptr, this->size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+            close(fd);
+            if (mapping == MAP_FAILED)
+                throw std::runtime_error("Cannot map checkpoint file \"" + path + "\".");
+            // The amplitudes are read once front to back.
+            madvise(mapping, this->size, MADV_SEQUENTIAL);
+            this->data = static_cast<const char*>(mapping);
+#endif
+            if (this->size < sizeof(Header) || std::memcmp(GetHeader().magic, MAGIC, sizeof(MAGIC)) != 0
+                || GetHeader().version != VERSION || GetHeader().numQubits > 62
+                || GetHeader().amplitudeOffset != AmplitudeOffset(GetHeader().numQubits)
+                || this->size != GetHeader().amplitudeOffset + (sizeof(std::complex<double>) << GetHeader().numQubits)) {
+                Unmap();
+                throw std::runtime_error("Invalid checkpoint file \"" + path + "\".");
+            }
+        }
+        ~StateCheckpoint()
+        {
+            Unmap();
+        }
+        StateCheckpoint(const StateCheckpoint&) = delete;
+        StateCheckpoint& operator=(const StateCheckpoint&) = delete;
+
+        void Unmap()
+        {
+#ifndef _WIN32
+            if (this->data != nullptr)
+                munmap(const_cast<char*>(this->data), this->size);
+#endif
+            this->data = nullptr;
+        }
+
+        uint32_t NumQubits() const
+        {
+            return GetHeader().numQubits;
+        }
+
+        RandomGenerator::StateType RngState() const
+        {
+            RandomGenerator::StateType state;
+            std::copy(std::begin(GetHeader().rngState), std::end(GetHeader().rngState), state.begin());
+            return state;
+        }
+
+        const int64_t* QubitIds() const
+        {
+            return reinterpret_cast<const int64_t*>(this->data + sizeof(Header));
+        }
+
+        // The ids of `QubitIds` in the order in which the qubits were allocated, which basis indices follow.
+        const int64_t* AllocationOrder() const
+        {
+            return QubitIds() + GetHeader().numQubits;
+        }
+
+        // Read-only view of the amplitudes inside the mapped file, valid as long as the checkpoint is alive.
+        Eigen::Map<const Eigen::VectorXcd, Eigen::Aligned16> Amplitudes() const
+        {
+            return Eigen::Map<const Eigen::VectorXcd, Eigen::Aligned16>(
+                reinterpret_cast<const std::complex<double>*>(this->data + GetHeader().amplitudeOffset),
+                1L << GetHeader().numQubits);
+        }
+
+        // Writes a checkpoint with one sequential write per section. The file is written under a temporary name
+        // and renamed at the end, so that a crash while saving never leaves a truncated checkpoint behind.
+        static void Write(const std::string& path, const Eigen::Ref<const Eigen::VectorXcd>& amplitudes, const std::vector<int64_t>& qubitIds,
+                          const std::vector<int64_t>& allocationOrder, const RandomGenerator::StateType& rngState)
+        {
+            Header header = {};
+            std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+            header.version = VERSION;
+            header.numQubits = static_cast<uint32_t>(qubitIds.size());
+            std::copy(rngState.begin(), rngState.end(), header.rngState);
+            header.amplitudeOffset = AmplitudeOffset(header.numQubits);
+
+            std::string tmpPath = path + ".tmp";
+            {
+                std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+                if (!file)
+                    throw std::runtime_error("Cannot create checkpoint file \"" + tmpPath + "\".");
+                std::vector<char> padding(header.amplitudeOffset - sizeof(Header) - 2 * qubitIds.size() * sizeof(int64_t), 0);
+                file.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+                file.write(reinterpret_cast<const char*>(qubitIds.data()), qubitIds.size() * sizeof(int64_t));
+                file.write(reinterpret_cast<const char*>(allocationOrder.data()), allocationOrder.size() * sizeof(int64_t));
+                file.write(padding.data(), padding.size());
+                file.write(reinterpret_cast<const char*>(amplitudes.data()), amplitudes.size() * sizeof(std::complex<double>));
+                if (!file.flush())
+                    throw std::runtime_error("Failed to write checkpoint file \"" + tmpPath + "\".");
+            }
+#ifdef _WIN32
+            std::remove(path.c_str());
+#endif
+            if (std::rename(tmpPath.c_str(), path.c_str()) != 0)
+                throw std::runtime_error("Cannot replace checkpoint file \"" + path + "\".");
+        }
+    };
+
+} // namespace Quantum
+} // namespace Microsoft
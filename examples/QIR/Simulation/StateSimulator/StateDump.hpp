@@ -0,0 +1,182 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <algorithm>
+#include <complex>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "QirRuntimeApi_I.hpp"
+
+#include "Eigen/Dense"
+
+// Output of `DumpMachine` and `DumpRegister`, shared by the state vector backends. Amplitudes are read through a
+// callback from the basis index, so that each backend can stream them straight from its own storage layout.
+
+namespace Microsoft
+{
+namespace Quantum
+{
+    // Relative tolerance of the product state check of `WriteRegisterDump`.
+    constexpr double DUMP_TOLERANCE = 1e-6;
+
+    // Dumps are written either as text, one line per basis state, or in a binary format made of a header
+    //     magic "QIRDUMP\0", uint32 number of qubits, uint32 reserved, int64 qubit ids (most significant first)
+    // followed by one record {uint64 basis index, double re, double im} per listed basis state, in native byte order.
+    // Amplitudes are streamed straight from their source, only top-k selection keeps k indices on the side.
+    const char DUMP_MAGIC[8] = {'Q', 'I', 'R', 'D', 'U', 'M', 'P', '\0'};
+
+    // The location passed by the runtime is the target file name as a QIR string, null or empty for the console.
+    inline std::ostream& GetOutStream(const void* location, std::ofstream& file, bool binary)
+    {
+        const QirString* path = static_cast<const QirString*>(location);
+        if (path == nullptr || path->str.empty())
+            return std::cout;
+
+        file.open(path->str, binary ? std::ios::binary | std::ios::trunc : std::ios::trunc);
+        if (!file)
+            throw std::runtime_error("Cannot open dump file \"" + path->str + "\".");
+        return file;
+    }
+
+    inline void WriteDump(std::ostream& out, bool binary, const std::vector<int64_t>& qubitIds,
+                          const std::function<std::complex<double>(uint64_t)>& amplitude, uint64_t size,
+                          double cutoff, long topK)
+    {
+        uint32_t numQubits = static_cast<uint32_t>(qubitIds.size());
+        if (binary) {
+            uint32_t reserved = 0;
+            out.write(DUMP_MAGIC, sizeof(DUMP_MAGIC));
+            out.write(reinterpret_cast<const char*>(&numQubits), sizeof(numQubits));
+            out.write(reinterpret_cast<const char*>(&reserved), sizeof(reserved));
+            out.write(reinterpret_cast<const char*>(qubitIds.data()), qubitIds.size() * sizeof(int64_t));
+        } else {
+            out << "# state of " << numQubits << " qubits with ids (most significant first):";
+            for (int64_t id : qubitIds)
+                out << " " << id;
+            out << "\n" << std::fixed << std::setprecision(6);
+        }
+
+        auto writeEntry = [&](uint64_t idx) {
+            std::complex<double> a = amplitude(idx);
+            if (binary) {
+                double parts[2] = {a.real(), a.imag()};
+                out.write(reinterpret_cast<const char*>(&idx), sizeof(idx));
+                out.write(reinterpret_cast<const char*>(parts), sizeof(parts));
+            } else {
+                out << "|";
+                for (int b = numQubits - 1; b >= 0; b--)
+                    out << ((idx >> b) & 1);
+                out << "⟩\t" << std::showpos << a.real() << " " << a.imag() << "i" << std::noshowpos
+                    << "\tp=" << std::norm(a) << "\n";
+            }
+        };
+
+        if (topK <= 0) {
+            for (uint64_t idx = 0; idx < size; idx++) {
+                if (std::abs(amplitude(idx)) > cutoff)
+                    writeEntry(idx);
+            }
+        } else {
+            // Min-heap of the k largest magnitudes seen so far, listed in basis order at the end.
+            using Entry = std::pair<double, uint64_t>;
+            std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> largest;
+            for (uint64_t idx = 0; idx < size; idx++) {
+                double magnitude = std::abs(amplitude(idx));
+                if (magnitude <= cutoff)
+                    continue;
+                if ((long)largest.size() < topK)
+                    largest.push({magnitude, idx});
+                else if (magnitude > largest.top().first) {
+                    largest.pop();
+                    largest.push({magnitude, idx});
+                }
+            }
+            std::vector<uint64_t> indices;
+            indices.reserve(largest.size());
+            for (; !largest.empty(); largest.pop())
+                indices.push_back(largest.top().second);
+            std::sort(indices.begin(), indices.end());
+            for (uint64_t idx : indices)
+                writeEntry(idx);
+        }
+        out.flush();
+    }
+
+    // Writes the state of a register R, given by the bits it occupies in the basis index (most significant first), or
+    // a note that it is entangled with the rest of the system E.
+    //
+    // The register has a state of its own only if |Ψ⟩ = |φ⟩_R ⊗ |χ⟩_E, i.e. if the amplitudes ψ(r,e) form a
+    // rank one matrix. Taking the largest amplitude ψ(r0,e0), the candidate is φ(r) ∝ ψ(r,e0), and the state is
+    // a product state iff ψ(r,e) ψ(r0,e0) = ψ(r,e0) ψ(r0,e) for all r and e, which is checked in one pass over
+    // the state without forming the reduced density matrix. Only the 2^k amplitudes of φ are stored.
+    inline void WriteRegisterDump(std::ostream& out, bool binary, const std::vector<int64_t>& qubitIds,
+                                  const std::vector<uint64_t>& registerBits,
+                                  const std::function<std::complex<double>(uint64_t)>& amplitude, uint64_t size,
+                                  double cutoff, long topK)
+    {
+        const long numQubits = static_cast<long>(registerBits.size());
+        uint64_t registerMask = 0;
+        for (uint64_t bit : registerBits)
+            registerMask |= bit;
+        auto gather = [&](uint64_t idx) {
+            uint64_t r = 0;
+            for (long j = 0; j < numQubits; j++)
+                r = (r << 1) | ((idx & registerBits[j]) ? 1 : 0);
+            return r;
+        };
+        auto scatter = [&](uint64_t r) {
+            uint64_t idx = 0;
+            for (long j = 0; j < numQubits; j++) {
+                if (r & (uint64_t(1) << (numQubits - 1 - j)))
+                    idx |= registerBits[j];
+            }
+            return idx;
+        };
+
+        uint64_t i0 = 0;
+        double maxNorm = -1.0;
+        for (uint64_t idx = 0; idx < size; idx++) {
+            if (std::norm(amplitude(idx)) > maxNorm) {
+                maxNorm = std::norm(amplitude(idx));
+                i0 = idx;
+            }
+        }
+        std::complex<double> pivot = amplitude(i0);
+        uint64_t e0 = i0 & ~registerMask, r0Bits = i0 & registerMask;
+
+        Eigen::VectorXcd reduced(Eigen::Index(1) << numQubits);
+        for (long r = 0; r < reduced.size(); r++)
+            reduced(r) = amplitude(scatter(r) | e0);
+
+        bool entangled = false;
+        for (uint64_t idx = 0; idx < size && !entangled; idx++) {
+            std::complex<double> expected = reduced(gather(idx)) * amplitude((idx & ~registerMask) | r0Bits);
+            entangled = std::abs(amplitude(idx) * pivot - expected) > DUMP_TOLERANCE * std::abs(pivot);
+        }
+
+        if (entangled) {
+            // No pure state to show, the binary format then only contains the header.
+            if (binary)
+                WriteDump(out, true, qubitIds, nullptr, 0, 0.0, 0);
+            else
+                out << "# qubits are entangled with the rest of the system, the register has no state of its own\n";
+            return;
+        }
+
+        // Fix the global phase such that the largest amplitude is real and positive.
+        reduced *= std::conj(pivot) / std::abs(pivot) / reduced.norm();
+        WriteDump(out, binary, qubitIds, [&reduced](uint64_t idx) { return reduced(idx); }, reduced.size(), cutoff, topK);
+    }
+
+} // namespace Quantum
+} // namespace Microsoft
@@ -0,0 +1,251 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <bitset>
+#include <complex>
+#include <cstdint>
+#include <vector>
+
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
+#include "Eigen/Dense"
+
+#include "Reduction.hpp"
+
+// In-place kernels on a state vector of 2^n amplitudes, shared by the state vector backends.
+// Qubits are addressed by the bit mask they occupy in the basis index.
+
+namespace Microsoft
+{
+namespace Quantum
+{
+    // Bit masks of a Pauli product P = i^|x∧z| X^x Z^z over the basis index, such that P|b⟩ = phase (-1)^|b∧z| |b⊕x⟩.
+    struct PauliMasks
+    {
+        uint64_t x = 0, z = 0;
+        std::complex<double> phase = 1.0;
+    };
+
+    inline bool Parity(uint64_t word)
+    {
+        return std::bitset<64>(word).count() % 2;
+    }
+
+    // Factor of a diagonal operator on the basis states b with (b & controlMask) == controlValue: phase1 if |b∧z| is
+    // odd and phase0 otherwise, 1 on all other states. Products of such terms cover (controlled) phase gates,
+    // Z rotations and exponentials of Z strings.
+    struct DiagonalTerm
+    {
+        uint64_t controlMask = 0, controlValue = 0, z = 0;
+        std::complex<double> phase0 = 1.0, phase1 = 1.0;
+    };
+
+    // Enumerates the basis indices that are zero on a set of fixed bits: the k-th such index is obtained by
+    // scattering the bits of the counter k into the free positions (x86 `pdep`). Kernels on controlled gates
+    // thereby only visit the 2^(n-c) amplitudes of the controlled subspace instead of filtering all 2^n.
+    class BitScatter
+    {
+#ifdef __BMI2__
+        uint64_t freeMask;
+#else
+        // Masks of the bits below each fixed bit, in ascending order.
+        uint64_t lowMasks[64];
+        int numFixed = 0;
+#endif
+
+      public:
+        BitScatter(uint64_t fixedMask, [[maybe_unused]] uint64_t size)
+        {
+#ifdef __BMI2__
+            this->freeMask = (size - 1) & ~fixedMask;
+#else
+            for (uint64_t bits = fixedMask; bits != 0; bits &= bits - 1)
+                this->lowMasks[this->numFixed++] = (bits & (~bits + 1)) - 1;
+#endif
+        }
+
+        uint64_t operator()(uint64_t counter) const
+        {
+#ifdef __BMI2__
+            return _pdep_u64(counter, this->freeMask);
+#else
+            // Insert a zero at each fixed bit, from the lowest one up.
+            for (int i = 0; i < this->numFixed; i++)
+                counter = ((counter & ~this->lowMasks[i]) << 1) | (counter & this->lowMasks[i]);
+            return counter;
+#endif
+        }
+    };
+
+    // |Ψ'⟩ = cU|Ψ⟩ for a single-qubit gate U on the target bit, controlled on all bits of `controlMask` being set.
+    inline void ApplyGateKernel(std::complex<double>* psi, uint64_t size, const Eigen::Matrix2cd& gate, uint64_t targetMask,
+                                uint64_t controlMask = 0)
+    {
+        const std::complex<double> g00 = gate(0,0), g01 = gate(0,1), g10 = gate(1,0), g11 = gate(1,1);
+        const BitScatter scatter(targetMask | controlMask, size);
+        const long count = static_cast<long>(size >> std::bitset<64>(targetMask | controlMask).count());
+
+        if (g01 == 0.0 && g10 == 0.0) {
+            // Diagonal gates (Z, S, T, R_z and their controlled versions) only rescale amplitudes.
+            #pragma omp parallel for if(count > 4096)
+            for (long k = 0; k < count; k++) {
+                uint64_t i0 = scatter(k) | controlMask;
+                psi[i0] *= g00;
+                psi[i0 | targetMask] *= g11;
+            }
+        } else {
+            #pragma omp parallel for if(count > 4096)
+            for (long k = 0; k < count; k++) {
+                uint64_t i0 = scatter(k) | controlMask, i1 = i0 | targetMask;
+                std::complex<double> a0 = psi[i0], a1 = psi[i1];
+                psi[i0] = g00 * a0 + g01 * a1;
+                psi[i1] = g10 * a0 + g11 * a1;
+            }
+        }
+    }
+
+    // |Ψ'⟩ = cU|Ψ⟩ for a 2^K x 2^K matrix U (row-major) on K target bits, the first target being the most
+    // significant bit of U's index. With K known at compile time, the gather/multiply/scatter of the 2^K amplitudes
+    // of each block is fully unrolled, which is used for the common two- and three-qubit cases.
+    template <int K>
+    inline void ApplyUnitaryKernel(std::complex<double>* psi, uint64_t size, const std::complex<double>* matrix,
+                                   const uint64_t targetMasks[], uint64_t controlMask = 0)
+    {
+        constexpr int dim = 1 << K;
+        uint64_t offsets[dim] = {};
+        uint64_t fixedMask = controlMask;
+        for (int t = 0; t < K; t++) {
+            fixedMask |= targetMasks[t];
+            for (int j = 0; j < dim; j++) {
+                if (j & (1 << (K - 1 - t)))
+                    offsets[j] |= targetMasks[t];
+            }
+        }
+
+        const BitScatter scatter(fixedMask, size);
+        const long count = static_cast<long>(size >> std::bitset<64>(fixedMask).count());
+        #pragma omp parallel for if(count > 4096)
+        for (long k = 0; k < count; k++) {
+            uint64_t base = scatter(k) | controlMask;
+            std::complex<double> in[dim];
+            for (int j = 0; j < dim; j++)
+                in[j] = psi[base | offsets[j]];
+            for (int i = 0; i < dim; i++) {
+                std::complex<double> out = 0.0;
+                for (int j = 0; j < dim; j++)
+                    out += matrix[i * dim + j] * in[j];
+                psi[base | offsets[i]] = out;
+            }
+        }
+    }
+
+    // Same for a number of targets only known at run time.
+    inline void ApplyUnitaryKernel(std::complex<double>* psi, uint64_t size, const std::complex<double>* matrix,
+                                   long numTargets, const uint64_t targetMasks[], uint64_t controlMask = 0)
+    {
+        switch (numTargets) {
+            case 1:
+                return ApplyGateKernel(psi, size, Eigen::Map<const Eigen::Matrix<std::complex<double>, 2, 2, Eigen::RowMajor>>(matrix),
+                                       targetMasks[0], controlMask);
+            case 2:
+                return ApplyUnitaryKernel<2>(psi, size, matrix, targetMasks, controlMask);
+            case 3:
+                return ApplyUnitaryKernel<3>(psi, size, matrix, targetMasks, controlMask);
+        }
+
+        const long dim = 1L << numTargets;
+        std::vector<uint64_t> offsets(dim, 0);
+        uint64_t fixedMask = controlMask;
+        for (long t = 0; t < numTargets; t++) {
+            fixedMask |= targetMasks[t];
+            for (long j = 0; j < dim; j++) {
+                if (j & (1L << (numTargets - 1 - t)))
+                    offsets[j] |= targetMasks[t];
+            }
+        }
+
+        const BitScatter scatter(fixedMask, size);
+        const long count = static_cast<long>(size >> std::bitset<64>(fixedMask).count());
+        #pragma omp parallel if(count > 4096)
+        {
+            std::vector<std::complex<double>> in(dim);
+            #pragma omp for
+            for (long k = 0; k < count; k++) {
+                uint64_t base = scatter(k) | controlMask;
+                for (long j = 0; j < dim; j++)
+                    in[j] = psi[base | offsets[j]];
+                for (long i = 0; i < dim; i++) {
+                    std::complex<double> out = 0.0;
+                    for (long j = 0; j < dim; j++)
+                        out += matrix[i * dim + j] * in[j];
+                    psi[base | offsets[i]] = out;
+                }
+            }
+        }
+    }
+
+    // |Ψ'⟩ = (α + βP)|Ψ⟩ on the subspace selected by `controlMask`, pairing up the basis states b and b⊕x.
+    // Covers Pauli exponentials exp(iθP) = cos(θ) + i sin(θ) P as well as the projectors (1 ± P)/2.
+    inline void ApplyPauliSumKernel(std::complex<double>* psi, uint64_t size, std::complex<double> alpha, std::complex<double> beta,
+                                    const PauliMasks& masks, uint64_t controlMask = 0)
+    {
+        const std::complex<double> plus = beta * masks.phase, minus = -plus;
+        if (masks.x == 0) {
+            const BitScatter scatter(controlMask, size);
+            const long count = static_cast<long>(size >> std::bitset<64>(controlMask).count());
+            #pragma omp parallel for if(count > 4096)
+            for (long k = 0; k < count; k++) {
+                uint64_t b = scatter(k) | controlMask;
+                psi[b] *= alpha + (Parity(b & masks.z) ? minus : plus);
+            }
+            return;
+        }
+
+        // Iterate over the states with the highest bit of x cleared, each one forming a pair with b⊕x.
+        uint64_t highBit = masks.x;
+        while (highBit & (highBit - 1))
+            highBit &= highBit - 1;
+        const BitScatter scatter(highBit | controlMask, size);
+        const long count = static_cast<long>(size >> std::bitset<64>(highBit | controlMask).count());
+        #pragma omp parallel for if(count > 4096)
+        for (long k = 0; k < count; k++) {
+            uint64_t b = scatter(k) | controlMask, flipped = b ^ masks.x;
+            std::complex<double> v = psi[b], w = psi[flipped];
+            psi[b] = alpha * v + (Parity(flipped & masks.z) ? minus : plus) * w;
+            psi[flipped] = alpha * w + (Parity(b & masks.z) ? minus : plus) * v;
+        }
+    }
+
+    // |Ψ'⟩ = D|Ψ⟩ for the product D of the given diagonal terms, multiplying each amplitude by its phase in a single
+    // pass over the state, however many gates the terms were collected from.
+    inline void ApplyDiagonalKernel(std::complex<double>* psi, uint64_t size, const DiagonalTerm* terms, size_t numTerms)
+    {
+        const long count = static_cast<long>(size);
+        #pragma omp parallel for if(count > 4096)
+        for (long b = 0; b < count; b++) {
+            std::complex<double> phase = 1.0;
+            for (size_t i = 0; i < numTerms; i++) {
+                if ((b & terms[i].controlMask) == terms[i].controlValue)
+                    phase *= Parity(b & terms[i].z) ? terms[i].phase1 : terms[i].phase0;
+            }
+            psi[b] *= phase;
+        }
+    }
+
+    // Parity-weighted overlap Σ_b conj(ψ(b⊕x)) (-1)^|b∧z| ψ(b), such that 〈Ψ|P|Ψ⟩ = phase * overlap.
+    // This is the reduction shared by measurements, assertions and expectation values.
+    // The sum does not depend on the number of threads, so sampled outcomes are reproducible for a given seed.
+    inline std::complex<double> ParityOverlapKernel(const std::complex<double>* psi, uint64_t size, uint64_t x, uint64_t z)
+    {
+        return DeterministicComplexSum(static_cast<long>(size), [=](long b) {
+            std::complex<double> term = std::conj(psi[b ^ x]) * psi[b];
+            return Parity(b & z) ? -term : term;
+        });
+    }
+
+} // namespace Quantum
+} // namespace Microsoft
@@ -1,10 +1,13 @@
 // Copyright (c) Microsoft Corporation. All rights reserved.
 // Licensed under the MIT License.
 
+#include <algorithm>
 #include <complex>
+#include <new>
 #include <utility>
 
 #include "StateSimulator.hpp"
+#include "StateCheckpoint.hpp"
 
 #include "Eigen/KroneckerProduct"
 #include "Eigen/MatrixFunctions"
@@ -16,29 +19,6 @@ using namespace std::complex_literals;
 # define PI 3.14159265358979323846
 # define TOLERANCE 1e-6
 
-static Operator PartialTrace(Operator u, short idx, short dim)
-{
-    // Partial trace defined as:
-    //    tr_B[U] = (Id ⊗ 〈0|) U (Id ⊗ |0⟩) + (Id ⊗ 〈1|) U (Id ⊗ |1⟩)
-    // This is expanded to arbitrary sized systems where a single qubit is traced out.
-    Operator proj_zero = Operator::Ones(1,1), proj_one = Operator::Ones(1,1);
-    for (int i = 0; i < idx; i++) {
-        proj_zero = kroneckerProduct(proj_zero, Operator::Identity(2,2)).eval();
-        proj_one = kroneckerProduct(proj_one, Operator::Identity(2,2)).eval();
-    }
-    proj_zero = kroneckerProduct(proj_zero, Vector2cd(1,0)).eval();
-    proj_one = kroneckerProduct(proj_one, Vector2cd(0,1)).eval();
-    for (int i = idx+1; i < dim; i++) {
-        proj_zero = kroneckerProduct(proj_zero, Operator::Identity(2,2)).eval();
-        proj_one = kroneckerProduct(proj_one, Operator::Identity(2,2)).eval();
-    }
-
-    Operator result = proj_zero.adjoint() * u * proj_zero
-                    + proj_one.adjoint() * u * proj_one;
-
-    return result;
-}
-
 static Pauli SelectPauliOp(PauliId axis)
 {
     switch (axis) {
@@ -53,100 +33,576 @@ static Pauli SelectPauliOp(PauliId axis)
     }
 }
 
+static std::complex<double> PowerOfI(short k)
+{
+    static const std::complex<double> powers[] = {1.0, 1i, -1.0, -1i};
+    return powers[k % 4];
+}
+
 
 ///
 /// State manipulation
 ///
 
+void StateSimulator::ResizeState(uint64_t size)
+{
+    if (size > this->amplitudeBuffer.size())
+        this->amplitudeBuffer.resize(size, 0.0);
+    new (&this->stateVec) Map<State>(this->amplitudeBuffer.data(), size);
+}
+
+void StateSimulator::CheckMemoryBudget(long numQubits) const
+{
+    if (FitsMemoryBudget(numQubits))
+        return;
+    throw std::runtime_error("The state vector of " + std::to_string(numQubits) + " qubits needs " +
+                             (numQubits < 60 ? std::to_string(StateBytes(numQubits)) : "more than 2^64") +
+                             " bytes, exceeding the memory budget of " + std::to_string(this->memoryBudget) + " bytes.");
+}
+
 void StateSimulator::UpdateState(short qubitIndex, bool remove)
 {
     // When adding a qubit, the state vector can be updated with: |Ψ'⟩ = |Ψ⟩ ⊗ |0⟩.
-    // When removing a qubit, it is traced out from the state vector: ρ' = tr_i[|Ψ⟩〈Ψ|].
+    // When removing a qubit, it is traced out from the state vector: ρ' = tr_i[|Ψ⟩〈Ψ|].
+    // Both are done in place on the amplitude buffer, which keeps its memory for later growth.
+    ApplyScheduledGates();
+    uint64_t size = this->stateVec.size();
+    std::complex<double>* psi = this->amplitudeBuffer.data();
     if (!remove) {
-        this->stateVec = kroneckerProduct(this->stateVec, Vector2cd(1,0)).eval();
+        // The new qubit is the least significant bit, so ψ'(2b) = ψ(b) and ψ'(2b+1) = 0. Moving from the top down
+        // never overwrites an amplitude that has yet to be moved.
+        ResizeState(2 * size);
+        psi = this->amplitudeBuffer.data();
+        for (uint64_t b = size; b-- > 0;) {
+            psi[2 * b + 1] = 0.0;
+            psi[2 * b] = psi[b];
+        }
     } else {
-        Operator densityMatrix = this->stateVec * this->stateVec.adjoint();
-        densityMatrix = PartialTrace(densityMatrix, qubitIndex, this->numActiveQubits);
+        // The removed qubit is in a product state, |Ψ⟩ = (α|0⟩ + β|1⟩) ⊗ |Φ⟩, so both halves ψ(..0..) = α Φ and
+        // ψ(..1..) = β Φ are proportional to the remaining state. Keep the half with the larger norm, which equals
+        // the trace over the qubit up to a global phase. Equality in Cauchy-Schwarz, |〈α Φ|β Φ⟩|^2 = |α|^2 |β|^2,
+        // confirms the product state.
+        const uint64_t mask = uint64_t(1) << (this->numActiveQubits - 1 - qubitIndex);
+        auto index0 = [mask](long k) { return ((k & ~(mask - 1)) << 1) | (k & (mask - 1)); };
+        // Both norms are summed at once as the real and imaginary part of one complex sum.
+        std::complex<double> norms = DeterministicComplexSum(size / 2, [=](long k) {
+            return std::complex<double>(std::norm(psi[index0(k)]), std::norm(psi[index0(k) | mask]));
+        });
+        std::complex<double> overlap = DeterministicComplexSum(size / 2, [=](long k) {
+            return std::conj(psi[index0(k)]) * psi[index0(k) | mask];
+        });
+        double norm0 = norms.real(), norm1 = norms.imag();
+        assert(abs(std::norm(overlap) - norm0 * norm1) < TOLERANCE && "Released qubit is entangled.");
+
+        // Drop the qubit's bit from each kept index, moving from the bottom up.
+        const uint64_t kept = norm1 > norm0 ? mask : 0;
+        const double scale = 1 / sqrt(std::max(norm0, norm1));
+        for (uint64_t r = 0; r < size / 2; r++)
+            psi[r] = scale * psi[((r & ~(mask - 1)) << 1) | (r & (mask - 1)) | kept];
+        std::fill(psi + size / 2, psi + size, 0.0);
+        ResizeState(size / 2);
+    }
+}
+
+void StateSimulator::SetStateVector(const State& state)
+{
+    Flush();
+    assert(state.size() == (1L << this->numActiveQubits) && "State does not match the compute register.");
+    this->stateVec = state;
+}
 
-        // Ensure state is pure tr(ρ^2)=1, meaning the removed qubit was in a product state.
-        assert(abs((densityMatrix*densityMatrix).trace()-1.0) < TOLERANCE);
+void StateSimulator::Reset(uint32_t userProvidedSeed, uint64_t streamId)
+{
+    // Operations still held back belong to the previous run, and qubits still held by the program are handed back
+    // to the qubit manager for reuse.
+    this->scheduledGates.Clear();
+    this->numPendingCnots = 0;
+    this->diagonalTerms.clear();
+    this->pauliFrame.clear();
+    this->framePhase = 0;
+    for (Qubit q : this->allocationOrder)
+        this->qbm->Release(q);
+    this->classicalQubits.clear();
+    this->numOperations = 0;
+    this->computeRegister.clear();
+    this->allocationOrder.clear();
+    this->numActiveQubits = 0;
+
+    // Zero the used part of the buffer, leaving the scalar 1 of the empty register.
+    std::complex<double>* psi = this->amplitudeBuffer.data();
+    const long size = static_cast<long>(this->stateVec.size());
+    #pragma omp parallel for if(size > 4096)
+    for (long b = 0; b < size; b++)
+        psi[b] = 0.0;
+    ResizeState(1);
+    this->stateVec(0) = 1.0;
+
+    this->rng = RandomGenerator(userProvidedSeed, streamId);
+}
+
+void StateSimulator::SaveCheckpoint(const std::string& path)
+{
+    Flush();
+    std::vector<int64_t> qubitIds;
+    qubitIds.reserve(this->computeRegister.size());
+    for (Qubit q : this->computeRegister)
+        qubitIds.push_back(this->qbm->GetQubitId(q));
+    std::vector<int64_t> allocationIds;
+    allocationIds.reserve(this->allocationOrder.size());
+    for (Qubit q : this->allocationOrder)
+        allocationIds.push_back(this->qbm->GetQubitId(q));
+
+    StateCheckpoint::Write(path, this->stateVec, qubitIds, allocationIds, this->rng.GetState());
+}
+
+void StateSimulator::LoadCheckpoint(const std::string& path)
+{
+    StateCheckpoint checkpoint(path);
+    CheckMemoryBudget(checkpoint.NumQubits());
+    this->scheduledGates.Clear();
+    this->numPendingCnots = 0;
+    this->diagonalTerms.clear();
+    this->classicalQubits.clear();
+    this->framePhase = 0;
+    const int64_t* qubitIds = checkpoint.QubitIds();
+    long numQubits = checkpoint.NumQubits();
+
+    // A fresh qubit manager hands out ids in increasing order, so allocating up to the largest saved id and
+    // releasing the unused ones again recreates the same qubits. Only the order of reuse of free ids can differ.
+    delete this->qbm;
+    this->qbm = new CQubitManager();
+    int64_t maxId = numQubits > 0 ? *std::max_element(qubitIds, qubitIds + numQubits) : -1;
+    std::vector<Qubit> allocated;
+    for (int64_t id = 0; id <= maxId; id++)
+        allocated.push_back(this->qbm->Allocate());
+
+    this->computeRegister.clear();
+    for (long i = 0; i < numQubits; i++) {
+        auto it = std::find_if(allocated.begin(), allocated.end(),
+                               [&](Qubit q) { return this->qbm->GetQubitId(q) == qubitIds[i]; });
+        if (it == allocated.end())
+            throw std::runtime_error("Cannot restore qubit " + std::to_string(qubitIds[i]) + " of the checkpoint.");
+        this->computeRegister.push_back(*it);
+        allocated.erase(it);
+    }
+    for (Qubit q : allocated)
+        this->qbm->Release(q);
+
+    // Swaps leave the compute register out of allocation order, which basis indices of `GetState` keep following.
+    const int64_t* allocationIds = checkpoint.AllocationOrder();
+    this->allocationOrder.clear();
+    for (long i = 0; i < numQubits; i++) {
+        auto it = std::find_if(this->computeRegister.begin(), this->computeRegister.end(),
+                               [&](Qubit q) { return this->qbm->GetQubitId(q) == allocationIds[i]; });
+        if (it == this->computeRegister.end()
+            || std::find(this->allocationOrder.begin(), this->allocationOrder.end(), *it) != this->allocationOrder.end())
+            throw std::runtime_error("Cannot restore the allocation order of the checkpoint.");
+        this->allocationOrder.push_back(*it);
+    }
+    this->pauliFrame.assign(numQubits, 0);
+
+    // The amplitudes are copied once from the read-only mapping into the amplitude buffer rather than used in place:
+    // the buffer owns the storage of the state vector, which grows in place and is reused by `Reset`.
+    this->numActiveQubits = numQubits;
+    std::fill(this->amplitudeBuffer.begin(), this->amplitudeBuffer.begin() + this->stateVec.size(), 0.0);
+    ResizeState(checkpoint.Amplitudes().size());
+    this->stateVec = checkpoint.Amplitudes();
+    this->rng.SetState(checkpoint.RngState());
+}
+
+void StateSimulator::Flush()
+{
+    this->flushedQubits.clear();
+    for (const auto& entry : this->classicalQubits)
+        this->flushedQubits.push_back(entry.first);
+    Reinstate(this->flushedQubits.size(), this->flushedQubits.data());
+    Materialize(this->numActiveQubits, this->computeRegister.data());
+    ApplyScheduledGates();
+    if (this->framePhase != 0) {
+        this->stateVec *= PowerOfI(this->framePhase);
+        this->framePhase = 0;
+    }
+}
+
+void StateSimulator::ApplyScheduledGates()
+{
+    this->scheduledGates.Run(this->stateVec.data(), this->stateVec.size());
+}
+
+void StateSimulator::SchedulePendingCnots()
+{
+    Gate x; x << 0, 1,
+                 1, 0;
+    for (short i = 0; i < this->numPendingCnots; i++) {
+        if (this->scheduledGates.Full())
+            ApplyScheduledGates();
+        this->scheduledGates.Add(x, GetQubitMask(this->pendingCnots[i].second), GetQubitMask(this->pendingCnots[i].first));
+    }
+    this->numPendingCnots = 0;
+}
 
-        SelfAdjointEigenSolver<Operator> eigensolver(densityMatrix);
-        assert(eigensolver.info() == Success && "Failed to decompose density matrix.");
+void StateSimulator::ApplyPendingCnots()
+{
+    SchedulePendingCnots();
+    ApplyScheduledGates();
+}
 
-        Index maxEigenIdx;
-        ArrayXd eigenvals = eigensolver.eigenvalues().array();
-        eigenvals.abs().maxCoeff(&maxEigenIdx);
-        assert(abs(eigenvals(maxEigenIdx) - 1.0) < TOLERANCE);
+void StateSimulator::ApplyPendingDiagonal()
+{
+    SchedulePendingCnots();
+    if (this->diagonalTerms.empty())
+        return;
+    ApplyScheduledGates();
+    ApplyDiagonalKernel(this->stateVec.data(), this->stateVec.size(), this->diagonalTerms.data(),
+                        this->diagonalTerms.size());
+    this->diagonalTerms.clear();
+}
 
-        this->stateVec = eigensolver.eigenvectors().col(maxEigenIdx);
+void StateSimulator::Materialize(long numQubits, const Qubit qubits[])
+{
+    ApplyPendingDiagonal();
+    PauliMasks masks;
+    for (long i = 0; i < numQubits; i++) {
+        uint8_t& frame = this->pauliFrame[GetQubitIdx(qubits[i])];
+        if (frame & FRAME_X)
+            masks.x |= GetQubitMask(qubits[i]);
+        if (frame & FRAME_Z)
+            masks.z |= GetQubitMask(qubits[i]);
+        frame = 0;
     }
+    if (masks.x == 0 && masks.z == 0)
+        return;
+
+    // |Ψ'⟩ = i^k X^x Z^z |Ψ⟩, taking the global phase of the frame along.
+    ApplyScheduledGates();
+    ApplyPauliSumKernel(this->stateVec.data(), this->stateVec.size(), 0.0, PowerOfI(this->framePhase), masks);
+    this->framePhase = 0;
 }
 
 void StateSimulator::ApplyGate(Gate gate, Qubit target)
 {
-    // Construct unitary as Id_A ⊗ G ⊗ Id_C, split by the qubit index.
-    short qubitIndex = GetQubitIdx(target);
-    long dimA = pow(2, qubitIndex);
-    long dimC = pow(2, this->numActiveQubits-qubitIndex-1);
-    Operator unitary = Operator::Identity(dimA, dimA);
-    unitary = kroneckerProduct(unitary, gate).eval();
-    unitary = kroneckerProduct(unitary, Operator::Identity(dimC, dimC)).eval();
+    Materialize(1, &target);
+    // Apply gate with |Ψ'⟩ = (Id_A ⊗ G ⊗ Id_C)|Ψ⟩ in place, updating each pair of amplitudes differing in the target
+    // bit, once the scheduler gets to it.
+    ApplyGateUnderFrame(gate, target);
+}
 
-    // Apply gate with |Ψ'⟩ = U|Ψ⟩.
-    this->stateVec = unitary*this->stateVec;
+void StateSimulator::ApplyGateUnderFrame(Gate gate, Qubit target, uint64_t controlMask)
+{
+    ApplyPendingDiagonal();
+    if (this->scheduledGates.Full())
+        ApplyScheduledGates();
+    this->scheduledGates.Add(gate, GetQubitMask(target), controlMask);
 }
 
 void StateSimulator::ApplyControlledGate(Gate gate, long numControls, Qubit controls[], Qubit target)
 {
+    this->operationQubits.assign(controls, controls + numControls);
+    this->operationQubits.push_back(target);
+    Materialize(this->operationQubits.size(), this->operationQubits.data());
     // Controlled unitary on a bipartite system A⊗B can be expressed as:
-    //     cU = (|0⟩〈0| ⊗ 1) + (|1⟩〈1| ⊗ U)    if control on A
-    //     cU = (1 ⊗ |0⟩〈0|) + (U ⊗ |1⟩〈1|)    if control on B
-    // Thus, the full unitary will be built starting from target in both directions
-    // to handle controls coming both before and after the target.
-    short targetIndex = GetQubitIdx(target);
-    std::vector<short> preTargetIndices, postTargetIndices;
-    for (int i = 0; i < numControls; i++) {
-        short idx = GetQubitIdx(controls[i]);
-        if (idx < targetIndex)
-            preTargetIndices.push_back(idx);
-        else
-            postTargetIndices.push_back(idx);
+    //     cU = (|0⟩〈0| ⊗ 1) + (|1⟩〈1| ⊗ U)    if control on A
+    // so only the pairs of amplitudes with all control bits set are updated. These are enumerated directly by
+    // scattering a counter into the free bits, so the work scales with the 2^(n-c) states of the subspace.
+    ApplyGateUnderFrame(gate, target, GetControlMask(numControls, controls));
+}
+
+void StateSimulator::BuildNoiseChannels()
+{
+    this->noiseChannels.clear();
+    for (const char* operation : NoiseModel::OPERATIONS) {
+        std::vector<KrausChannel> channels;
+        for (const NoiseEntry& entry : this->noise.ChannelsFor(operation)) {
+            KrausChannel channel = {NoiseModel::KrausOperators(entry), false};
+            for (const Gate& k : channel.operators) {
+                Gate kdagk = k.adjoint() * k;
+                channel.stateDependent |= !(kdagk - kdagk(0,0)*Gate::Identity()).isZero(TOLERANCE);
+            }
+            channels.push_back(std::move(channel));
+        }
+        if (!channels.empty())
+            this->noiseChannels.emplace(operation, std::move(channels));
     }
-    sort(preTargetIndices.begin(), preTargetIndices.end());
-    sort(postTargetIndices.begin(), postTargetIndices.end());
-
-    long dimU = 2;
-    Operator unitary = gate;
-    Operator project0 = (Operator(2,2) << 1,0,0,0).finished();
-    Operator project1 = (Operator(2,2) << 0,0,0,1).finished();
-    // Build up unitary from target to last qubit.
-    auto controlItFw = postTargetIndices.begin();
-    for (int i = targetIndex+1; i < this->numActiveQubits; i++) {
-        if (controlItFw != postTargetIndices.end() && i == *controlItFw) {
-            unitary = (kroneckerProduct(Operator::Identity(dimU, dimU), project0) // 1 ⊗ |0⟩〈0|
-                      +kroneckerProduct(unitary, project1)).eval();               // U ⊗ |1⟩〈1|
-            controlItFw++;
-        } else {
-            unitary = kroneckerProduct(unitary, Operator::Identity(2,2)).eval();
+}
+
+void StateSimulator::ApplyNoise(const std::string& name, Qubit q)
+{
+    if (this->noise.IsEmpty())
+        return;
+
+    // Kraus operator K_i is selected with probability p_i = 〈Ψ|K_i^† K_i|Ψ⟩, and the state becomes K_i|Ψ⟩/√p_i.
+    // For mixtures of unitaries (depolarizing, dephasing) K_i^† K_i ∝ 1, so p_i does not depend on the state.
+    // Otherwise p_i = tr(K_i^† K_i ρ_q) is computed from the reduced density matrix ρ_q of the qubit.
+    auto channels = this->noiseChannels.find(name);
+    if (channels == this->noiseChannels.end())
+        return;
+    Reinstate(1, &q);
+    Materialize(1, &q);
+    for (const KrausChannel& channel : channels->second) {
+        const std::vector<Gate>& kraus = channel.operators;
+        Gate reduced = Gate::Identity() / 2;
+        if (channel.stateDependent) {
+            ApplyScheduledGates();
+            const uint64_t mask = GetQubitMask(q);
+            const std::complex<double>* psi = this->stateVec.data();
+            auto index0 = [mask](long k) { return ((k & ~(mask - 1)) << 1) | (k & (mask - 1)); };
+            std::complex<double> norms = DeterministicComplexSum(this->stateVec.size() / 2, [=](long k) {
+                return std::complex<double>(std::norm(psi[index0(k)]), std::norm(psi[index0(k) | mask]));
+            });
+            reduced(0,0) = norms.real();
+            reduced(1,1) = norms.imag();
+            reduced(0,1) = DeterministicComplexSum(this->stateVec.size() / 2, [=](long k) {
+                return psi[index0(k)] * std::conj(psi[index0(k) | mask]);
+            });
+            reduced(1,0) = std::conj(reduced(0,1));
         }
-        dimU *= 2;
+
+        // Without a selection by rounding, the last operator is taken, whose probability is the last one computed.
+        double random0to1 = this->rng.NextDouble(), cumulative = 0.0, probability = 0.0;
+        size_t selected = kraus.size() - 1;
+        for (size_t i = 0; i < kraus.size(); i++) {
+            probability = real((kraus[i].adjoint() * kraus[i] * reduced).trace());
+            cumulative += probability;
+            if (random0to1 < cumulative) {
+                selected = i;
+                break;
+            }
+        }
+
+        // Operators proportional to the identity leave the normalized state unchanged.
+        const Gate& k = kraus[selected];
+        if ((k - k(0,0)*Gate::Identity()).isZero(TOLERANCE))
+            continue;
+        ApplyGate(k / sqrt(probability), q);
+    }
+}
+
+void StateSimulator::ApplyNoise(const std::string& name, long numControls, Qubit controls[], Qubit target)
+{
+    for (long i = 0; i < numControls; i++)
+        ApplyNoise(name, controls[i]);
+    ApplyNoise(name, target);
+}
+
+
+///
+/// Pauli frame
+///
+
+bool StateSimulator::AnticommutesWithFrame(long numTargets, const PauliId paulis[], const Qubit targets[])
+{
+    // X anticommutes with Z and Z with X, so P_j does with X^x Z^z iff it has an X part and z is set, or vice versa.
+    bool anticommutes = false;
+    for (long i = 0; i < numTargets; i++) {
+        uint8_t frame = this->pauliFrame[GetQubitIdx(targets[i])];
+        bool hasX = paulis[i] == PauliId_X || paulis[i] == PauliId_Y;
+        bool hasZ = paulis[i] == PauliId_Z || paulis[i] == PauliId_Y;
+        anticommutes ^= (hasX && (frame & FRAME_Z)) != (hasZ && (frame & FRAME_X));
+    }
+    return anticommutes;
+}
+
+void StateSimulator::MultiplyFrame(PauliId pauli, Qubit q)
+{
+    // X X^x Z^z = X^(x+1) Z^z, Z X^x Z^z = (-1)^x X^x Z^(z+1), and Y = iXZ.
+    uint8_t& frame = this->pauliFrame[GetQubitIdx(q)];
+    if (pauli == PauliId_Z || pauli == PauliId_Y) {
+        this->framePhase += (frame & FRAME_X) ? 2 : 0;
+        frame ^= FRAME_Z;
     }
-    // Build up the unitary from target to first qubit.
-    auto controlItBw = preTargetIndices.rbegin();
-    for (int i = targetIndex-1; i >= 0; i--) {
-        if (controlItBw != preTargetIndices.rend() && i == *controlItBw) {
-            unitary = (kroneckerProduct(project0, Operator::Identity(dimU, dimU)) // |0⟩〈0| ⊗ 1
-                      +kroneckerProduct(project1, unitary)).eval();               // |1⟩〈1| ⊗ U
-            controlItBw++;
-        } else {
-            unitary = kroneckerProduct(Operator::Identity(2,2), unitary).eval();
+    if (pauli == PauliId_X || pauli == PauliId_Y)
+        frame ^= FRAME_X;
+    if (pauli == PauliId_Y)
+        this->framePhase += 1;
+    this->framePhase %= 4;
+}
+
+void StateSimulator::ConjugateFrameH(Qubit q)
+{
+    // H X^x Z^z H = Z^x X^z = (-1)^xz X^z Z^x
+    uint8_t& frame = this->pauliFrame[GetQubitIdx(q)];
+    if (frame == (FRAME_X | FRAME_Z))
+        this->framePhase = (this->framePhase + 2) % 4;
+    else if (frame != 0)
+        frame ^= FRAME_X | FRAME_Z;
+}
+
+void StateSimulator::ConjugateFrameCnot(Qubit control, Qubit target)
+{
+    // X on the control spreads to the target, Z on the target spreads to the control.
+    uint8_t& c = this->pauliFrame[GetQubitIdx(control)];
+    uint8_t& t = this->pauliFrame[GetQubitIdx(target)];
+    if (c & FRAME_X)
+        t ^= FRAME_X;
+    if (t & FRAME_Z)
+        c ^= FRAME_Z;
+}
+
+
+
+///
+/// Diagonal gates
+///
+
+void StateSimulator::AddDiagonal(std::complex<double> phase0, std::complex<double> phase1, long numControls,
+                                 const Qubit controls[], long numZ, const Qubit z[])
+{
+    DiagonalTerm term;
+    term.controlMask = term.controlValue = GetControlMask(numControls, controls);
+    term.z = GetControlMask(numZ, z);
+    term.phase0 = phase0;
+    term.phase1 = phase1;
+
+    // The term acts beneath the Pauli frame, F^† D F. With X on a qubit, its control turns into a control on |0⟩,
+    // and the parity of the z qubits flips, exchanging the two phases. Z in the frame commutes with D.
+    uint64_t frameX = 0;
+    for (short j = 0; j < this->numActiveQubits; j++) {
+        if (this->pauliFrame[j] & FRAME_X)
+            frameX |= uint64_t(1) << (this->numActiveQubits - 1 - j);
+    }
+    term.controlValue ^= frameX & term.controlMask;
+    if (Parity(frameX & term.z))
+        std::swap(term.phase0, term.phase1);
+
+    for (DiagonalTerm& pending : this->diagonalTerms) {
+        if (pending.controlMask == term.controlMask && pending.controlValue == term.controlValue && pending.z == term.z) {
+            pending.phase0 *= term.phase0;
+            pending.phase1 *= term.phase1;
+            return;
+        }
+    }
+    if (this->diagonalTerms.size() == MAX_DIAGONAL_TERMS)
+        ApplyPendingDiagonal();
+    this->diagonalTerms.push_back(term);
+}
+
+bool StateSimulator::ConjugateDiagonalCnot(Qubit control, Qubit target)
+{
+    // CNOT flips the target bit where the control bit is set, so the parity over z gains the control bit if z
+    // contains the target. A control on the target bit would become a condition on the XOR of two bits.
+    const uint64_t controlBit = GetQubitMask(control), targetBit = GetQubitMask(target);
+    for (const DiagonalTerm& term : this->diagonalTerms) {
+        if (term.controlMask & targetBit)
+            return false;
+    }
+    for (DiagonalTerm& term : this->diagonalTerms) {
+        if (term.z & targetBit)
+            term.z ^= controlBit;
+    }
+    return true;
+}
+
+
+///
+/// Factored-out qubits
+///
+
+void StateSimulator::BeginOperation(long numQubits, const Qubit qubits[])
+{
+    if (++this->numOperations % DISENTANGLE_INTERVAL == 0)
+        FactorOutBasisQubits();
+    Reinstate(numQubits, qubits);
+}
+
+void StateSimulator::BeginOperation(long numControls, const Qubit controls[], Qubit target)
+{
+    BeginOperation(numControls, controls);
+    Reinstate(1, &target);
+}
+
+long StateSimulator::FindClassical(Qubit q) const
+{
+    for (size_t k = 0; k < this->classicalQubits.size(); k++) {
+        if (this->classicalQubits[k].first == q)
+            return k;
+    }
+    return -1;
+}
+
+void StateSimulator::FactorOut(Qubit q, bool value)
+{
+    // Beneath its frame X^x Z^z, the qubit is |v⟩, so it is |v⊕x⟩ up to the global phase (-1)^(vz).
+    const uint8_t frame = this->pauliFrame[GetQubitIdx(q)];
+    if (value && (frame & FRAME_Z))
+        this->framePhase = (this->framePhase + 2) % 4;
+    RemoveFromRegister(q);
+    this->classicalQubits.push_back({q, value != bool(frame & FRAME_X)});
+}
+
+void StateSimulator::FactorOutBasisQubits()
+{
+    if (!this->noise.IsEmpty() || this->numActiveQubits == 0)
+        return;
+
+    // A qubit is in a basis state iff its bit has the same value in all basis states with a non-zero amplitude,
+    // found in one read-only pass by collecting the bits set and the bits cleared in any of these. Pending
+    // diagonal gates and the frame do not change which amplitudes are zero.
+    ApplyPendingCnots();
+    const std::complex<double>* psi = this->stateVec.data();
+    const long size = static_cast<long>(this->stateVec.size());
+    uint64_t ones = 0, zeros = 0;
+    #pragma omp parallel for reduction(|:ones, zeros) if(size > 4096)
+    for (long b = 0; b < size; b++) {
+        if (std::norm(psi[b]) > BASIS_STATE_CUTOFF) {
+            ones |= b;
+            zeros |= ~b;
         }
-        dimU *= 2;
     }
 
-    // Apply gate with |Ψ'⟩ = U|Ψ⟩.
-    this->stateVec = unitary*this->stateVec;
+    this->basisQubits.clear();
+    for (Qubit q : this->computeRegister) {
+        const uint64_t mask = GetQubitMask(q);
+        if ((ones ^ zeros) & mask)
+            this->basisQubits.push_back({q, (ones & mask) != 0});
+    }
+    for (const auto& entry : this->basisQubits)
+        FactorOut(entry.first, entry.second);
+}
+
+void StateSimulator::Reinstate(long numQubits, const Qubit qubits[])
+{
+    if (this->classicalQubits.empty())
+        return;
+
+    // The budget is checked for all qubits to bring back before any of them leaves `classicalQubits`, so that a
+    // failing operation loses none of them.
+    long numReinstated = 0;
+    for (long i = 0; i < numQubits; i++) {
+        if (FindClassical(qubits[i]) >= 0 && std::find(qubits, qubits + i, qubits[i]) == qubits + i)
+            numReinstated++;
+    }
+    if (numReinstated == 0)
+        return;
+    CheckMemoryBudget(this->numActiveQubits + numReinstated);
+
+    for (long i = 0; i < numQubits && !this->classicalQubits.empty(); i++) {
+        long k = FindClassical(qubits[i]);
+        if (k < 0)
+            continue;
+        // The qubit returns as |0⟩ in the lowest bit, and |1⟩ = X|0⟩ only takes an X in its frame.
+        const bool value = this->classicalQubits[k].second;
+        this->classicalQubits.erase(this->classicalQubits.begin() + k);
+        AddToRegister(qubits[i]);
+        if (value)
+            this->pauliFrame.back() = FRAME_X;
+    }
+}
+
+bool StateSimulator::MultiplyClassical(PauliId pauli, Qubit q)
+{
+    long k = FindClassical(q);
+    if (k < 0)
+        return false;
+    // X|v⟩ = |v⊕1⟩, Z|v⟩ = (-1)^v |v⟩ and Y|v⟩ = i(-1)^v |v⊕1⟩.
+    bool& value = this->classicalQubits[k].second;
+    if (pauli == PauliId_Z || pauli == PauliId_Y)
+        this->framePhase += value ? 2 : 0;
+    if (pauli == PauliId_Y)
+        this->framePhase += 1;
+    if (pauli == PauliId_X || pauli == PauliId_Y)
+        value = !value;
+    this->framePhase %= 4;
+    return true;
 }
 
 
@@ -156,172 +612,384 @@ void StateSimulator::ApplyControlledGate(Gate gate, long numControls, Qubit cont
 
 void StateSimulator::X(Qubit q)
 {
-    Gate x; x << 0, 1,
-                 1, 0;
-    ApplyGate(x, q);
+    if (!MultiplyClassical(PauliId_X, q))
+        MultiplyFrame(PauliId_X, q);
+    ApplyNoise("X", q);
 }
 
 void StateSimulator::ControlledX(long numControls, Qubit controls[], Qubit target)
 {
+    BeginOperation(numControls, controls, target);
+    // Without noise, CNOTs are held back until they either form a SWAP, CNOT(a,b) CNOT(b,a) CNOT(a,b), which is
+    // then applied by relabeling, or cancel out, CNOT(a,b) CNOT(a,b) = 1. Anything else applies them as usual.
+    // The Pauli frame and the pending diagonal gates are conjugated as each CNOT arrives, while the state vector
+    // only receives the pending CNOTs later, underneath both.
+    if (numControls == 1 && this->noise.IsEmpty()) {
+        ConjugateFrameCnot(controls[0], target);
+        if (!ConjugateDiagonalCnot(controls[0], target))
+            ApplyPendingDiagonal();
+        std::pair<Qubit, Qubit> cnot = {controls[0], target}, reversed = {target, controls[0]};
+        if (this->numPendingCnots == 1 && cnot == this->pendingCnots[0]) {
+            this->numPendingCnots = 0;
+            return;
+        }
+        if (this->numPendingCnots == 1 && reversed == this->pendingCnots[0]) {
+            this->pendingCnots[this->numPendingCnots++] = cnot;
+            return;
+        }
+        if (this->numPendingCnots == 2 && cnot == this->pendingCnots[1]) {
+            this->numPendingCnots = 1;
+            return;
+        }
+        if (this->numPendingCnots == 2 && cnot == this->pendingCnots[0]) {
+            // The three CNOTs have already exchanged the frames and diagonal terms of the two qubits, which the
+            // relabeling would do again.
+            this->numPendingCnots = 0;
+            std::swap(this->pauliFrame[GetQubitIdx(controls[0])], this->pauliFrame[GetQubitIdx(target)]);
+            const uint64_t swapped = GetQubitMask(controls[0]) | GetQubitMask(target);
+            for (DiagonalTerm& term : this->diagonalTerms) {
+                for (uint64_t* mask : {&term.controlMask, &term.controlValue, &term.z}) {
+                    if (Parity(*mask & swapped))
+                        *mask ^= swapped;
+                }
+            }
+            Relabel(controls[0], target);
+            return;
+        }
+        SchedulePendingCnots();
+        this->pendingCnots[this->numPendingCnots++] = cnot;
+        return;
+    }
+
     Gate x; x << 0, 1,
                  1, 0;
     ApplyControlledGate(x, numControls, controls, target);
+    ApplyNoise("X", numControls, controls, target);
 }
 
 void StateSimulator::Y(Qubit q)
 {
-    Gate y; y <<  0,-1i,
-                 1i,  0;
-    ApplyGate(y, q);
+    if (!MultiplyClassical(PauliId_Y, q))
+        MultiplyFrame(PauliId_Y, q);
+    ApplyNoise("Y", q);
 }
 
 void StateSimulator::ControlledY(long numControls, Qubit controls[], Qubit target)
 {
+    BeginOperation(numControls, controls, target);
     Gate y; y <<  0,-1i,
                  1i,  0;
     ApplyControlledGate(y, numControls, controls, target);
+    ApplyNoise("Y", numControls, controls, target);
 }
 
 void StateSimulator::Z(Qubit q)
 {
-    Gate z; z << 1, 0,
-                 0,-1;
-    ApplyGate(z, q);
+    if (!MultiplyClassical(PauliId_Z, q))
+        MultiplyFrame(PauliId_Z, q);
+    ApplyNoise("Z", q);
 }
 
 void StateSimulator::ControlledZ(long numControls, Qubit controls[], Qubit target)
 {
-    Gate z; z << 1, 0,
-                 0,-1;
-    ApplyControlledGate(z, numControls, controls, target);
+    BeginOperation(numControls, controls, target);
+    AddDiagonal(1.0, -1.0, numControls, controls, 1, &target);
+    ApplyNoise("Z", numControls, controls, target);
 }
 
 void StateSimulator::H(Qubit q)
 {
+    BeginOperation(1, &q);
     Gate h; h << 1, 1,
                  1,-1;
     h = h / sqrt(2);
-    ApplyGate(h, q);
+    ConjugateFrameH(q);
+    ApplyGateUnderFrame(h, q);
+    ApplyNoise("H", q);
 }
 
 void StateSimulator::ControlledH(long numControls, Qubit controls[], Qubit target)
 {
+    BeginOperation(numControls, controls, target);
     Gate h; h << 1, 1,
                  1,-1;
     h = h / sqrt(2);
     ApplyControlledGate(h, numControls, controls, target);
+    ApplyNoise("H", numControls, controls, target);
 }
 
 void StateSimulator::S(Qubit q)
 {
-    Gate s; s << 1,  0,
-                 0, 1i;
-    ApplyGate(s, q);
+    BeginOperation(1, &q);
+    AddDiagonal(1.0, 1i, 0, nullptr, 1, &q);
+    ApplyNoise("S", q);
 }
 
 void StateSimulator::ControlledS(long numControls, Qubit controls[], Qubit target)
 {
-    Gate s; s << 1,  0,
-                 0, 1i;
-    ApplyControlledGate(s, numControls, controls, target);
+    BeginOperation(numControls, controls, target);
+    AddDiagonal(1.0, 1i, numControls, controls, 1, &target);
+    ApplyNoise("S", numControls, controls, target);
 }
 
 void StateSimulator::AdjointS(Qubit q)
 {
-    Gate sdag; sdag << 1,  0,
-                       0,-1i;
-    ApplyGate(sdag, q);
+    BeginOperation(1, &q);
+    AddDiagonal(1.0, -1i, 0, nullptr, 1, &q);
+    ApplyNoise("Sdag", q);
 }
 
 void StateSimulator::ControlledAdjointS(long numControls, Qubit controls[], Qubit target)
 {
-    Gate sdag; sdag << 1,  0,
-                       0,-1i;
-    ApplyControlledGate(sdag, numControls, controls, target);
+    BeginOperation(numControls, controls, target);
+    AddDiagonal(1.0, -1i, numControls, controls, 1, &target);
+    ApplyNoise("Sdag", numControls, controls, target);
 }
 
 void StateSimulator::T(Qubit q)
 {
-    Gate t; t << 1, 0,
-                 0, exp(1i*PI/4.);
-    ApplyGate(t, q);
+    BeginOperation(1, &q);
+    AddDiagonal(1.0, exp(1i*PI/4.), 0, nullptr, 1, &q);
+    ApplyNoise("T", q);
 }
 
 void StateSimulator::ControlledT(long numControls, Qubit controls[], Qubit target)
 {
-    Gate t; t << 1, 0,
-                 0, exp(1i*PI/4.);
-    ApplyControlledGate(t, numControls, controls, target);
+    BeginOperation(numControls, controls, target);
+    AddDiagonal(1.0, exp(1i*PI/4.), numControls, controls, 1, &target);
+    ApplyNoise("T", numControls, controls, target);
 }
 
 void StateSimulator::AdjointT(Qubit q)
 {
-    Gate tdag; tdag << 1, 0,
-                       0, exp(-1i*PI/4.);
-    ApplyGate(tdag, q);
+    BeginOperation(1, &q);
+    AddDiagonal(1.0, exp(-1i*PI/4.), 0, nullptr, 1, &q);
+    ApplyNoise("Tdag", q);
 }
 
 void StateSimulator::ControlledAdjointT(long numControls, Qubit controls[], Qubit target)
 {
-    Gate tdag; tdag << 1, 0,
-                       0, exp(-1i*PI/4.);
-    ApplyControlledGate(tdag, numControls, controls, target);
+    BeginOperation(numControls, controls, target);
+    AddDiagonal(1.0, exp(-1i*PI/4.), numControls, controls, 1, &target);
+    ApplyNoise("Tdag", numControls, controls, target);
 }
 
 void StateSimulator::R(PauliId axis, Qubit q, double theta)
 {
-    Gate r = (-1i*theta/2.0*SelectPauliOp(axis)).exp();
-    ApplyGate(r, q);
+    ControlledR(0, nullptr, axis, q, theta);
 }
 
 void StateSimulator::ControlledR(long numControls, Qubit controls[], PauliId axis, Qubit target, double theta)
 {
+    BeginOperation(numControls, controls, target);
+
+    // Z rotations are diagonal, diag(e^-iθ/2, e^iθ/2), and join the pending diagonal gates.
+    if (axis == PauliId_Z || axis == PauliId_I) {
+        Gate r = (-1i*theta/2.0*SelectPauliOp(axis)).exp();
+        AddDiagonal(r(0,0), r(1,1), numControls, controls, 1, &target);
+        ApplyNoise("R", numControls, controls, target);
+        return;
+    }
+
+    // Other rotations pass through the frame of their target, exp(-iθ/2 P) F = F exp(∓iθ/2 P) as F^† P F = ±P,
+    // but a frame with X on a control would flip the controlled subspace.
+    Materialize(numControls, controls);
+    if (AnticommutesWithFrame(1, &axis, &target))
+        theta = -theta;
     Gate r = (-1i*theta/2.0*SelectPauliOp(axis)).exp();
-    ApplyControlledGate(r, numControls, controls, target);
+    ApplyGateUnderFrame(r, target, GetControlMask(numControls, controls));
+    ApplyNoise("R", numControls, controls, target);
 }
 
 void StateSimulator::Exp(long numTargets, PauliId paulis[], Qubit targets[], double theta)
 {
-    Operator u = (1i*theta*BuildPauliUnitary(numTargets, paulis, targets)).exp();
-    this->stateVec = u*this->stateVec;
+    ControlledExp(0, nullptr, numTargets, paulis, targets, theta);
 }
 
 void StateSimulator::ControlledExp(long numControls, Qubit controls[], long numTargets, PauliId paulis[], Qubit targets[], double theta)
 {
-    throw std::logic_error("operation_not_supported");
+    // exp(iθP)|Ψ⟩ = cos(θ)|Ψ⟩ + i sin(θ) P|Ψ⟩, applied in place on the controlled subspace. As for R, the frame
+    // of the targets only flips the sign of θ. For a string of Z, exp(iθP)|b⟩ = e^(±iθ)|b⟩ by the parity of b.
+    BeginOperation(numControls, controls);
+    Reinstate(numTargets, targets);
+    PauliMasks masks = GetPauliMasks(numTargets, paulis, targets);
+    if (masks.x == 0) {
+        this->operationQubits.clear();
+        for (long i = 0; i < numTargets; i++) {
+            if (paulis[i] == PauliId_Z)
+                this->operationQubits.push_back(targets[i]);
+        }
+        AddDiagonal(exp(1i*theta), exp(-1i*theta), numControls, controls, this->operationQubits.size(),
+                    this->operationQubits.data());
+    } else {
+        Materialize(numControls, controls);
+        if (AnticommutesWithFrame(numTargets, paulis, targets))
+            theta = -theta;
+        ApplyScheduledGates();
+        ApplyPauliSumKernel(this->stateVec.data(), this->stateVec.size(), cos(theta), 1i*sin(theta), masks,
+                            GetControlMask(numControls, controls));
+    }
+    for (long i = 0; i < numControls; i++)
+        ApplyNoise("Exp", controls[i]);
+    for (long i = 0; i < numTargets; i++) {
+        if (paulis[i] != PauliId_I)
+            ApplyNoise("Exp", targets[i]);
+    }
+}
+
+void StateSimulator::Swap(Qubit q1, Qubit q2)
+{
+    Qubit qubits[] = {q1, q2};
+    BeginOperation(2, qubits);
+    Relabel(q1, q2);
+    ApplyNoise("Swap", q1);
+    ApplyNoise("Swap", q2);
+}
+
+void StateSimulator::Relabel(Qubit q1, Qubit q2)
+{
+    // The bit of a qubit in the basis index follows its position in the compute register, so exchanging the two
+    // entries exchanges the qubits' states without moving any amplitude. The frame stays with the positions and
+    // is thereby exchanged as well, as are the scheduled gates, which address bits.
+    SchedulePendingCnots();
+    std::swap(this->computeRegister[GetQubitIdx(q1)], this->computeRegister[GetQubitIdx(q2)]);
+}
+
+void StateSimulator::Unitary(long numTargets, Qubit targets[], const std::complex<double> matrix[])
+{
+    ControlledUnitary(0, nullptr, numTargets, targets, matrix);
+}
+
+void StateSimulator::ControlledUnitary(long numControls, Qubit controls[], long numTargets, Qubit targets[], const std::complex<double> matrix[])
+{
+    this->operationQubits.assign(controls, controls + numControls);
+    this->operationQubits.insert(this->operationQubits.end(), targets, targets + numTargets);
+    BeginOperation(this->operationQubits.size(), this->operationQubits.data());
+    Materialize(this->operationQubits.size(), this->operationQubits.data());
+    ApplyScheduledGates();
+    // The whole block is applied in one pass over the (controlled subspace of the) state.
+    this->operationMasks.clear();
+    for (long i = 0; i < numTargets; i++)
+        this->operationMasks.push_back(GetQubitMask(targets[i]));
+    ApplyUnitaryKernel(this->stateVec.data(), this->stateVec.size(), matrix, numTargets, this->operationMasks.data(),
+                       GetControlMask(numControls, controls));
+    ApplyNoise("Unitary", numControls, controls, targets[0]);
+    for (long i = 1; i < numTargets; i++)
+        ApplyNoise("Unitary", targets[i]);
 }
 
 Result StateSimulator::Measure(long numBases, PauliId bases[], long numTargets, Qubit targets[])
 {
     assert(numBases == numTargets);
-    short dim = this->numActiveQubits;
+    // A factored-out qubit yields its value, still taking a random number, such that the random sequence does not
+    // depend on which qubits happen to be factored out.
+    const bool singleZ = numTargets == 1 && bases[0] == PauliId_Z;
+    if (singleZ && this->noise.IsEmpty() && FindClassical(targets[0]) >= 0) {
+        this->rng.NextDouble();
+        return this->classicalQubits[FindClassical(targets[0])].second ? UseOne() : UseZero();
+    }
+    BeginOperation(numTargets, targets);
+    ApplyPendingCnots();
+
+    // Measurement errors act on the measured qubits beforehand. Their Kraus operators are scheduled like any gate,
+    // so the schedule is run before the state vector is read.
+    for (long i = 0; i < numTargets; i++)
+        ApplyNoise("Measure", targets[i]);
+    ApplyScheduledGates();
 
     // Projection operators P_+- for Pauli measurements {P_i}:
     //     P_+- = (1 +- P_1⊗P_2⊗..⊗P_n)/2
-    Operator paulis = BuildPauliUnitary(numTargets, bases, targets);
-    Operator p_projector = (Operator::Identity(dim, dim) + paulis)/2;
-    Operator m_projector = (Operator::Identity(dim, dim) - paulis)/2;
-
-    // Probability of getting outcome Zero is p(+) = 〈Ψ|P_+|Ψ⟩.
-    double probZero = real(this->stateVec.conjugate().dot(p_projector*this->stateVec));
+    // Probability of getting outcome Zero is p(+) = 〈Ψ|P_+|Ψ⟩ = (1 + 〈Ψ|P|Ψ⟩)/2.
+    // Under the Pauli frame F, 〈Ψ|F^† P F|Ψ⟩ = ±〈Ψ|P|Ψ⟩, and the projector P_+- of the actual state is P_-+ on
+    // the state vector if P anticommutes with F, so the frame only swaps the roles of the outcomes.
+    // Pending diagonal gates commute with measurements of Z strings and are kept back for these.
+    PauliMasks masks = GetPauliMasks(numTargets, bases, targets);
+    if (masks.x != 0)
+        ApplyPendingDiagonal();
+    double sign = AnticommutesWithFrame(numTargets, bases, targets) ? -1.0 : 1.0;
+    double probZero = std::min(1.0, std::max(0.0, (1 + sign * PauliExpectation(masks)) / 2));
 
     // Select measurement outcome via PRNG.
-    double random0to1 = (double) rand() / (RAND_MAX);
+    double random0to1 = this->rng.NextDouble();
     Result outcome = random0to1 < probZero ? UseZero() : UseOne();
 
-    // Update state vector with |Ψ'⟩ = 1/√p(m) P_m|Ψ⟩.
-    if (outcome == UseZero())
-        this->stateVec = (p_projector * this->stateVec)/sqrt(probZero);
-    else
-        this->stateVec = (m_projector * this->stateVec)/sqrt(1-probZero);
+    // Update state vector with |Ψ'⟩ = 1/√p(m) P_m|Ψ⟩, applying the projector in place.
+    double prob = (outcome == UseZero()) ? probZero : 1 - probZero;
+    double scale = 1 / (2 * sqrt(prob));
+    ApplyPauliSumKernel(this->stateVec.data(), this->stateVec.size(), scale, (outcome == UseZero()) ? sign * scale : -sign * scale, masks);
 
+    // A qubit measured on its own is left in a basis state, which is |outcome⟩ beneath the X of its frame.
+    if (singleZ && this->noise.IsEmpty())
+        FactorOut(targets[0], (outcome == UseOne()) != bool(this->pauliFrame[GetQubitIdx(targets[0])] & FRAME_X));
     return outcome;
 }
 
+PauliMasks StateSimulator::GetPauliMasks(long numTargets, const PauliId paulis[], const Qubit targets[])
+{
+    PauliMasks masks;
+    for (long i = 0; i < numTargets; i++) {
+        uint64_t mask = GetQubitMask(targets[i]);
+        if (paulis[i] == PauliId_X || paulis[i] == PauliId_Y)
+            masks.x |= mask;
+        if (paulis[i] == PauliId_Z || paulis[i] == PauliId_Y)
+            masks.z |= mask;
+        if (paulis[i] == PauliId_Y)
+            masks.phase *= 1i;
+    }
+    return masks;
+}
+
+double StateSimulator::PauliExpectation(const PauliMasks& masks) const
+{
+    return real(masks.phase * ParityOverlapKernel(this->stateVec.data(), this->stateVec.size(), masks.x, masks.z));
+}
+
+double StateSimulator::ExpectationValue(const std::vector<PauliTerm>& terms)
+{
+    for (const PauliTerm& term : terms)
+        Reinstate(term.targets.size(), term.targets.data());
+    ApplyPendingCnots();
+    // Terms with the same x mask pair up the same amplitudes, 〈Ψ|P_j|Ψ⟩ = phase_j Σ_b (-1)^|b∧z_j| conj(ψ(b⊕x)) ψ(b).
+    // Summing over the group first gives one weight per basis state, w(b) = Σ_j c_j phase_j (-1)^|b∧z_j|,
+    // and the group contributes Re Σ_b w(b) conj(ψ(b⊕x)) ψ(b).
+    this->expectationTerms.clear();
+    for (const PauliTerm& term : terms) {
+        assert(term.paulis.size() == term.targets.size());
+        PauliMasks masks = GetPauliMasks(term.paulis.size(), term.paulis.data(), term.targets.data());
+        double sign = AnticommutesWithFrame(term.paulis.size(), term.paulis.data(), term.targets.data()) ? -1.0 : 1.0;
+        this->expectationTerms.push_back({masks.x, masks.z, sign * term.coefficient * masks.phase,
+                                          this->expectationTerms.size()});
+    }
+    std::sort(this->expectationTerms.begin(), this->expectationTerms.end(),
+              [](const ExpectationTerm& a, const ExpectationTerm& b) {
+                  return a.x != b.x ? a.x < b.x : a.order < b.order;
+    });
+
+    if (!this->expectationTerms.empty() && this->expectationTerms.back().x != 0)
+        ApplyPendingDiagonal();
+
+    double expectation = 0.0;
+    long size = this->stateVec.size();
+    for (auto group = this->expectationTerms.begin(); group != this->expectationTerms.end();) {
+        const uint64_t x = group->x;
+        auto groupEnd = std::find_if(group, this->expectationTerms.end(), [x](const ExpectationTerm& t) { return t.x != x; });
+        const std::complex<double>* psi = this->stateVec.data();
+        expectation += DeterministicSum(size, [&](long b) {
+            std::complex<double> w = 0.0;
+            for (auto term = group; term != groupEnd; ++term)
+                w += Parity(b & term->z) ? -term->weight : term->weight;
+            return real(w * std::conj(psi[b ^ x]) * psi[b]);
+        });
+        group = groupEnd;
+    }
+    return expectation;
+}
+
 Operator StateSimulator::BuildPauliUnitary(long numTargets, PauliId paulis[], Qubit targets[])
 {
     // Sort pauli matrices by the target qubit's index in the compute register.
-    std::vector<std::pair<short, PauliId>> sortedTargetBase(numTargets);
+    std::vector<std::pair<short, PauliId>> sortedTargetBase;
+    sortedTargetBase.reserve(numTargets);
     for (int i = 0; i < numTargets; i++)
         sortedTargetBase.push_back({GetQubitIdx(targets[i]), paulis[i]});
     std::sort(sortedTargetBase.begin(), sortedTargetBase.end(),
@@ -331,7 +999,7 @@ Operator StateSimulator::BuildPauliUnitary(long numTargets, PauliId paulis[], Qu
 
     Operator pauliUnitary = Operator::Ones(1,1);
     for (int i = 0, targetIdx = 0; i < this->numActiveQubits; i++) {
-        Pauli p_i = SelectPauliOp(i == sortedTargetBase[targetIdx].first ?
+        Pauli p_i = SelectPauliOp(targetIdx < numTargets && i == sortedTargetBase[targetIdx].first ?
                                   sortedTargetBase[targetIdx++].second :
                                   PauliId_I);
         pauliUnitary = kroneckerProduct(pauliUnitary, p_i).eval();
@@ -1,15 +1,27 @@
 // Copyright (c) Microsoft Corporation. All rights reserved.
 // Licensed under the MIT License.
 
+#pragma once
+
+#include <array>
+#include <complex>
+#include <cstdint>
 #include <cstdlib>
 #include <vector>
 #include <algorithm>
 #include <string>
+#include <unordered_map>
+#include <utility>
 
 #include "QirRuntimeApi_I.hpp"
 #include "QSharpSimApi_I.hpp"
+#include "../ExtendedGateSet_I.hpp"
 
+#include "GateScheduler.hpp"
 #include "QubitManager.hpp"
+#include "NoiseModel.hpp"
+#include "RandomGenerator.hpp"
+#include "StateKernels.hpp"
 
 #include "Eigen/Dense"
 
@@ -22,29 +34,210 @@ namespace Microsoft
 {
 namespace Quantum
 {
-    class StateSimulator : public IRuntimeDriver, public IQuantumGateSet
+    // Output settings of `DumpMachine` and `DumpRegister`.
+    struct DumpOptions
+    {
+        // Write the compact binary format described in Diagnostics.cpp instead of text (files only).
+        bool binary = false;
+        // Only basis states with an amplitude magnitude above the cutoff are listed.
+        double cutoff = 0.0;
+        // If positive, only the given number of basis states with the largest magnitudes are listed.
+        long topK = 0;
+    };
+
+    // A weighted Pauli string c·(P_1⊗P_2⊗..⊗P_k) on the given qubits, e.g. one term of a Hamiltonian.
+    struct PauliTerm
+    {
+        double coefficient;
+        std::vector<PauliId> paulis;
+        std::vector<Qubit> targets;
+    };
+
+    class StateSimulator : public IRuntimeDriver, public IQuantumGateSet, public IDiagnostics, public IExtendedGateSet
     {
         // Associated qubit manager instance to handle qubit representation.
         CQubitManager *qbm;
 
-        // The register of currently active qubits.
+        // The register of currently active qubits. Swaps exchange entries of the register, which otherwise keeps the
+        // order in which the qubits were allocated, as does `allocationOrder` in any case.
         short numActiveQubits = 0;
         std::vector<Qubit> computeRegister;
+        std::vector<Qubit> allocationOrder;
 
         // The state of the compute register is represented by its full 2^n column vector of probability amplitudes.
-        // With no qubits allocated, the state vector starts out as the scalar 1.
-        State stateVec = State::Ones(1);
+        // With no qubits allocated, the state vector starts out as the scalar 1. The amplitudes live at the front of
+        // a buffer that only ever grows, so that qubits can be added and removed in place and a simulator that is
+        // reset between runs does not allocate again. The buffer is zero beyond the current state.
+        std::vector<std::complex<double>> amplitudeBuffer = {1.0};
+        Eigen::Map<State> stateVec{this->amplitudeBuffer.data(), 1};
+
+        // Per-simulator PRNG used to sample measurement outcomes and noise.
+        RandomGenerator rng;
+
+        // Noise channels inserted after each operation, empty for an ideal simulation.
+        NoiseModel noise;
+
+        // Kraus operators of the channels of each operation, built once when the noise model is set, so that sampling
+        // the noise of an operation allocates nothing. The probabilities of selecting the operators of a channel
+        // depend on the state unless all K_i^† K_i are proportional to the identity.
+        struct KrausChannel
+        {
+            std::vector<Gate> operators;
+            bool stateDependent;
+        };
+        std::unordered_map<std::string, std::vector<KrausChannel>> noiseChannels;
+        void BuildNoiseChannels();
+
+        DumpOptions dumpOptions;
+
+        // Upper limit on the bytes of the state vector, zero for no limit.
+        uint64_t memoryBudget = 0;
+
+        // Gates applied to the state vector so far, but not yet carried out, beneath the pending CNOTs. They are
+        // run in stages by their dependencies once the amplitudes are needed, see `GateScheduler`.
+        GateScheduler scheduledGates;
+
+        // CNOTs held back to recognize a SWAP written as CNOT(a,b) CNOT(b,a) CNOT(a,b), stored as (control, target).
+        std::array<std::pair<Qubit, Qubit>, 2> pendingCnots;
+        short numPendingCnots = 0;
+
+        // Pauli frame: the state of the compute register is i^framePhase F D|Ψ⟩, with |Ψ⟩ the state vector (after
+        // the scheduled gates and pending CNOTs), D the pending diagonal operator below, and F = Π_j X_j^x Z_j^z
+        // given by one FRAME_X/FRAME_Z entry per position j of the compute register. Pauli gates only multiply into
+        // the frame and H and CNOT conjugate it, so that the Pauli layers of teleportation or error correction
+        // circuits cost no pass over the state. The frame of a qubit is applied to the state vector once a non-diagonal,
+        // non-Clifford operation acts on it, and folded into the sign of measured and rotated Pauli products otherwise.
+        static constexpr uint8_t FRAME_X = 1, FRAME_Z = 2;
+        std::vector<uint8_t> pauliFrame;
+        short framePhase = 0;
+
+        // Diagonal gates held back as a product of phase terms over the positions of the compute register, until
+        // a non-diagonal operation arrives. A QFT layer of controlled phases thereby costs one pass over the state
+        // instead of one per gate. Terms on the same bits are merged, and the product is applied once it reaches
+        // MAX_DIAGONAL_TERMS different terms, as every term adds to the work per amplitude.
+        static constexpr size_t MAX_DIAGONAL_TERMS = 64;
+        std::vector<DiagonalTerm> diagonalTerms;
+
+        // Qubits in a basis state, found after a Z measurement or by a check every DISENTANGLE_INTERVAL operations,
+        // are factored out of the state vector and only tracked by their value, halving the state for each of them.
+        // Pauli gates and Z measurements on such a qubit stay classical, and releasing it costs nothing. Any other
+        // operation brings it back into the state vector. Amplitudes with a squared magnitude below
+        // BASIS_STATE_CUTOFF count as zero, and qubits are only factored out without noise.
+        static constexpr uint64_t DISENTANGLE_INTERVAL = 256;
+        static constexpr double BASIS_STATE_CUTOFF = 1e-20;
+        std::vector<std::pair<Qubit, bool>> classicalQubits;
+        uint64_t numOperations = 0;
+
+        // Scratch space of single operations, kept between them such that repeated runs allocate no further memory.
+        // Terms of `ExpectationValue` are sorted by their x mask and then by their `order` among the terms.
+        struct ExpectationTerm
+        {
+            uint64_t x, z;
+            std::complex<double> weight;
+            size_t order;
+        };
+        std::vector<Qubit> operationQubits;
+        std::vector<uint64_t> operationMasks;
+        std::vector<Qubit> flushedQubits;
+        std::vector<std::pair<Qubit, bool>> basisQubits;
+        std::vector<ExpectationTerm> expectationTerms;
+
+        // Bytes of the state vector of the given number of qubits, saturating where 64 bits no longer suffice.
+        static uint64_t StateBytes(long numQubits)
+        {
+            return numQubits < 60 ? sizeof(std::complex<double>) << numQubits : UINT64_MAX;
+        }
+
+        // Throws if the state vector of the given number of qubits exceeds the memory budget.
+        void CheckMemoryBudget(long numQubits) const;
 
         // To be called on allocation/deallocation of qubits to update the state vector.
         void UpdateState(short qubitIndex, bool remove = false);
 
-        // To be called by quantum gate set operations.
+        // Adds a qubit in |0⟩ to the compute register as the lowest bit, or removes one in a product state from it.
+        void AddToRegister(Qubit q);
+        void RemoveFromRegister(Qubit q);
+
+        // To be called at the start of an operation on the given qubits, periodically factoring out the qubits in a
+        // basis state, and bringing factored-out qubits among the given ones back into the state vector.
+        void BeginOperation(long numQubits, const Qubit qubits[]);
+        void BeginOperation(long numControls, const Qubit controls[], Qubit target);
+
+        // Index of a factored-out qubit in `classicalQubits`, or -1 for a qubit in the state vector.
+        long FindClassical(Qubit q) const;
+
+        // Factors out a qubit in the basis state |value⟩ of the state vector, beneath the Pauli frame, or all qubits
+        // found in a basis state, and brings factored-out qubits back.
+        void FactorOut(Qubit q, bool value);
+        void FactorOutBasisQubits();
+        void Reinstate(long numQubits, const Qubit qubits[]);
+
+        // Applies a Pauli gate to a factored-out qubit, returns false for a qubit in the state vector.
+        bool MultiplyClassical(PauliId pauli, Qubit q);
+
+        // Points the state vector at the first `size` amplitudes of the buffer, growing the buffer if needed.
+        void ResizeState(uint64_t size);
+
+        // Applies all operations held back so far, the scheduled gates, pending CNOTs, diagonal gates and the Pauli
+        // frame, to the state vector. To be called before the amplitudes are read or overwritten as a whole.
+        void Flush();
+
+        // Runs the scheduled gates on the state vector.
+        void ApplyScheduledGates();
+
+        // Hands the CNOTs held back so far to the scheduler.
+        void SchedulePendingCnots();
+
+        // Applies the scheduled gates and the CNOTs held back so far to the state vector.
+        void ApplyPendingCnots();
+
+        // Applies the pending CNOTs and then the pending diagonal gates to the state vector. Scheduled gates are only
+        // run if there are diagonal gates to apply.
+        void ApplyPendingDiagonal();
+
+        // Applies the pending CNOTs and diagonal gates and the Pauli frame of the given qubits to the state vector.
+        void Materialize(long numQubits, const Qubit qubits[]);
+
+        // Holds back the diagonal gate diag(phase0, phase1) on the parity of the `z` qubits, controlled on the
+        // `controls`, rewritten to act beneath the Pauli frame.
+        void AddDiagonal(std::complex<double> phase0, std::complex<double> phase1, long numControls,
+                         const Qubit controls[], long numZ, const Qubit z[]);
+
+        // Rewrites the pending diagonal gates D for a CNOT passing them, D → CNOT D CNOT, unless this leaves the
+        // form of the terms (returns false).
+        bool ConjugateDiagonalCnot(Qubit control, Qubit target);
+
+        // Whether the Pauli product P anticommutes with the Pauli frame, i.e. F^† P F = -P.
+        bool AnticommutesWithFrame(long numTargets, const PauliId paulis[], const Qubit targets[]);
+
+        // Updates the Pauli frame for a Pauli gate P, F → PF, or a Clifford gate C, F → CFC^†.
+        void MultiplyFrame(PauliId pauli, Qubit q);
+        void ConjugateFrameH(Qubit q);
+        void ConjugateFrameCnot(Qubit control, Qubit target);
+
+        // Exchanges the positions of two qubits in the compute register, see `Swap`.
+        void Relabel(Qubit q1, Qubit q2);
+
+        // To be called by quantum gate set operations, scheduling the gate. The Pauli frame of the involved qubits is
+        // materialized first.
         void ApplyGate(Gate gate, Qubit target);
         void ApplyControlledGate(Gate gate, long numControls, Qubit controls[], Qubit target);
 
+        // Schedules a gate on the state vector, after the pending diagonal gates, while leaving the Pauli frame in
+        // place once the frame has been updated for the gate.
+        void ApplyGateUnderFrame(Gate gate, Qubit target, uint64_t controlMask = 0);
+
+        // Samples one Kraus operator per noise channel of the operation on each qubit it acted on (quantum trajectories).
+        void ApplyNoise(const std::string& name, Qubit q);
+        void ApplyNoise(const std::string& name, long numControls, Qubit controls[], Qubit target);
+
         // Builds a unitary matrix over the state space made of Pauli operators.
         Operator BuildPauliUnitary(long numTargets, PauliId paulis[], Qubit targets[]);
 
+        // Expectation value 〈Ψ|P|Ψ⟩ of a Pauli product, computed in a single read-only pass over the state.
+        PauliMasks GetPauliMasks(long numTargets, const PauliId paulis[], const Qubit targets[]);
+        double PauliExpectation(const PauliMasks& masks) const;
+
         short GetQubitIdx(Qubit q)
         {
             return std::distance(
@@ -53,17 +246,91 @@ namespace Quantum
             );
         }
 
+        // Bit of the qubit in the basis index, the first qubit of the compute register being the most significant.
+        uint64_t GetQubitMask(Qubit q)
+        {
+            return uint64_t(1) << (this->numActiveQubits - 1 - GetQubitIdx(q));
+        }
+        uint64_t GetControlMask(long numControls, const Qubit controls[])
+        {
+            uint64_t mask = 0;
+            for (long i = 0; i < numControls; i++)
+                mask |= GetQubitMask(controls[i]);
+            return mask;
+        }
+
       public:
-        StateSimulator(uint32_t userProvidedSeed = 0)
+        // Simulators sharing a seed but constructed with different stream ids draw independent random sequences.
+        StateSimulator(uint32_t userProvidedSeed = 0, uint64_t streamId = 0, NoiseModel noise = NoiseModel())
+            : rng(userProvidedSeed, streamId)
+            , noise(std::move(noise))
         {
-            srand(userProvidedSeed);
             this->qbm = new CQubitManager();
+            BuildNoiseChannels();
         }
         ~StateSimulator()
         {
             delete this->qbm;
         }
 
+        // Fetch or restore the PRNG state, e.g. to reproduce a run from a given point.
+        RandomGenerator::StateType GetRngState() const
+        {
+            return this->rng.GetState();
+        }
+        void SetRngState(const RandomGenerator::StateType& state)
+        {
+            this->rng.SetState(state);
+        }
+
+        // Return to the initial state of a fresh simulator with the given seed, as if all qubits had been released,
+        // for the next run of a program. The noise model and dump options are kept, and so is the amplitude buffer,
+        // such that repeated runs of the same program allocate no further memory. With noise, the sampled Kraus
+        // operators make up gate streams not seen before, whose plans reuse the memory of evicted ones in the
+        // scheduler's cache but may still enlarge it, until the cached plans have grown to the largest streams.
+        void Reset(uint32_t userProvidedSeed = 0, uint64_t streamId = 0);
+
+        // With a noise model, each run of a program samples one trajectory of the noisy evolution.
+        void SetNoiseModel(NoiseModel model)
+        {
+            this->noise = std::move(model);
+            BuildNoiseChannels();
+        }
+
+        void SetDumpOptions(const DumpOptions& options)
+        {
+            this->dumpOptions = options;
+        }
+
+        // Limit the state vector to the given number of bytes, zero for no limit. Allocating a qubit or loading a
+        // checkpoint beyond the budget throws a runtime error before any memory is allocated, such that a run too
+        // large for its machine fails predictably rather than being killed for running out of memory.
+        void SetMemoryBudget(uint64_t bytes)
+        {
+            this->memoryBudget = bytes;
+        }
+
+        // Whether the state vector of the given number of qubits fits into the memory budget.
+        bool FitsMemoryBudget(long numQubits) const
+        {
+            return this->memoryBudget == 0 || StateBytes(numQubits) <= this->memoryBudget;
+        }
+
+        // Overwrite the amplitudes of the compute register, e.g. when taking over a run from another backend.
+        // The first qubit of the compute register corresponds to the most significant bit of the basis index.
+        void SetStateVector(const State& state);
+
+        // Exact expectation value 〈Ψ|H|Ψ⟩ of H = Σ_j c_j P_j, leaving the state untouched. Terms sharing the same
+        // X/Y qubits are evaluated together in one pass over the state, so the cost scales with the number of such
+        // groups rather than the number of terms.
+        double ExpectationValue(const std::vector<PauliTerm>& terms);
+
+        // Save the complete simulation state (amplitudes, compute register and PRNG) to a binary checkpoint, or
+        // restore one in place of the current state, e.g. to resume a long run or to fork it at some point.
+        // Restored qubits keep the ids they had when the checkpoint was taken. See StateCheckpoint.hpp for the format.
+        void SaveCheckpoint(const std::string& path);
+        void LoadCheckpoint(const std::string& path);
+
 
         ///
         /// Implementation of IRuntimeDriver
@@ -131,6 +398,16 @@ namespace Quantum
         Result Measure(long numBases, PauliId bases[], long numTargets, Qubit targets[]) override;
 
 
+        ///
+        /// Implementation of IExtendedGateSet
+        ///
+        void Swap(Qubit q1, Qubit q2) override;
+
+        void Unitary(long numTargets, Qubit targets[], const std::complex<double> matrix[]) override;
+
+        void ControlledUnitary(long numControls, Qubit controls[], long numTargets, Qubit targets[], const std::complex<double> matrix[]) override;
+
+
         ///
         /// Implementation of IDiagnostics
         ///
@@ -0,0 +1,132 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "NoiseModel.hpp"
+#include "RandomGenerator.hpp"
+#include "StateSimulator.hpp"
+
+namespace Microsoft
+{
+namespace Quantum
+{
+    // Monte Carlo simulation of a noisy program by quantum trajectories: every run of the program on a noisy
+    // `StateSimulator` samples one pure-state trajectory, and the distribution of the results over many runs
+    // converges to that of the density matrix evolution while only needing 2^n amplitudes per run.
+    //
+    // Trajectories are independent, so they are spread over worker threads which pick up fixed-size chunks of
+    // trajectories from a shared atomic counter. Chunk c draws its random numbers from stream c of the seed,
+    // which makes the histogram reproducible regardless of the number of threads or their scheduling.
+    // With more than one worker, each worker runs its simulator's kernels single-threaded, as OpenMP teams opened
+    // from every worker would oversubscribe the cores that the workers already occupy.
+    class TrajectoryRunner
+    {
+      public:
+        // A program runs on a freshly reset simulator and returns the bit string of its measurement results.
+        using Program = std::function<uint64_t(StateSimulator&)>;
+
+        static constexpr long CHUNK_SIZE = 64;
+
+      private:
+        NoiseModel noise;
+        uint32_t seed;
+        unsigned numThreads;
+
+      public:
+        TrajectoryRunner(NoiseModel noise, uint32_t seed = 0, unsigned numThreads = 0)
+            : noise(std::move(noise))
+            , seed(seed)
+            , numThreads(numThreads > 0 ? numThreads : std::max(1u, std::thread::hardware_concurrency()))
+        {}
+
+        // Runs the given number of trajectories and returns how often each result in [0, 2^numResultBits) occurred.
+        std::vector<uint64_t> Run(const Program& program, long numTrajectories, short numResultBits)
+        {
+            if (numResultBits < 0 || numResultBits > 30)
+                throw std::invalid_argument("Histogram is limited to 30 result bits.");
+            const uint64_t numBins = 1ULL << numResultBits;
+
+            // Workers only ever increment the shared bins, which needs no locking. Contention is negligible as
+            // a single increment is tiny compared to the cost of simulating a trajectory.
+            std::vector<std::atomic<uint64_t>> histogram(numBins);
+            std::atomic<long> nextChunk(0);
+            const long numChunks = (numTrajectories + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+            // The first exception thrown by a trajectory stops all workers and is rethrown to the caller.
+            std::exception_ptr error;
+            std::atomic_flag failed = ATOMIC_FLAG_INIT;
+
+            const unsigned numWorkers =
+                static_cast<unsigned>(std::min<long>(this->numThreads, std::max(1L, numChunks)));
+            auto worker = [&]() {
+#ifdef _OPENMP
+              // The calling thread is one of the workers, so its OpenMP thread count is restored afterwards.
+              const int ompThreads = omp_get_max_threads();
+              if (numWorkers > 1)
+                  omp_set_num_threads(1);
+#endif
+              try {
+                // Chunks are claimed in increasing order, so each worker only jumps its stream forward.
+                // Each worker resets one simulator between trajectories, reusing its amplitude buffer.
+                StateSimulator sim(0, 0, this->noise);
+                RandomGenerator stream(this->seed);
+                long streamId = 0;
+                for (long chunk = nextChunk++; chunk < numChunks; chunk = nextChunk++) {
+                    for (; streamId < chunk; streamId++)
+                        stream.Jump();
+                    RandomGenerator chunkRng = stream;
+
+                    long end = std::min(numTrajectories, (chunk + 1) * CHUNK_SIZE);
+                    for (long trajectory = chunk * CHUNK_SIZE; trajectory < end; trajectory++) {
+                        sim.Reset();
+                        sim.SetRngState(chunkRng.GetState());
+                        uint64_t result = program(sim);
+                        chunkRng.SetState(sim.GetRngState());
+
+                        if (result >= numBins)
+                            throw std::out_of_range("Program result exceeds the histogram size.");
+                        histogram[result].fetch_add(1, std::memory_order_relaxed);
+                    }
+                }
+              } catch (...) {
+                if (!failed.test_and_set())
+                    error = std::current_exception();
+                nextChunk = numChunks;
+              }
+#ifdef _OPENMP
+              omp_set_num_threads(ompThreads);
+#endif
+            };
+
+            std::vector<std::thread> threads;
+            for (unsigned i = 1; i < numWorkers; i++)
+                threads.emplace_back(worker);
+            worker();
+            for (std::thread& thread : threads)
+                thread.join();
+            if (error)
+                std::rethrow_exception(error);
+
+            std::vector<uint64_t> counts(numBins);
+            for (uint64_t i = 0; i < numBins; i++)
+                counts[i] = histogram[i].load(std::memory_order_relaxed);
+            return counts;
+        }
+    };
+
+} // namespace Quantum
+} // namespace Microsoft
@@ -1,6 +1,7 @@
 // Copyright (c) Microsoft Corporation. All rights reserved.
 // Licensed under the MIT License.
 
+#include <complex>
 #include <iostream>
 #include <string>
 
@@ -176,3 +177,34 @@ Result TraceSimulator::Measure(long numBases, PauliId bases[], long numTargets,
                   << " in base " << SelectPauli(bases[i]) << std::endl;
     return UseZero();
 }
+
+void TraceSimulator::Swap(Qubit q1, Qubit q2)
+{
+    std::cout << "Swapping qubits " << this->qbm->GetQubitName(q1) << " and "
+              << this->qbm->GetQubitName(q2) << std::endl;
+}
+
+void TraceSimulator::Unitary(long numTargets, Qubit targets[], const std::complex<double> matrix[])
+{
+    ControlledUnitary(0, nullptr, numTargets, targets, matrix);
+}
+
+void TraceSimulator::ControlledUnitary(long numControls, Qubit controls[], long numTargets, Qubit targets[], const std::complex<double> matrix[])
+{
+    long dim = 1L << numTargets;
+    std::cout << "Applying unitary on target qubits ";
+    for (int i = 0; i < numTargets; i++)
+        std::cout << this->qbm->GetQubitName(targets[i]) << " ";
+    if (numControls > 0) {
+        std::cout << " and controlled on qubits ";
+        for (int i = 0; i < numControls; i++)
+            std::cout << this->qbm->GetQubitName(controls[i]) << " ";
+    }
+    std::cout << std::endl;
+    for (long row = 0; row < dim; row++) {
+        std::cout << "   ";
+        for (long col = 0; col < dim; col++)
+            std::cout << " " << matrix[row * dim + col];
+        std::cout << std::endl;
+    }
+}
@@ -3,6 +3,7 @@
 
 #include "QirRuntimeApi_I.hpp"
 #include "QSharpSimApi_I.hpp"
+#include "../ExtendedGateSet_I.hpp"
 
 #include "QubitManager.hpp"
 
@@ -12,7 +13,7 @@ namespace Microsoft
 {
 namespace Quantum
 {
-    class TraceSimulator : public IRuntimeDriver, public IQuantumGateSet
+    class TraceSimulator : public IRuntimeDriver, public IQuantumGateSet, public IExtendedGateSet
     {
         // Associated qubit manager instance to handle qubit representation.
         QubitManager *qbm;
@@ -97,6 +98,16 @@ namespace Quantum
 
         Result Measure(long numBases, PauliId bases[], long numTargets, Qubit targets[]) override;
 
+
+        ///
+        /// Implementation of IExtendedGateSet
+        ///
+        void Swap(Qubit q1, Qubit q2) override;
+
+        void Unitary(long numTargets, Qubit targets[], const std::complex<double> matrix[]) override;
+
+        void ControlledUnitary(long numControls, Qubit controls[], long numTargets, Qubit targets[], const std::complex<double> matrix[]) override;
+
     }; // class TraceSimulator
 
 } // namespace Quantum